@@ -39,6 +39,9 @@
 #include "unix_server.h"
 #include "player.h"
 #include "jsonrpc.h"
+#ifdef DECODER_POOL
+#include "decoder_pool.h"
+#endif
 typedef struct json_request_list_s json_request_list_t;
 struct json_request_list_s
 {
@@ -52,6 +55,7 @@ typedef enum eventsmask_e eventsmask_t;
 enum eventsmask_e
 {
 	ONCHANGE = 0x01,
+	ONANALYSE = 0x02,
 };
 
 typedef struct cmds_ctx_s cmds_ctx_t;
@@ -69,6 +73,10 @@ struct cmds_ctx_s
 	unsigned int eventsmask;
 	int run;
 	int onchangeid;
+#ifdef DECODER_POOL
+	decoder_pool_t *pool;
+	decoder_analyse_t *analyses;
+#endif
 };
 #define CMDS_CTX
 #include "cmds.h"
@@ -553,6 +561,22 @@ static int method_setnext(json_t *json_params, json_t **result, void *userdata)
 	return ret;
 }
 
+static int _duration_entry(void *arg, int id, const char *url,
+		const char *info, const char *mime)
+{
+	uint32_t *duration = (uint32_t *)arg;
+	if (info == NULL)
+		return -1;
+
+	json_error_t error;
+	json_t *json_info = json_loads(info, 0, &error);
+	json_t *value = json_object_get(json_info, str_duration);
+	if (json_is_integer(value))
+		*duration = json_integer_value(value);
+	json_decref(json_info);
+	return 0;
+}
+
 static int method_getposition(json_t *json_params, json_t **result, void *userdata)
 {
 	int ret = -1;
@@ -565,9 +589,22 @@ static int method_getposition(json_t *json_params, json_t **result, void *userda
 	}
 	if (decoder != NULL)
 	{
-		*result = json_pack("{s:i,s:i}",
-			"position", decoder->ops->position(decoder->ctx),
-			"duration", decoder->ops->duration(decoder->ctx));
+		uint32_t duration = 0;
+		if (decoder->ops->duration != NULL)
+			duration = decoder->ops->duration(decoder->ctx);
+		/**
+		 * the decoder may not know the duration without to read
+		 * the whole stream. The media may have it in cache.
+		 */
+		if (duration == 0)
+		{
+			media_t *media = player_media(ctx->player);
+			media->ops->find(media->ctx, player_mediaid(ctx->player), _duration_entry, &duration);
+		}
+		*result = json_pack("{s:i,s:i,s:i}",
+			"position", (decoder->ops->position != NULL)? decoder->ops->position(decoder->ctx) : 0,
+			"duration", duration,
+			"delay", player_delay(ctx->player));
 		ret = 0;
 	}
 	else
@@ -577,6 +614,128 @@ static int method_getposition(json_t *json_params, json_t **result, void *userda
 	return ret;
 }
 
+#ifdef DECODER_POOL
+static void _analyse_free(decoder_analyse_t *analyse)
+{
+	free(analyse->url);
+	free(analyse->waveform);
+	free(analyse);
+}
+
+static void _analyse_done(void *arg, decoder_analyse_t *analyse)
+{
+	cmds_ctx_t *ctx = (cmds_ctx_t *)arg;
+
+	pthread_mutex_lock(&ctx->mutex);
+	analyse->next = ctx->analyses;
+	ctx->analyses = analyse;
+	ctx->eventsmask |= ONANALYSE;
+	pthread_mutex_unlock(&ctx->mutex);
+	pthread_cond_broadcast(&ctx->cond);
+}
+
+static int _analyse_entry(void *arg, int id, const char *url,
+		const char *info, const char *mime)
+{
+	decoder_analyse_t *analyse = (decoder_analyse_t *)arg;
+	if (url == NULL)
+		return -1;
+	analyse->url = strdup(url);
+	analyse->mime = utils_mime2mime(mime);
+	return 0;
+}
+
+/**
+ * the analyse runs on the decoder pool and the method leaves
+ * immediately. Each result is sent with the "onanalyse" notification.
+ */
+static int method_analyse(json_t *json_params, json_t **result, void *userdata)
+{
+	cmds_ctx_t *ctx = (cmds_ctx_t *)userdata;
+	media_t *media = player_media(ctx->player);
+	cmds_dbg("cmds: analyse");
+
+	json_t *ids = json_object_get(json_params, "id");
+	if (json_is_integer(ids))
+	{
+		json_t *array = json_array();
+		json_array_append(array, ids);
+		ids = array;
+	}
+	else if (json_is_array(ids))
+		json_incref(ids);
+	else
+	{
+		*result = jsonrpc_error_object_predefined(JSONRPC_INVALID_PARAMS, json_string("id not found"));
+		return -1;
+	}
+	unsigned int nwaveform = 0;
+	json_t *value = json_object_get(json_params, "waveform");
+	if (json_is_integer(value) && json_integer_value(value) > 0)
+		nwaveform = json_integer_value(value);
+
+	if (ctx->pool == NULL)
+		ctx->pool = decoder_pool_init(0);
+
+	int queued = 0;
+	int index;
+	json_array_foreach(ids, index, value)
+	{
+		if (!json_is_integer(value))
+			continue;
+		decoder_analyse_t *analyse = calloc(1, sizeof(*analyse));
+		analyse->id = json_integer_value(value);
+		analyse->nwaveform = nwaveform;
+		analyse->cb = _analyse_done;
+		analyse->arg = ctx;
+		if (media->ops->find(media->ctx, analyse->id, _analyse_entry, analyse) == 1 &&
+			decoder_pool_add(ctx->pool, analyse) == 0)
+			queued++;
+		else
+			_analyse_free(analyse);
+	}
+	json_decref(ids);
+	*result = json_pack("{s:i}", "queued", queued);
+	return 0;
+}
+
+static int method_onanalyse(json_t *json_params, json_t **result, void *userdata)
+{
+	cmds_ctx_t *ctx = (cmds_ctx_t *)userdata;
+	json_t *analyses = json_array();
+	decoder_analyse_t *analyse = ctx->analyses;
+	while (analyse != NULL)
+	{
+		json_t *object;
+		if (analyse->result == 0)
+		{
+			object = json_pack("{s:i,s:s,s:i,s:i,s:I,s:i,s:f}",
+				"id", analyse->id,
+				"url", analyse->url,
+				"duration", analyse->duration,
+				"samplerate", analyse->samplerate,
+				"nsamples", (json_int_t)analyse->nsamples,
+				"peak", analyse->peak,
+				"replaygain", (double)analyse->regain / 100);
+			if (analyse->waveform != NULL)
+			{
+				json_t *waveform = json_array();
+				int i;
+				for (i = 0; i < analyse->nwaveform; i++)
+					json_array_append_new(waveform, json_integer(analyse->waveform[i]));
+				json_object_set_new(object, "waveform", waveform);
+			}
+		}
+		else
+			object = json_pack("{s:i,s:s}", "id", analyse->id, "error", "decoding error");
+		json_array_append_new(analyses, object);
+		analyse = analyse->next;
+	}
+	*result = json_pack("{s:o}", "analyses", analyses);
+	return 0;
+}
+#endif
+
 typedef struct _display_ctx_s _display_ctx_t;
 struct _display_ctx_s
 {
@@ -730,6 +889,9 @@ static int method_onchange(json_t *json_params, json_t **result, void *userdata)
 	const char *mediapath = media_path();
 	json_object_set(*result, "media", json_string(mediapath));
 
+	/// expected delay in ms between the decoding and the output
+	json_object_set(*result, "delay", json_integer(player_delay(ctx->player)));
+
 	json_t *options = json_array();
 	if (media->ops->loop && media->ops->loop(media->ctx, OPTION_REQUEST) == OPTION_ENABLE)
 		json_array_append(options, json_string("loop"));
@@ -881,6 +1043,14 @@ static int method_capabilities(json_t *json_params, json_t **result, void *userd
 	params = json_object();
 	json_object_set(event, "params", params);
 	json_array_append(events, event);
+#ifdef DECODER_POOL
+	event = json_object();
+	value = json_string("onanalyse");
+	json_object_set(event, "method", value);
+	params = json_object();
+	json_object_set(event, "params", params);
+	json_array_append(events, event);
+#endif
 	json_object_set(*result, "events", events);
 
 	json_t *actions;
@@ -1041,6 +1211,18 @@ static int method_capabilities(json_t *json_params, json_t **result, void *userd
 		json_object_set(action, "params", params);
 		json_array_append(actions, action);
 	}
+#ifdef DECODER_POOL
+	action = json_object();
+	value = json_string("analyse");
+	json_object_set(action, "method", value);
+	params = json_array();
+	value = json_string("id");
+	json_array_append(params, value);
+	value = json_string("waveform");
+	json_array_append(params, value);
+	json_object_set(action, "params", params);
+	json_array_append(actions, action);
+#endif
 	if (ctx->sink && ctx->sink->ops->getvolume != NULL)
 	{
 		action = json_object();
@@ -1166,6 +1348,10 @@ static struct jsonrpc_method_entry_t method_table[] = {
 	{ 'r', "options", method_options, "o" },
 	{ 'r', "volume", method_volume, "o" },
 	{ 'r', "getposition", method_getposition, "" },
+#ifdef DECODER_POOL
+	{ 'r', "analyse", method_analyse, "o" },
+	{ 'n', "onanalyse", method_onanalyse, "o" },
+#endif
 	{ 0, NULL },
 };
 
@@ -1382,6 +1568,30 @@ static void *_cmds_json_pthreadsend(void *arg)
 				}
 				ctx->eventsmask &= ~ONCHANGE;
 			}
+#ifdef DECODER_POOL
+			if ((ctx->eventsmask & ONANALYSE) == ONANALYSE)
+			{
+				thread_info_t *info = ctx->info;
+				while (info)
+				{
+					thread_info_t *next = info->next;
+					int ret = jsonrpc_sendevent(ctx, info, "onanalyse");
+					if (ret < 0)
+					{
+						err("cmds: sendevent error %d", ret);
+						_cmds_json_removeinfo(ctx, info);
+					}
+					info = next;
+				}
+				while (ctx->analyses != NULL)
+				{
+					decoder_analyse_t *next = ctx->analyses->next;
+					_analyse_free(ctx->analyses);
+					ctx->analyses = next;
+				}
+				ctx->eventsmask &= ~ONANALYSE;
+			}
+#endif
 		}
 		pthread_mutex_unlock(&ctx->mutex);
 	}
@@ -1514,6 +1724,16 @@ static void cmds_json_destroy(cmds_ctx_t *ctx)
 	ctx->onchangeid = 0;
 	ctx->info = NULL;
 	pthread_join(ctx->threadrecv, NULL);
+#ifdef DECODER_POOL
+	if (ctx->pool != NULL)
+		decoder_pool_destroy(ctx->pool);
+	while (ctx->analyses != NULL)
+	{
+		decoder_analyse_t *next = ctx->analyses->next;
+		_analyse_free(ctx->analyses);
+		ctx->analyses = next;
+	}
+#endif
 	ctx->run = 0;
 	pthread_cond_broadcast(&ctx->cond);
 	pthread_join(ctx->threadsend, NULL);
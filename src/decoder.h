@@ -22,6 +22,11 @@ struct decoder_ops_s
 	const char *(*mime)(decoder_ctx_t *ctx);
 	uint32_t (*position)(decoder_ctx_t *ctx);
 	uint32_t (*duration)(decoder_ctx_t *ctx);
+	/**
+	 * optional: the source lost nsamples (at the clockrate of the source)
+	 * after offset bytes of the input stream. The decoder replaces them.
+	 */
+	int (*conceal)(decoder_ctx_t *ctx, size_t offset, uint32_t nsamples, unsigned int clockrate);
 	void (*destroy)(decoder_ctx_t *);
 };
 
@@ -35,8 +40,16 @@ struct decoder_s
 decoder_t *decoder_build(player_ctx_t *player, const char *mime);
 const char *decoder_mimelist(int first);
 const decoder_ops_t *decoder_check(const char *path);
+/**
+ * the cache decoder replays the PCM of the short media already played,
+ * otherwise it records the output of the decoder built for the mime.
+ */
+decoder_t *decoder_cache_build(player_ctx_t *player, const char *mime, int mediaid, jitter_format_t format);
+void decoder_cache_complete(decoder_t *decoder);
 
 extern const decoder_ops_t *decoder_mad;
 extern const decoder_ops_t *decoder_flac;
 extern const decoder_ops_t *decoder_passthrough;
+extern const decoder_ops_t *decoder_cache;
+extern const decoder_ops_t *decoder_transmux;
 #endif
@@ -0,0 +1,494 @@
+/*****************************************************************************
+ * decoder_cache.c
+ * this file is part of https://github.com/ouistiti-project/putv
+ *****************************************************************************
+ * Copyright (C) 2016-2017
+ *
+ * Authors: Marc Chalain <marc.chalain@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "player.h"
+typedef struct decoder_s decoder_t;
+typedef struct decoder_ops_s decoder_ops_t;
+typedef struct decoder_ctx_s decoder_ctx_t;
+typedef struct cache_entry_s cache_entry_t;
+struct decoder_ctx_s
+{
+	const decoder_ops_t *ops;
+	player_ctx_t *player;
+	int mediaid;
+	/// the real decoder, NULL on a hit
+	decoder_t *decoder;
+	/// on a hit, the entry to replay
+	cache_entry_t *entry;
+	/// on a miss, the entry under recording
+	cache_entry_t *record;
+	int complete;
+	int closing;
+	jitter_t *in;
+	jitter_t *tee;
+	jitter_t *out;
+	size_t offset;
+	unsigned int samplesize;
+	pthread_t thread;
+};
+#define DECODER_CTX
+#include "decoder.h"
+#include "media.h"
+#include "jitter.h"
+
+#define err(format, ...) fprintf(stderr, "\x1B[31m"format"\x1B[0m\n",  ##__VA_ARGS__)
+#define warn(format, ...) fprintf(stderr, "\x1B[35m"format"\x1B[0m\n",  ##__VA_ARGS__)
+#ifdef DEBUG
+#define dbg(format, ...) fprintf(stderr, "\x1B[32m"format"\x1B[0m\n",  ##__VA_ARGS__)
+#else
+#define dbg(...)
+#endif
+
+#define cache_dbg(...)
+
+#ifndef DECODER_CACHE_SIZE
+#define DECODER_CACHE_SIZE 16384
+#endif
+/// budget of the cache in bytes
+#define CACHE_BUDGET ((size_t)DECODER_CACHE_SIZE * 1024)
+/// only the short media are cached
+#define CACHE_ENTRYMAX (CACHE_BUDGET / 4)
+
+/**
+ * The entries are sorted from the most recently used (head)
+ * to the least recently used (tail).
+ */
+struct cache_entry_s
+{
+	int mediaid;
+	jitter_format_t format;
+	unsigned int samplerate;
+	unsigned char *data;
+	size_t length;
+	size_t size;
+	/// number of decoders replaying the entry, it cannot be evicted
+	int refs;
+	cache_entry_t *prev;
+	cache_entry_t *next;
+};
+
+static struct
+{
+	pthread_mutex_t mutex;
+	cache_entry_t *head;
+	cache_entry_t *tail;
+	size_t length;
+} g_cache = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static const char *jitter_name = "cache";
+
+static void _cache_unlink(cache_entry_t *entry)
+{
+	if (entry->prev)
+		entry->prev->next = entry->next;
+	else
+		g_cache.head = entry->next;
+	if (entry->next)
+		entry->next->prev = entry->prev;
+	else
+		g_cache.tail = entry->prev;
+	entry->prev = NULL;
+	entry->next = NULL;
+}
+
+static void _cache_linkhead(cache_entry_t *entry)
+{
+	entry->prev = NULL;
+	entry->next = g_cache.head;
+	if (g_cache.head)
+		g_cache.head->prev = entry;
+	g_cache.head = entry;
+	if (g_cache.tail == NULL)
+		g_cache.tail = entry;
+}
+
+static void _cache_free(cache_entry_t *entry)
+{
+	free(entry->data);
+	free(entry);
+}
+
+/**
+ * the mutex must be locked
+ */
+static void _cache_evict(size_t length)
+{
+	cache_entry_t *entry = g_cache.tail;
+	while (entry != NULL && g_cache.length + length > CACHE_BUDGET)
+	{
+		cache_entry_t *prev = entry->prev;
+		if (entry->refs == 0)
+		{
+			cache_dbg("decoder: cache evicts %d", entry->mediaid);
+			_cache_unlink(entry);
+			g_cache.length -= entry->length;
+			_cache_free(entry);
+		}
+		entry = prev;
+	}
+}
+
+static cache_entry_t *_cache_lookup(int mediaid, jitter_format_t format)
+{
+	cache_entry_t *entry;
+	pthread_mutex_lock(&g_cache.mutex);
+	for (entry = g_cache.head; entry != NULL; entry = entry->next)
+	{
+		if (entry->mediaid == mediaid && entry->format == format)
+		{
+			_cache_unlink(entry);
+			_cache_linkhead(entry);
+			entry->refs++;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&g_cache.mutex);
+	return entry;
+}
+
+static void _cache_release(cache_entry_t *entry)
+{
+	pthread_mutex_lock(&g_cache.mutex);
+	entry->refs--;
+	pthread_mutex_unlock(&g_cache.mutex);
+}
+
+static void _cache_insert(cache_entry_t *entry)
+{
+	pthread_mutex_lock(&g_cache.mutex);
+	cache_entry_t *it;
+	for (it = g_cache.head; it != NULL; it = it->next)
+	{
+		if (it->mediaid == entry->mediaid && it->format == entry->format)
+			break;
+	}
+	if (it != NULL)
+	{
+		/// another player recorded the same media first
+		_cache_free(entry);
+	}
+	else
+	{
+		_cache_evict(entry->length);
+		_cache_linkhead(entry);
+		g_cache.length += entry->length;
+		dbg("decoder: cache %d stores %lu bytes (%lu/%lu)", entry->mediaid,
+				entry->length, g_cache.length, CACHE_BUDGET);
+	}
+	pthread_mutex_unlock(&g_cache.mutex);
+}
+
+/**
+ * on a miss, the decoder pushes into the tee and the tee records
+ * the PCM before forwarding it to the encoder jitter.
+ */
+static int _cache_tee(void *arg, unsigned char *buffer, size_t size)
+{
+	decoder_ctx_t *ctx = (decoder_ctx_t *)arg;
+	cache_entry_t *record = ctx->record;
+
+	if (ctx->out->ctx->frequence == 0)
+		ctx->out->ctx->frequence = ctx->tee->ctx->frequence;
+	if (record != NULL && ctx->closing)
+	{
+		/// the player stops the media before its end
+		ctx->record = NULL;
+		_cache_free(record);
+	}
+	else if (record != NULL)
+	{
+		if (record->length + size > CACHE_ENTRYMAX)
+		{
+			cache_dbg("decoder: cache %d too long", ctx->mediaid);
+			ctx->record = NULL;
+			_cache_free(record);
+		}
+		else
+		{
+			if (record->length + size > record->size)
+			{
+				size_t newsize = record->size * 2;
+				if (newsize < record->length + size)
+					newsize = record->length + size;
+				if (newsize > CACHE_ENTRYMAX)
+					newsize = CACHE_ENTRYMAX;
+				unsigned char *data = realloc(record->data, newsize);
+				if (data == NULL)
+				{
+					ctx->record = NULL;
+					_cache_free(record);
+					record = NULL;
+				}
+				else
+				{
+					record->data = data;
+					record->size = newsize;
+				}
+			}
+			if (record != NULL)
+			{
+				memcpy(record->data + record->length, buffer, size);
+				record->length += size;
+			}
+		}
+	}
+
+	size_t offset = 0;
+	while (offset < size)
+	{
+		unsigned char *outbuffer = ctx->out->ops->pull(ctx->out->ctx);
+		if (outbuffer == NULL)
+		{
+			/// the encoder is flushed, the record cannot be complete
+			ctx->closing = 1;
+			break;
+		}
+		size_t len = size - offset;
+		if (len > ctx->out->ctx->size)
+			len = ctx->out->ctx->size;
+		memcpy(outbuffer, buffer + offset, len);
+		ctx->out->ops->push(ctx->out->ctx, len, NULL);
+		offset += len;
+	}
+	return size;
+}
+
+static void *_cache_thread(void *arg)
+{
+	decoder_ctx_t *ctx = (decoder_ctx_t *)arg;
+	cache_entry_t *entry = ctx->entry;
+
+	dbg("decoder: cache %d replays %lu bytes", ctx->mediaid, entry->length);
+	while (ctx->offset < entry->length)
+	{
+		unsigned char *outbuffer = ctx->out->ops->pull(ctx->out->ctx);
+		if (outbuffer == NULL)
+			break;
+		size_t len = entry->length - ctx->offset;
+		if (len > ctx->out->ctx->size)
+			len = ctx->out->ctx->size;
+		memcpy(outbuffer, entry->data + ctx->offset, len);
+		ctx->out->ops->push(ctx->out->ctx, len, NULL);
+		ctx->offset += len;
+	}
+	if (ctx->player != NULL)
+		player_state(ctx->player, STATE_CHANGE);
+	return NULL;
+}
+
+static decoder_ctx_t *_decoder_init(player_ctx_t *player)
+{
+	decoder_ctx_t *ctx = calloc(1, sizeof(*ctx));
+	ctx->ops = decoder_cache;
+	ctx->player = player;
+	ctx->mediaid = -1;
+
+	return ctx;
+}
+
+static jitter_t *_decoder_jitter(decoder_ctx_t *ctx, jitte_t jitte)
+{
+	if (ctx->decoder != NULL)
+		return ctx->decoder->ops->jitter(ctx->decoder->ctx, jitte);
+	/**
+	 * on a hit, the source is attached to a small jitter
+	 * which is never read.
+	 */
+	if (ctx->in == NULL)
+		ctx->in = jitter_scattergather_init(jitter_name, 1, 1);
+	return ctx->in;
+}
+
+static int _decoder_prepare(decoder_ctx_t *ctx)
+{
+	if (ctx->decoder != NULL && ctx->decoder->ops->prepare != NULL)
+		return ctx->decoder->ops->prepare(ctx->decoder->ctx);
+	return 0;
+}
+
+static int _decoder_run(decoder_ctx_t *ctx, jitter_t *jitter)
+{
+	ctx->out = jitter;
+	ctx->samplesize = utils_format2framesize(jitter->format);
+	if (ctx->entry != NULL && ctx->entry->format != jitter->format)
+	{
+		err("decoder: cache %d bad format", ctx->mediaid);
+		return -1;
+	}
+	if (ctx->entry != NULL)
+	{
+		if (jitter->ctx->frequence == 0)
+			jitter->ctx->frequence = ctx->entry->samplerate;
+		else if (jitter->ctx->frequence != ctx->entry->samplerate)
+			err("decoder: cache samplerate %d not supported", ctx->entry->samplerate);
+		return pthread_create(&ctx->thread, NULL, _cache_thread, ctx);
+	}
+
+	if (ctx->samplesize > 0)
+	{
+		ctx->tee = jitter_scattergather_init(jitter_name, 2, jitter->ctx->size);
+		ctx->tee->format = jitter->format;
+		ctx->tee->ctx->frequence = jitter->ctx->frequence;
+		ctx->tee->ctx->thredhold = 0;
+		ctx->tee->ctx->consume = _cache_tee;
+		ctx->tee->ctx->consumer = ctx;
+
+		ctx->record = calloc(1, sizeof(*ctx->record));
+		ctx->record->mediaid = ctx->mediaid;
+		ctx->record->format = jitter->format;
+		int ret = ctx->decoder->ops->run(ctx->decoder->ctx, ctx->tee);
+		if (ret != 0)
+		{
+			_cache_free(ctx->record);
+			ctx->record = NULL;
+		}
+		return ret;
+	}
+	return ctx->decoder->ops->run(ctx->decoder->ctx, jitter);
+}
+
+static const char *_decoder_mime(decoder_ctx_t *ctx)
+{
+	if (ctx->decoder != NULL && ctx->decoder->ops->mime != NULL)
+		return ctx->decoder->ops->mime(ctx->decoder->ctx);
+	return mime_audiopcm;
+}
+
+static uint32_t _decoder_position(decoder_ctx_t *ctx)
+{
+	if (ctx->decoder != NULL)
+	{
+		if (ctx->decoder->ops->position != NULL)
+			return ctx->decoder->ops->position(ctx->decoder->ctx);
+		return 0;
+	}
+	if (ctx->samplesize == 0 || ctx->entry->samplerate == 0)
+		return 0;
+	return ctx->offset / ctx->samplesize / ctx->entry->samplerate;
+}
+
+static uint32_t _decoder_duration(decoder_ctx_t *ctx)
+{
+	if (ctx->decoder != NULL)
+	{
+		if (ctx->decoder->ops->duration != NULL)
+			return ctx->decoder->ops->duration(ctx->decoder->ctx);
+		return 0;
+	}
+	if (ctx->samplesize == 0 || ctx->entry->samplerate == 0)
+		return 0;
+	return ctx->entry->length / ctx->samplesize / ctx->entry->samplerate;
+}
+
+static void _decoder_destroy(decoder_ctx_t *ctx)
+{
+	ctx->closing = 1;
+	if (ctx->out)
+		ctx->out->ops->flush(ctx->out->ctx);
+	if (ctx->thread > 0)
+		pthread_join(ctx->thread, NULL);
+	uint32_t duration = 0;
+	if (ctx->decoder != NULL)
+	{
+		duration = _decoder_duration(ctx);
+		ctx->decoder->ops->destroy(ctx->decoder->ctx);
+		free(ctx->decoder);
+	}
+	if (ctx->record != NULL)
+	{
+		cache_entry_t *record = ctx->record;
+		record->samplerate = ctx->tee->ctx->frequence;
+		/**
+		 * the end of the source is not the end of the decoding,
+		 * the duration from the headers checks the tail is there.
+		 */
+		if (ctx->complete && record->length > 0 && record->samplerate > 0 &&
+			(duration == 0 ||
+			record->length / ctx->samplesize / record->samplerate + 1 >= duration))
+			_cache_insert(record);
+		else
+			_cache_free(record);
+	}
+	if (ctx->entry != NULL)
+		_cache_release(ctx->entry);
+	if (ctx->tee != NULL)
+		jitter_scattergather_destroy(ctx->tee);
+	if (ctx->in != NULL)
+		jitter_scattergather_destroy(ctx->in);
+	free(ctx);
+}
+
+const decoder_ops_t *decoder_cache = &(decoder_ops_t)
+{
+	.name = "cache",
+	.init = _decoder_init,
+	.jitter = _decoder_jitter,
+	.prepare = _decoder_prepare,
+	.run = _decoder_run,
+	.mime = _decoder_mime,
+	.position = _decoder_position,
+	.duration = _decoder_duration,
+	.destroy = _decoder_destroy,
+};
+
+decoder_t *decoder_cache_build(player_ctx_t *player, const char *mime, int mediaid, jitter_format_t format)
+{
+	decoder_t *decoder = NULL;
+	cache_entry_t *entry = NULL;
+
+	if (mediaid < 0)
+		return decoder_build(player, mime);
+	entry = _cache_lookup(mediaid, format);
+	if (entry == NULL)
+	{
+		decoder = decoder_build(player, mime);
+		if (decoder == NULL)
+			return NULL;
+	}
+	decoder_ctx_t *ctx = decoder_cache->init(player);
+	ctx->mediaid = mediaid;
+	ctx->entry = entry;
+	ctx->decoder = decoder;
+	decoder = calloc(1, sizeof(*decoder));
+	decoder->ops = decoder_cache;
+	decoder->ctx = ctx;
+	return decoder;
+}
+
+void decoder_cache_complete(decoder_t *decoder)
+{
+	if (decoder != NULL && decoder->ops == decoder_cache)
+		decoder->ctx->complete = 1;
+}
@@ -157,6 +157,10 @@ output_cb(const FLAC__StreamDecoder *decoder,
 	}
 	else if (ctx->out->ctx->frequence != audio.samplerate)
 	{
+#ifdef FILTER_RESAMPLING
+		/// the filter resamples to the rate of the output
+		if (ctx->filter->ops->ratio == NULL)
+#endif
 		err("decoder: samplerate %d not supported", ctx->out->ctx->frequence);
 	}
 
@@ -172,6 +176,10 @@ output_cb(const FLAC__StreamDecoder *decoder,
 	unsigned int nsamples;
 	if (audio.nchannels == 1)
 		audio.samples[1] = audio.samples[0];
+#ifdef FILTER_RESAMPLING
+	if (ctx->player != NULL && ctx->filter->ops->ratio != NULL)
+		ctx->filter->ops->ratio(ctx->filter->ctx, player_ratio(ctx->player, 0));
+#endif
 
 	while (audio.nsamples > 0)
 	{
@@ -249,7 +257,8 @@ static void *_decoder_thread(void *arg)
 	}
 
 	dbg("decoder: stop running");
-	player_state(ctx->player, STATE_CHANGE);
+	if (ctx->player != NULL)
+		player_state(ctx->player, STATE_CHANGE);
 
 	return (void *)(intptr_t)result;
 }
@@ -297,7 +306,13 @@ static int _decoder_run(decoder_ctx_t *ctx, jitter_t *jitter)
 	 */
 	if (ctx->filter)
 		ret = ctx->filter->ops->set(ctx->filter->ctx, NULL, jitter->format, jitter->ctx->frequence);
-	if (ret == 0)
+	/**
+	 * without player, the decoder runs in offline mode:
+	 * the caller's thread decodes the whole stream.
+	 */
+	if (ret == 0 && ctx->player == NULL)
+		_decoder_thread(ctx);
+	else if (ret == 0)
 		pthread_create(&ctx->thread, NULL, _decoder_thread, ctx);
 	return ret;
 }
@@ -63,7 +63,21 @@ struct decoder_ctx_s
 	heartbeat_t heartbeat;
 	beat_samples_t beat;
 	mad_timer_t position;
+	uint32_t duration;
 	unsigned int nloops;
+#ifdef RTP_PLC
+	/// bytes of the input stream consumed
+	size_t inoffset;
+	/// the last frame decoded, repeated during a loss
+	mad_fixed_t plcsamples[2][1152];
+	unsigned int plclength;
+	unsigned int plcchannels;
+	/// the loss to conceal, set by the source
+	size_t plcoffset;
+	uint32_t plcnsamples;
+	unsigned int plcclockrate;
+	int plcfadein;
+#endif
 };
 #define DECODER_CTX
 #include "decoder.h"
@@ -107,6 +121,10 @@ enum mad_flow input(void *data,
 	if (stream->next_frame)
 		len = stream->next_frame - ctx->inbuffer;
 	ctx->in->ops->pop(ctx->in->ctx, len);
+#ifdef RTP_PLC
+	if (ctx->inbuffer != NULL)
+		ctx->inoffset += len;
+#endif
 
 	ctx->inbuffer = ctx->in->ops->peer(ctx->in->ctx, NULL);
 
@@ -131,6 +149,141 @@ static clockid_t clockid = CLOCK_REALTIME;
 static struct timespec start = {0, 0};
 #endif
 
+static enum mad_flow _decoder_write(decoder_ctx_t *ctx, filter_audio_t *audio, unsigned int length)
+{
+#ifdef FILTER_RESAMPLING
+	if (ctx->player != NULL && ctx->filter->ops->ratio != NULL)
+		ctx->filter->ops->ratio(ctx->filter->ctx, player_ratio(ctx->player, 0));
+#endif
+	while (audio->nsamples > 0)
+	{
+		if (ctx->outbuffer == NULL)
+		{
+			ctx->outbuffer = ctx->out->ops->pull(ctx->out->ctx);
+			/**
+			 * the pipe is broken. close the src and the decoder
+			 */
+			if (ctx->outbuffer == NULL)
+			{
+				ctx->outbufferlen = 0;
+				/**
+				 * flush the src jitter to break the stream
+				 */
+				ctx->in->ops->flush(ctx->in->ctx);
+				return MAD_FLOW_STOP;
+			}
+		}
+
+		ctx->outbufferlen +=
+			ctx->filter->ops->run(ctx->filter->ctx, audio,
+				ctx->outbuffer + ctx->outbufferlen,
+				ctx->out->ctx->size - ctx->outbufferlen);
+
+		if (ctx->outbufferlen >= ctx->out->ctx->size)
+		{
+			if (ctx->outbufferlen > ctx->out->ctx->size)
+				err("decoder: out %ld %ld", ctx->outbufferlen, ctx->out->ctx->size);
+#ifdef DECODER_HEARTBEAT
+			ctx->beat.nsamples += length - audio->nsamples;
+			if (ctx->nloops == ctx->out->ctx->count)
+			{
+				decoder_dbg("decoder: heart boom %d", ctx->beat.nsamples);
+				ctx->out->ops->push(ctx->out->ctx, ctx->out->ctx->size, &ctx->beat);
+				ctx->beat.nsamples = 0;
+				ctx->nloops = 0;
+			}
+			else
+#endif
+				ctx->out->ops->push(ctx->out->ctx, ctx->out->ctx->size, NULL);
+			ctx->nloops++;
+			ctx->outbuffer = NULL;
+			ctx->outbufferlen = 0;
+		}
+#ifdef DECODER_HEARTBEAT
+		else
+		{
+			ctx->beat.nsamples += length;
+		}
+#endif
+	}
+
+	return MAD_FLOW_CONTINUE;
+}
+
+#ifdef RTP_PLC
+/// number of frames repeated before the silence
+#define PLC_FADE 4
+
+/**
+ * @brief apply a linear gain from gain0 to gain1 on the samples
+ */
+static void _decoder_plcfade(decoder_ctx_t *ctx, mad_fixed_t samples[2][1152],
+		unsigned int nchannels, unsigned int length, mad_fixed_t gain0, mad_fixed_t gain1)
+{
+	unsigned int i;
+	unsigned int j;
+	if (length == 0)
+		return;
+	mad_fixed_t step = (gain1 - gain0) / (mad_fixed_t)length;
+	for (j = 0; j < nchannels && j < 2; j++)
+	{
+		mad_fixed_t gain = gain0;
+		for (i = 0; i < length; i++)
+		{
+			samples[j][i] = mad_f_mul(samples[j][i], gain);
+			gain += step;
+		}
+	}
+}
+
+/**
+ * @brief repeat the last frame with a fade out for the duration of the loss,
+ * the number of samples sent to the sink stays the same.
+ */
+static enum mad_flow _decoder_conceal(decoder_ctx_t *ctx, unsigned int samplerate)
+{
+	uint32_t nsamples = __sync_lock_test_and_set(&ctx->plcnsamples, 0);
+	if (ctx->plclength == 0 || ctx->plcclockrate == 0)
+		return MAD_FLOW_CONTINUE;
+	nsamples = (uint64_t)nsamples * samplerate / ctx->plcclockrate;
+	dbg("decoder mad: conceal %u samples", nsamples);
+
+	mad_fixed_t samples[2][1152];
+	unsigned int frame = 0;
+	while (nsamples > 0)
+	{
+		unsigned int length = (nsamples < ctx->plclength)? nsamples : ctx->plclength;
+		int i;
+		for (i = 0; i < ctx->plcchannels && i < 2; i++)
+		{
+			if (frame < PLC_FADE)
+				memcpy(samples[i], ctx->plcsamples[i], length * sizeof(mad_fixed_t));
+			else
+				memset(samples[i], 0, length * sizeof(mad_fixed_t));
+		}
+		if (frame < PLC_FADE)
+			_decoder_plcfade(ctx, samples, ctx->plcchannels, length,
+				MAD_F_ONE / PLC_FADE * (PLC_FADE - frame),
+				MAD_F_ONE / PLC_FADE * (PLC_FADE - frame - 1));
+
+		filter_audio_t audio;
+		audio.samplerate = samplerate;
+		audio.nchannels = ctx->plcchannels;
+		audio.nsamples = length;
+		audio.bitspersample = 24;
+		audio.regain = 0;
+		audio.samples[0] = samples[0];
+		audio.samples[1] = (ctx->plcchannels > 1)? samples[1] : samples[0];
+		if (_decoder_write(ctx, &audio, length) == MAD_FLOW_STOP)
+			return MAD_FLOW_STOP;
+		nsamples -= length;
+		frame++;
+	}
+	ctx->plcfadein = 1;
+	return MAD_FLOW_CONTINUE;
+}
+#endif
+
 static
 enum mad_flow output(void *data,
 		     struct mad_header const *header,
@@ -164,6 +317,10 @@ enum mad_flow output(void *data,
 	}
 	else if (ctx->out->ctx->frequence != pcm->samplerate)
 	{
+#ifdef FILTER_RESAMPLING
+		/// the filter resamples to the rate of the output
+		if (ctx->filter->ops->ratio == NULL)
+#endif
 		err("decoder mad: samplerate %d not supported", ctx->out->ctx->frequence);
 	}
 
@@ -181,59 +338,23 @@ enum mad_flow output(void *data,
 	if (audio.nchannels == 1)
 		audio.samples[1] = audio.samples[0];
 
-	while (audio.nsamples > 0)
+#ifdef RTP_PLC
+	if (ctx->plcnsamples > 0)
 	{
-		if (ctx->outbuffer == NULL)
-		{
-			ctx->outbuffer = ctx->out->ops->pull(ctx->out->ctx);
-			/**
-			 * the pipe is broken. close the src and the decoder
-			 */
-			if (ctx->outbuffer == NULL)
-			{
-				ctx->outbufferlen = 0;
-				/**
-				 * flush the src jitter to break the stream
-				 */
-				ctx->in->ops->flush(ctx->in->ctx);
-				return MAD_FLOW_STOP;
-			}
-		}
-
-		ctx->outbufferlen +=
-			ctx->filter->ops->run(ctx->filter->ctx, &audio,
-				ctx->outbuffer + ctx->outbufferlen,
-				ctx->out->ctx->size - ctx->outbufferlen);
-
-		if (ctx->outbufferlen >= ctx->out->ctx->size)
-		{
-			if (ctx->outbufferlen > ctx->out->ctx->size)
-				err("decoder: out %ld %ld", ctx->outbufferlen, ctx->out->ctx->size);
-#ifdef DECODER_HEARTBEAT
-			ctx->beat.nsamples += pcm->length - audio.nsamples;
-			if (ctx->nloops == ctx->out->ctx->count)
-			{
-				decoder_dbg("decoder: heart boom %d", ctx->beat.nsamples);
-				ctx->out->ops->push(ctx->out->ctx, ctx->out->ctx->size, &ctx->beat);
-				ctx->beat.nsamples = 0;
-				ctx->nloops = 0;
-			}
-			else
-#endif
-				ctx->out->ops->push(ctx->out->ctx, ctx->out->ctx->size, NULL);
-			ctx->nloops++;
-			ctx->outbuffer = NULL;
-			ctx->outbufferlen = 0;
-		}
-#ifdef DECODER_HEARTBEAT
-		else
-		{
-			ctx->beat.nsamples += pcm->length;
-		}
-#endif
+		struct mad_stream *stream = &ctx->decoder.sync->stream;
+		size_t offset = ctx->inoffset + (stream->this_frame - ctx->inbuffer);
+		if (offset >= ctx->plcoffset && _decoder_conceal(ctx, pcm->samplerate) == MAD_FLOW_STOP)
+			return MAD_FLOW_STOP;
 	}
-
-	return MAD_FLOW_CONTINUE;
+	if (ctx->plcfadein)
+		_decoder_plcfade(ctx, pcm->samples, pcm->channels, pcm->length, 0, MAD_F_ONE);
+	ctx->plcfadein = 0;
+	for (i = 0; i < pcm->channels && i < 2; i++)
+		memcpy(ctx->plcsamples[i], pcm->samples[i], pcm->length * sizeof(mad_fixed_t));
+	ctx->plclength = pcm->length;
+	ctx->plcchannels = pcm->channels;
+#endif
+	return _decoder_write(ctx, &audio, pcm->length);
 }
 
 static
@@ -284,6 +405,21 @@ enum mad_flow header(void *data, struct mad_header const *header)
 	decoder_ctx_t *ctx = (decoder_ctx_t *)data;
 	decoder_dbg("decoder mad: audio header mpeg1layer%d, flag 0x%x", header->layer, header->flags);
 	decoder_dbg("decoder mad: bitrate %d , samplerate %d", header->bitrate, header->samplerate);
+	/**
+	 * the first frame may contain the Xing or VBRI header
+	 */
+	if (mad_timer_sign(ctx->position) == 0)
+	{
+		struct mad_stream *stream = &ctx->decoder.sync->stream;
+		uint64_t nsamples = 0;
+		unsigned int samplerate = 0;
+		if (utils_mp3vbrheader(stream->this_frame, stream->bufend - stream->this_frame,
+				&nsamples, &samplerate) == 0 && samplerate > 0)
+		{
+			ctx->duration = nsamples / samplerate;
+			decoder_dbg("decoder mad: duration %u", ctx->duration);
+		}
+	}
 	mad_timer_add(&ctx->position, header->duration);
 	return MAD_FLOW_CONTINUE;
 }
@@ -377,7 +513,8 @@ static void *mad_thread(void *arg)
 		ctx->out->ops->push(ctx->out->ctx, ctx->outbufferlen, NULL);
 	}
 	dbg("decoder: stop running");
-	player_state(ctx->player, STATE_CHANGE);
+	if (ctx->player != NULL)
+		player_state(ctx->player, STATE_CHANGE);
 
 	return (void *)(intptr_t)result;
 }
@@ -403,7 +540,13 @@ static int _decoder_run(decoder_ctx_t *ctx, jitter_t *jitter)
 		jitter->ops->heartbeat(jitter->ctx, &ctx->heartbeat);
 	}
 #endif
-	if (ret == 0)
+	/**
+	 * without player, the decoder runs in offline mode:
+	 * the caller's thread decodes the whole stream.
+	 */
+	if (ret == 0 && ctx->player == NULL)
+		mad_thread(ctx);
+	else if (ret == 0)
 		pthread_create(&ctx->thread, NULL, mad_thread, ctx);
 	return ret;
 }
@@ -429,8 +572,19 @@ static uint32_t _decoder_position(decoder_ctx_t *ctx)
 
 static uint32_t _decoder_duration(decoder_ctx_t *ctx)
 {
+	return ctx->duration;
+}
+
+#ifdef RTP_PLC
+static int _decoder_concealop(decoder_ctx_t *ctx, size_t offset, uint32_t nsamples, unsigned int clockrate)
+{
+	if (__sync_fetch_and_add(&ctx->plcnsamples, 0) == 0)
+		ctx->plcoffset = offset;
+	ctx->plcclockrate = clockrate;
+	__sync_add_and_fetch(&ctx->plcnsamples, nsamples);
 	return 0;
 }
+#endif
 
 static void _decoder_destroy(decoder_ctx_t *ctx)
 {
@@ -461,6 +615,9 @@ const decoder_ops_t _decoder_mad =
 	.run = _decoder_run,
 	.position = _decoder_position,
 	.duration = _decoder_duration,
+#ifdef RTP_PLC
+	.conceal = _decoder_concealop,
+#endif
 	.destroy = _decoder_destroy,
 	.mime = _decoder_mime,
 };
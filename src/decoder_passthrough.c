@@ -32,6 +32,8 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
+#include <pthread.h>
 
 #include "player.h"
 typedef struct decoder_s decoder_t;
@@ -41,6 +43,22 @@ struct decoder_ctx_s
 {
 	const decoder_ops_t *ops;
 	jitter_t *inout;
+#ifdef DECODER_TRANSMUX
+	player_ctx_t *player;
+	jitter_t *in;
+	pthread_t thread;
+	/// the frames not complete at the end of the previous input buffer
+	unsigned char *frames;
+	size_t length;
+	/// the bytes of the ID3v2 tag to skip
+	size_t skip;
+	int synced;
+	int run;
+	uint64_t nsamples;
+	unsigned int samplerate;
+	/// the duration of the Xing/VBRI header
+	uint32_t duration;
+#endif
 };
 #define DECODER_CTX
 #include "decoder.h"
@@ -106,3 +124,239 @@ const decoder_ops_t *decoder_passthrough = &(decoder_ops_t)
 	.mime = _decoder_mime,
 	.destroy = _decoder_destroy,
 };
+
+#ifdef DECODER_TRANSMUX
+/**
+ * The transmux decoder sends the MPEG audio frames of the source
+ * directly to the muxer, without decoding and encoding.
+ * Each output buffer contains only complete frames.
+ */
+#define TRANSMUX_BUFFERSIZE 2881
+#define TRANSMUX_NBUFFER 4
+#define TRANSMUX_FRAMESSIZE (TRANSMUX_BUFFERSIZE * 2)
+
+static const char *jitter_name = "transmux decoder";
+
+static decoder_ctx_t *_transmux_init(player_ctx_t *player)
+{
+	decoder_ctx_t *ctx = calloc(1, sizeof(*ctx));
+	ctx->ops = decoder_transmux;
+	ctx->player = player;
+	ctx->frames = malloc(TRANSMUX_FRAMESSIZE);
+
+	return ctx;
+}
+
+static jitter_t *_transmux_jitter(decoder_ctx_t *ctx, jitte_t jitte)
+{
+	if (ctx->in == NULL)
+	{
+		jitter_t *jitter = jitter_scattergather_init(jitter_name,
+				TRANSMUX_NBUFFER << jitte, TRANSMUX_BUFFERSIZE);
+		jitter->ctx->frequence = 0;
+		jitter->ctx->thredhold = 1;
+		jitter->format = MPEG2_3_MP3;
+		ctx->in = jitter;
+	}
+	return ctx->in;
+}
+
+/**
+ * @return the length of the next frame, 0 if more data is required,
+ * -1 if the data is not a frame
+ */
+static int _transmux_frame(decoder_ctx_t *ctx, size_t offset, int end, unsigned int *nsamples)
+{
+	unsigned int samplerate = 0;
+	int length = utils_mp3frame(ctx->frames + offset, ctx->length - offset, &samplerate, nsamples);
+	if (length <= 0)
+		return (ctx->length - offset < 4 && !end)? 0 : -1;
+	if (offset + length > ctx->length)
+		return (end)? -1 : 0;
+	if (!ctx->synced)
+	{
+		/**
+		 * the synchronization requires two consecutive headers
+		 */
+		if (offset + length + 4 > ctx->length)
+			return (end)? length : 0;
+		if (utils_mp3frame(ctx->frames + offset + length,
+				ctx->length - offset - length, NULL, NULL) < 0)
+			return -1;
+		ctx->synced = 1;
+	}
+	ctx->samplerate = samplerate;
+	return length;
+}
+
+static void *_transmux_thread(void *arg)
+{
+	decoder_ctx_t *ctx = (decoder_ctx_t *)arg;
+	unsigned char *outbuffer = NULL;
+	size_t outlength = 0;
+	int end = 0;
+
+	while (ctx->run && !end)
+	{
+		unsigned char *inbuffer = ctx->in->ops->peer(ctx->in->ctx, NULL);
+		if (inbuffer == NULL)
+			end = 1;
+		else
+		{
+			size_t inlength = ctx->in->ops->length(ctx->in->ctx);
+			size_t len = inlength;
+			if (ctx->skip > 0)
+			{
+				len = (ctx->skip < inlength)? ctx->skip : inlength;
+				ctx->skip -= len;
+				inbuffer += len;
+				len = inlength - len;
+			}
+			if (ctx->length + len > TRANSMUX_FRAMESSIZE)
+			{
+				/// the previous data is garbage
+				ctx->length = 0;
+				ctx->synced = 0;
+			}
+			memcpy(ctx->frames + ctx->length, inbuffer, len);
+			ctx->length += len;
+			ctx->in->ops->pop(ctx->in->ctx, inlength);
+		}
+
+		size_t offset = 0;
+		while (offset < ctx->length)
+		{
+			if (ctx->length - offset >= 10 && !memcmp(ctx->frames + offset, "ID3", 3))
+			{
+				unsigned char *tag = ctx->frames + offset;
+				size_t taglength = ((tag[6] & 0x7F) << 21) | ((tag[7] & 0x7F) << 14) |
+						((tag[8] & 0x7F) << 7) | (tag[9] & 0x7F);
+				taglength += (tag[5] & 0x10)? 20 : 10;
+				if (offset + taglength > ctx->length)
+				{
+					ctx->skip = offset + taglength - ctx->length;
+					offset = ctx->length;
+				}
+				else
+					offset += taglength;
+				continue;
+			}
+			unsigned int nsamples = 0;
+			int length = _transmux_frame(ctx, offset, end, &nsamples);
+			if (length == 0)
+				break;
+			if (length < 0)
+			{
+				ctx->synced = 0;
+				offset++;
+				continue;
+			}
+			uint64_t streamsamples = 0;
+			unsigned int streamrate = 0;
+			if (ctx->nsamples == 0 && utils_mp3vbrheader(ctx->frames + offset,
+					length, &streamsamples, &streamrate) == 0)
+			{
+				if (streamrate > 0)
+					ctx->duration = streamsamples / streamrate;
+				/// the Xing/VBRI frame is not audio
+				offset += length;
+				continue;
+			}
+			if (outbuffer != NULL && outlength + length > ctx->inout->ctx->size)
+			{
+				ctx->inout->ops->push(ctx->inout->ctx, outlength, NULL);
+				outbuffer = NULL;
+			}
+			if (outbuffer == NULL)
+			{
+				outbuffer = ctx->inout->ops->pull(ctx->inout->ctx);
+				outlength = 0;
+			}
+			if (outbuffer == NULL)
+			{
+				ctx->run = 0;
+				break;
+			}
+			if (length > ctx->inout->ctx->size)
+				warn("decoder: transmux frame too large %d", length);
+			else
+			{
+				memcpy(outbuffer + outlength, ctx->frames + offset, length);
+				outlength += length;
+				ctx->nsamples += nsamples;
+			}
+			offset += length;
+		}
+		if (offset > ctx->length)
+			offset = ctx->length;
+		memmove(ctx->frames, ctx->frames + offset, ctx->length - offset);
+		ctx->length -= offset;
+	}
+	if (outbuffer != NULL && outlength > 0)
+		ctx->inout->ops->push(ctx->inout->ctx, outlength, NULL);
+	dbg("decoder: transmux end %lu samples", ctx->nsamples);
+	if (ctx->run && ctx->player != NULL)
+		player_state(ctx->player, STATE_CHANGE);
+	return NULL;
+}
+
+static int _transmux_run(decoder_ctx_t *ctx, jitter_t *jitter)
+{
+	/**
+	 * only the muxer accepts the frames
+	 */
+	if (jitter->format != MPEG2_3_MP3)
+		return -1;
+	ctx->inout = jitter;
+	ctx->run = 1;
+	return pthread_create(&ctx->thread, NULL, _transmux_thread, ctx);
+}
+
+static const char *_transmux_mime(decoder_ctx_t *ctx)
+{
+	return mime_audiomp3;
+}
+
+static uint32_t _transmux_position(decoder_ctx_t *ctx)
+{
+	if (ctx->samplerate == 0)
+		return 0;
+	return ctx->nsamples / ctx->samplerate;
+}
+
+/**
+ * @return the duration of the Xing/VBRI header, 0 if the stream
+ * doesn't have it and the media gives it.
+ */
+static uint32_t _transmux_duration(decoder_ctx_t *ctx)
+{
+	return ctx->duration;
+}
+
+static void _transmux_destroy(decoder_ctx_t *ctx)
+{
+	/**
+	 * the output is the jitter of the muxer and it is not flushed,
+	 * the encoder may use it too.
+	 */
+	ctx->run = 0;
+	if (ctx->thread > 0)
+		pthread_join(ctx->thread, NULL);
+	if (ctx->in)
+		jitter_scattergather_destroy(ctx->in);
+	free(ctx->frames);
+	free(ctx);
+}
+
+const decoder_ops_t *decoder_transmux = &(decoder_ops_t)
+{
+	.name = "transmux",
+	.init = _transmux_init,
+	.jitter = _transmux_jitter,
+	.run = _transmux_run,
+	.mime = _transmux_mime,
+	.position = _transmux_position,
+	.duration = _transmux_duration,
+	.destroy = _transmux_destroy,
+};
+#endif
@@ -0,0 +1,435 @@
+/*****************************************************************************
+ * decoder_pool.c
+ * this file is part of https://github.com/ouistiti-project/putv
+ *****************************************************************************
+ * Copyright (C) 2016-2017
+ *
+ * Authors: Marc Chalain <marc.chalain@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#include <math.h>
+
+#include "player.h"
+#include "jitter.h"
+#include "decoder.h"
+#include "decoder_pool.h"
+#include "media.h"
+
+#define err(format, ...) fprintf(stderr, "\x1B[31m"format"\x1B[0m\n",  ##__VA_ARGS__)
+#define warn(format, ...) fprintf(stderr, "\x1B[35m"format"\x1B[0m\n",  ##__VA_ARGS__)
+#ifdef DEBUG
+#define dbg(format, ...) fprintf(stderr, "\x1B[32m"format"\x1B[0m\n",  ##__VA_ARGS__)
+#else
+#define dbg(...)
+#endif
+
+#define pool_dbg(...)
+
+#define NBUFFER 3
+/// 1152 samples of 16 bits stereo
+#define BUFFERSIZE 4608
+
+/// ReplayGain analyses the RMS of 50ms windows
+#define RMS_WINDOW_MS 50
+#define RMS_STEPS_PER_DB 100
+#define RMS_MAX_DB 120
+#define RMS_PERCENTILE 0.95
+#define PINK_REF 64.82
+
+/// number of waveform points computed per second before the reduction
+#define WAVEFORM_RATE 10
+
+typedef struct decoder_pool_job_s decoder_pool_job_t;
+struct decoder_pool_job_s
+{
+	decoder_analyse_t *analyse;
+	decoder_pool_job_t *next;
+};
+
+struct decoder_pool_s
+{
+	pthread_t *threads;
+	int nthreads;
+	pthread_mutex_t mutex;
+	pthread_cond_t condjob;
+	pthread_cond_t conddone;
+	decoder_pool_job_t *jobs;
+	decoder_pool_job_t *last;
+	int pending;
+	int run;
+};
+
+typedef struct decoder_pool_work_s decoder_pool_work_t;
+struct decoder_pool_work_s
+{
+	decoder_analyse_t *analyse;
+	int fd;
+	jitter_t *out;
+
+	unsigned int rmswindow;
+	unsigned int rmsnsamples;
+	double rmssum;
+	uint32_t *histogram;
+
+	unsigned int wavewindow;
+	unsigned int wavensamples;
+	uint16_t wavepeak;
+	uint16_t *waveform;
+	unsigned int nwaveform;
+	unsigned int maxwaveform;
+};
+
+static const char *jitter_name = "pool decoder";
+
+static int _pool_read(void *arg, unsigned char *buffer, size_t size)
+{
+	decoder_pool_work_t *work = (decoder_pool_work_t *)arg;
+	int ret = read(work->fd, buffer, size);
+	if (ret < 0)
+		err("decoder pool: read error %s", strerror(errno));
+	return ret;
+}
+
+static void _pool_waveform(decoder_pool_work_t *work, uint16_t peak)
+{
+	if (peak > work->wavepeak)
+		work->wavepeak = peak;
+	work->wavensamples++;
+	if (work->wavensamples < work->wavewindow)
+		return;
+	if (work->nwaveform >= work->maxwaveform)
+	{
+		work->maxwaveform += 64 * WAVEFORM_RATE;
+		uint16_t *waveform = realloc(work->waveform, work->maxwaveform * sizeof(*waveform));
+		if (waveform == NULL)
+			return;
+		work->waveform = waveform;
+	}
+	work->waveform[work->nwaveform++] = work->wavepeak;
+	work->wavepeak = 0;
+	work->wavensamples = 0;
+}
+
+static void _pool_rms(decoder_pool_work_t *work, double square)
+{
+	work->rmssum += square;
+	work->rmsnsamples++;
+	if (work->rmsnsamples < work->rmswindow)
+		return;
+	double value = 10 * log10(work->rmssum / work->rmsnsamples * 0.5 + 1.e-37);
+	int index = (int)(value * RMS_STEPS_PER_DB);
+	if (index < 0)
+		index = 0;
+	if (index >= RMS_STEPS_PER_DB * RMS_MAX_DB)
+		index = RMS_STEPS_PER_DB * RMS_MAX_DB - 1;
+	work->histogram[index]++;
+	work->rmssum = 0;
+	work->rmsnsamples = 0;
+}
+
+/**
+ * the consumer is called by the decoder thread during the push.
+ * The output is PCM_16bits_LE_stereo.
+ */
+static int _pool_consume(void *arg, unsigned char *buffer, size_t size)
+{
+	decoder_pool_work_t *work = (decoder_pool_work_t *)arg;
+	decoder_analyse_t *analyse = work->analyse;
+
+	if (analyse->samplerate == 0)
+	{
+		analyse->samplerate = work->out->ctx->frequence;
+		if (analyse->samplerate == 0)
+			analyse->samplerate = DEFAULT_SAMPLERATE;
+		work->rmswindow = analyse->samplerate * RMS_WINDOW_MS / 1000;
+		work->wavewindow = analyse->samplerate / WAVEFORM_RATE;
+	}
+
+	int i;
+	for (i = 0; i + 3 < size; i += 4)
+	{
+		int16_t left = (int16_t)(buffer[i] | (buffer[i + 1] << 8));
+		int16_t right = (int16_t)(buffer[i + 2] | (buffer[i + 3] << 8));
+		int peak = abs(left);
+		if (abs(right) > peak)
+			peak = abs(right);
+		if (peak > analyse->peak)
+			analyse->peak = peak;
+		_pool_rms(work, (double)left * left + (double)right * right);
+		if (analyse->nwaveform > 0)
+			_pool_waveform(work, peak);
+		analyse->nsamples++;
+	}
+	return size;
+}
+
+static void _pool_result(decoder_pool_work_t *work)
+{
+	decoder_analyse_t *analyse = work->analyse;
+
+	if (analyse->samplerate > 0)
+		analyse->duration = analyse->nsamples / analyse->samplerate;
+
+	/**
+	 * the loudness is the RMS value of the window at the 95th percentile.
+	 * The equal loudness filter of ReplayGain is not applied, the gain
+	 * is an approximation.
+	 */
+	uint64_t total = 0;
+	int i;
+	for (i = 0; i < RMS_STEPS_PER_DB * RMS_MAX_DB; i++)
+		total += work->histogram[i];
+	if (total > 0)
+	{
+		uint64_t limit = (uint64_t)ceil(total * (1. - RMS_PERCENTILE));
+		for (i = RMS_STEPS_PER_DB * RMS_MAX_DB - 1; i > 0; i--)
+		{
+			if (work->histogram[i] >= limit)
+				break;
+			limit -= work->histogram[i];
+		}
+		double gain = PINK_REF - (double)i / RMS_STEPS_PER_DB;
+		analyse->regain = (int)(gain * 100);
+	}
+
+	if (analyse->nwaveform > 0 && work->nwaveform > 0)
+	{
+		analyse->waveform = calloc(analyse->nwaveform, sizeof(*analyse->waveform));
+		for (i = 0; i < work->nwaveform; i++)
+		{
+			unsigned int index = (uint64_t)i * analyse->nwaveform / work->nwaveform;
+			if (work->waveform[i] > analyse->waveform[index])
+				analyse->waveform[index] = work->waveform[i];
+		}
+	}
+}
+
+static int _pool_analyse(decoder_analyse_t *analyse)
+{
+	decoder_pool_work_t work = {0};
+	const char *path = analyse->url;
+
+	work.analyse = analyse;
+	if (!strncmp(path, "file://", 7))
+		path += 7;
+	else if (strstr(path, "://") != NULL)
+	{
+		warn("decoder pool: only local files are supported %s", path);
+		return -1;
+	}
+	work.fd = open(path, O_RDONLY);
+	if (work.fd < 0)
+	{
+		err("decoder pool: open %s error %s", path, strerror(errno));
+		return -1;
+	}
+
+	/**
+	 * the decoder without player runs in offline mode.
+	 * The run function leaves at the end of the stream.
+	 */
+	decoder_t *decoder = decoder_build(NULL, analyse->mime);
+	if (decoder == NULL)
+	{
+		close(work.fd);
+		return -1;
+	}
+	jitter_t *in = decoder->ops->jitter(decoder->ctx, JITTE_LOW);
+	in->ctx->produce = (produce_t)_pool_read;
+	in->ctx->producter = (void *)&work;
+
+	work.out = jitter_scattergather_init(jitter_name, NBUFFER, BUFFERSIZE);
+	work.out->format = PCM_16bits_LE_stereo;
+	work.out->ctx->frequence = 0;
+	work.out->ctx->thredhold = 0;
+	work.out->ctx->consume = (consume_t)_pool_consume;
+	work.out->ctx->consumer = (void *)&work;
+
+	work.histogram = calloc(RMS_STEPS_PER_DB * RMS_MAX_DB, sizeof(*work.histogram));
+
+	int ret = 0;
+	if (decoder->ops->prepare != NULL)
+		ret = decoder->ops->prepare(decoder->ctx);
+	if (ret == 0)
+		ret = decoder->ops->run(decoder->ctx, work.out);
+	decoder->ops->destroy(decoder->ctx);
+	free(decoder);
+
+	if (ret == 0)
+		_pool_result(&work);
+	pool_dbg("decoder pool: %s %lu samples", analyse->url, analyse->nsamples);
+
+	free(work.histogram);
+	free(work.waveform);
+	jitter_scattergather_destroy(work.out);
+	close(work.fd);
+	return ret;
+}
+
+static void *_pool_thread(void *arg)
+{
+	decoder_pool_t *pool = (decoder_pool_t *)arg;
+
+	pthread_mutex_lock(&pool->mutex);
+	while (pool->run)
+	{
+		decoder_pool_job_t *job = pool->jobs;
+		if (job == NULL)
+		{
+			pthread_cond_wait(&pool->condjob, &pool->mutex);
+			continue;
+		}
+		pool->jobs = job->next;
+		if (pool->jobs == NULL)
+			pool->last = NULL;
+		pthread_mutex_unlock(&pool->mutex);
+
+		job->analyse->result = _pool_analyse(job->analyse);
+		if (job->analyse->cb != NULL)
+			job->analyse->cb(job->analyse->arg, job->analyse);
+		free(job);
+
+		pthread_mutex_lock(&pool->mutex);
+		pool->pending--;
+		if (pool->pending == 0)
+			pthread_cond_broadcast(&pool->conddone);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+	return NULL;
+}
+
+decoder_pool_t *decoder_pool_init(int nthreads)
+{
+	if (nthreads <= 0)
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nthreads <= 0)
+		nthreads = 1;
+
+	decoder_pool_t *pool = calloc(1, sizeof(*pool));
+	pool->threads = calloc(nthreads, sizeof(*pool->threads));
+	pool->run = 1;
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->condjob, NULL);
+	pthread_cond_init(&pool->conddone, NULL);
+
+	/**
+	 * The analyses must not disturb the playing.
+	 * The workers use the batch scheduling.
+	 */
+	pthread_attr_t attr;
+	struct sched_param params = {0};
+	pthread_attr_init(&attr);
+	pthread_attr_setschedpolicy(&attr, SCHED_BATCH);
+	pthread_attr_setschedparam(&attr, &params);
+	pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+
+	int i;
+	for (i = 0; i < nthreads; i++)
+	{
+		if (pthread_create(&pool->threads[i], &attr, _pool_thread, pool) != 0 &&
+			pthread_create(&pool->threads[i], NULL, _pool_thread, pool) != 0)
+		{
+			err("decoder pool: thread error %s", strerror(errno));
+			break;
+		}
+	}
+	pthread_attr_destroy(&attr);
+	pool->nthreads = i;
+	dbg("decoder pool: %d workers", pool->nthreads);
+	return pool;
+}
+
+int decoder_pool_add(decoder_pool_t *pool, decoder_analyse_t *analyse)
+{
+	if (analyse->mime == NULL)
+		analyse->mime = utils_getmime(analyse->url);
+	if (analyse->mime == NULL)
+		return -1;
+
+	/// without worker the job never ends
+	if (pool->nthreads == 0)
+		return -1;
+
+	decoder_pool_job_t *job = calloc(1, sizeof(*job));
+	job->analyse = analyse;
+	analyse->result = -1;
+
+	pthread_mutex_lock(&pool->mutex);
+	if (pool->last != NULL)
+		pool->last->next = job;
+	else
+		pool->jobs = job;
+	pool->last = job;
+	pool->pending++;
+	pthread_mutex_unlock(&pool->mutex);
+	pthread_cond_signal(&pool->condjob);
+	return 0;
+}
+
+void decoder_pool_wait(decoder_pool_t *pool)
+{
+	pthread_mutex_lock(&pool->mutex);
+	while (pool->pending > 0 && pool->nthreads > 0)
+		pthread_cond_wait(&pool->conddone, &pool->mutex);
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+void decoder_pool_destroy(decoder_pool_t *pool)
+{
+	/**
+	 * the workers finish their current analyse only,
+	 * the jobs not started are returned without result.
+	 */
+	pthread_mutex_lock(&pool->mutex);
+	pool->run = 0;
+	decoder_pool_job_t *jobs = pool->jobs;
+	pool->jobs = NULL;
+	pool->last = NULL;
+	pthread_mutex_unlock(&pool->mutex);
+	pthread_cond_broadcast(&pool->condjob);
+
+	while (jobs != NULL)
+	{
+		decoder_pool_job_t *next = jobs->next;
+		if (jobs->analyse->cb != NULL)
+			jobs->analyse->cb(jobs->analyse->arg, jobs->analyse);
+		free(jobs);
+		jobs = next;
+	}
+
+	int i;
+	for (i = 0; i < pool->nthreads; i++)
+		pthread_join(pool->threads[i], NULL);
+	pthread_cond_destroy(&pool->condjob);
+	pthread_cond_destroy(&pool->conddone);
+	pthread_mutex_destroy(&pool->mutex);
+	free(pool->threads);
+	free(pool);
+}
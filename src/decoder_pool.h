@@ -0,0 +1,53 @@
+#ifndef __DECODER_POOL_H__
+#define __DECODER_POOL_H__
+
+#include <stdint.h>
+
+/**
+ * The pool decodes media outside of the player pipeline.
+ * Each worker runs a decoder in offline mode (without player and
+ * without heartbeat) and analyses the PCM stream.
+ */
+typedef struct decoder_analyse_s decoder_analyse_t;
+typedef void (*decoder_analyse_cb_t)(void *arg, decoder_analyse_t *analyse);
+struct decoder_analyse_s
+{
+	int id;
+	char *url;
+	const char *mime;
+	/**
+	 * number of points of the waveform requested,
+	 * 0 disables the waveform
+	 */
+	unsigned int nwaveform;
+
+	/**
+	 * results
+	 */
+	int result;
+	unsigned int samplerate;
+	uint64_t nsamples;
+	/// duration in seconds as the decoders' duration
+	uint32_t duration;
+	/// peak on 16 bits
+	int peak;
+	/// track gain in 1/100 dB
+	int regain;
+	uint16_t *waveform;
+
+	/**
+	 * the callback is called by the worker at the end of the analyse
+	 */
+	decoder_analyse_cb_t cb;
+	void *arg;
+	decoder_analyse_t *next;
+};
+
+typedef struct decoder_pool_s decoder_pool_t;
+
+decoder_pool_t *decoder_pool_init(int nthreads);
+int decoder_pool_add(decoder_pool_t *pool, decoder_analyse_t *job);
+void decoder_pool_wait(decoder_pool_t *pool);
+void decoder_pool_destroy(decoder_pool_t *pool);
+
+#endif
@@ -33,28 +33,103 @@
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
+#ifdef DEMUX_RTP_REORDER
+#include <poll.h>
+#endif
 
 #include <pthread.h>
 
 #include "player.h"
 #include "decoder.h"
 #include "event.h"
+#include "rtp.h"
+#include "sink.h"
+#ifdef DEMUX_RTP_SYNC
+#include "jitter.h"
+#include "heartbeat.h"
+#ifndef HEARTBEAT
+#error "DEMUX_RTP_SYNC releases the packets with the heartbeat of the jitter"
+#endif
+#endif
 typedef struct src_s demux_t;
 typedef struct src_ops_s demux_ops_t;
 
-#define NB_LOOPS 21
 #define NB_BUFFERS 8
 #define BUFFERSIZE 1500
+/// a larger jump of the sequence numbers restarts the stream
+#define SEQNUM_RESTART 1000
+
+#ifdef DEMUX_RTP_REORDER
+#ifndef DEMUX_RTP_REORDER_DEPTH
+#define DEMUX_RTP_REORDER_DEPTH 16
+#endif
+/// ms to wait a missing packet without playout time
+#ifndef DEMUX_RTP_REORDER_DELAY
+#define DEMUX_RTP_REORDER_DELAY 20
+#endif
+typedef struct demux_packet_s demux_packet_t;
+struct demux_packet_s
+{
+	unsigned char buffer[BUFFERSIZE];
+	size_t len;
+	size_t offset;
+	/// monotonic time in ns to release the packet without the missing ones
+	uint64_t deadline;
+	demux_packet_t *next;
+};
 
 typedef struct demux_reorder_s demux_reorder_t;
 struct demux_reorder_s
 {
-	char buffer[BUFFERSIZE];
+	/// the packets held, indexed by sequence number
+	demux_packet_t *ring[DEMUX_RTP_REORDER_DEPTH];
+	demux_packet_t *free;
+	demux_packet_t *pool;
+	/// the next sequence number to release
+	uint16_t next;
+	int nheld;
+	char started;
+};
+#endif
+
+#if defined(DEMUX_RTP_SYNC) || defined(DEMUX_RTP_REORDER)
+/// the packets are dated on their arrival
+#define DEMUX_RTP_ARRIVAL
+#endif
+
+#ifdef RTP_FEC
+#define FEC_NBPACKETS (2 * (RTP_FEC_GROUP + 1))
+
+typedef struct demux_fecpacket_s demux_fecpacket_t;
+struct demux_fecpacket_s
+{
+	unsigned char buffer[BUFFERSIZE];
+	/// length of the packet with its header
 	size_t len;
-	char id;
+	/// offset of the payload
+	size_t offset;
+	uint16_t seqnum;
 	char ready;
+	char held;
 };
 
+/**
+ * the last packets are kept to rebuild a lost packet with the parity.
+ * After a loss, the next packets are held until the parity and the
+ * other packets of the group arrive.
+ */
+typedef struct demux_fec_s demux_fec_t;
+struct demux_fec_s
+{
+	demux_fecpacket_t packets[FEC_NBPACKETS];
+	/// the last parity packet, its seqnum is the one of the parity stream
+	demux_fecpacket_t parity;
+	uint16_t lost;
+	char holding;
+};
+#endif
+
 typedef struct demux_out_s demux_out_t;
 struct demux_out_s
 {
@@ -64,32 +139,115 @@ struct demux_out_s
 	char *data;
 	const char *mime;
 	short cc;
+	unsigned int clockrate;
+	/// length of the header of the payload format
+	size_t format;
+	/// bytes per sample and channels of L16 and L24, 0 for the compressed audio
+	unsigned char samplesize;
+	unsigned char nchannels;
+	/// the last sequence number received
+	unsigned short seqlast;
+	unsigned short seqorig;
+	/// the counter of the packets of the demux at the last packet of the stream
+	unsigned long lastpacket;
+#ifdef RTP_FEC
+	demux_fec_t fec;
+#endif
+#ifdef DEMUX_RTP_REORDER
+	demux_reorder_t reorder;
+#endif
+#ifdef DEMUX_RTP_SYNC
+	/// the first sender report of the stream, the origin of the skew
+	uint32_t srorigts;
+	uint64_t srorigwall;
+	/// the last sender report of the stream
+	uint32_t srtimestamp;
+	uint64_t srwallclock;
+	/// skew of the sender clock in ppm
+	int skew;
+#ifndef SINK_DRIFT
+	/// correction sent to the player in ppm, only by the played stream
+	int ratio;
+#endif
+	unsigned long late;
+	/// the decoder receives each packet at its release time
+	heartbeat_t heartbeat;
+	beat_clock_t *releases;
+	unsigned int nreleases;
+	/// the release time of the current packet
+	uint64_t release;
+#endif
+#ifdef DEMUX_RTP_ARRIVAL
+	/// the previous packet to compute the interarrival jitter
+	uint64_t lastarrival;
+	uint32_t lasttimestamp;
+	/// interarrival jitter in ns (RFC 3550 6.4.1)
+	int64_t interjitter;
+#endif
+#ifdef SINK_DRIFT
+	/// the clock drift is measured on the jitter of the decoder
+	sink_drift_t drift;
+	/// bytes pushed to the decoder since the timestamp driftts
+	uint64_t driftbytes;
+	uint32_t driftts;
+	char driftstarted;
+#endif
+#ifdef RTP_PLC
+	/// the last PCM payload, repeated for a loss
+	unsigned char *plc;
+	size_t plclength;
+	unsigned int plccount;
+	/// the duration of one packet at the clock of the stream
+	uint32_t timestamp;
+	uint32_t tsduration;
+	uint16_t seqnum;
+	/// bytes sent to the decoder
+	size_t nbytes;
+#endif
 	demux_out_t *next;
 };
 
-typedef struct demux_profile_s demux_profile_t;
-struct demux_profile_s
-{
-	const char *mime;
-	demux_profile_t *next;
-	char pt;
-};
+#ifndef DEMUX_RTP_MAXSTREAMS
+#define DEMUX_RTP_MAXSTREAMS 16
+#endif
+#ifndef DEMUX_RTP_SWITCHPACKETS
+/// packets of the parked streams without packet of the played stream
+#define DEMUX_RTP_SWITCHPACKETS 200
+#endif
+/// the table of the streams is at most half full
+#define NB_SLOTS (DEMUX_RTP_MAXSTREAMS * 2)
+#define NB_PAYLOADTYPES 128
 
 typedef struct demux_ctx_s demux_ctx_t;
 typedef struct demux_ctx_s src_ctx_t;
 struct demux_ctx_s
 {
+	/// the streams in the order of creation
 	demux_out_t *out;
+	/// the streams indexed by SSRC with open addressing
+	demux_out_t *streams[NB_SLOTS];
+	int nbstreams;
+	/**
+	 * only one stream is played, the others are parked until the
+	 * played stream stops.
+	 */
+	demux_out_t *playout;
+	unsigned long npackets;
+	unsigned long dropped;
 	jitter_t *in;
 	jitte_t jitte;
-	unsigned short seqnum;
-	unsigned short seqorig;
 	unsigned long missing;
-	demux_reorder_t reorder[NB_BUFFERS];
+	unsigned long recovered;
 	const char *mime;
 	pthread_t thread;
 	event_listener_t *listener;
-	demux_profile_t *profiles;
+	/// the mime of each payload type
+	const char *profiles[NB_PAYLOADTYPES];
+	player_ctx_t *player;
+#ifdef DEMUX_RTP_ARRIVAL
+	/// monotonic arrival time in ns of the current packet
+	uint64_t arrival;
+#endif
 };
 #define SRC_CTX
 #define DEMUX_CTX
@@ -97,7 +255,6 @@ struct demux_ctx_s
 #include "src.h"
 #include "media.h"
 #include "jitter.h"
-#include "rtp.h"
 
 #define err(format, ...) fprintf(stderr, "\x1B[31m"format"\x1B[0m\n",  ##__VA_ARGS__)
 #define warn(format, ...) fprintf(stderr, "\x1B[35m"format"\x1B[0m\n",  ##__VA_ARGS__)
@@ -118,10 +275,18 @@ static demux_ctx_t *demux_init(player_ctx_t *player, const char *protocol, const
 {
 	demux_ctx_t *ctx = calloc(1, sizeof(*ctx));
 	ctx->mime = utils_mime2mime(mime);
-	demux_profile_t *profile = NULL;
+	ctx->player = player;
 
-	demux_rtp_addprofile(ctx, 14, mime_audiomp3);
-	demux_rtp_addprofile(ctx, 11, mime_audiopcm);
+	demux_rtp_addprofile(ctx, RTP_MPA_PT, mime_audiomp3);
+	int pt;
+	for (pt = 0; pt < NB_PAYLOADTYPES; pt++)
+	{
+		unsigned char samplesize;
+		unsigned char nchannels;
+		unsigned int samplerate;
+		if (rtp_pcmformat(pt, &samplesize, &nchannels, &samplerate) == 0)
+			demux_rtp_addprofile(ctx, pt, mime_audiopcm);
+	}
 
 	return ctx;
 }
@@ -144,28 +309,898 @@ static jitter_t *demux_jitter(demux_ctx_t *ctx, jitte_t jitte)
 
 static const char *demux_profile(demux_ctx_t *ctx, char pt)
 {
-	demux_profile_t *profile = ctx->profiles;
-	while (profile != NULL && profile->pt != pt) profile = profile->next;
-	if (profile == NULL)
+	const char *mime = ctx->profiles[pt & (NB_PAYLOADTYPES - 1)];
+	if (mime == NULL)
 		return mime_octetstream;
-	return profile->mime;
+	return mime;
 }
 
 void demux_rtp_addprofile(demux_ctx_t *ctx, char pt, const char *mime)
 {
-	demux_profile_t *profile = NULL;
+	ctx->profiles[pt & (NB_PAYLOADTYPES - 1)] = mime;
+}
+
+/**
+ * @brief the slot of the stream into the table, or the free slot
+ * for a new stream
+ */
+static unsigned int _demux_slot(demux_ctx_t *ctx, uint32_t ssrc)
+{
+	unsigned int slot = (ssrc * 2654435761U) % NB_SLOTS;
+	while (ctx->streams[slot] != NULL && ctx->streams[slot]->ssrc != ssrc)
+		slot = (slot + 1) % NB_SLOTS;
+	return slot;
+}
+
+static demux_out_t *_demux_out(demux_ctx_t *ctx, uint32_t ssrc)
+{
+	return ctx->streams[_demux_slot(ctx, ssrc)];
+}
+
+/**
+ * @brief the beat of the buffer pulled for the current packet
+ * The beats are stored as the buffers of the jitter, the slot is
+ * free when the buffer is pulled.
+ */
+static void *_demux_beat(demux_out_t *out)
+{
+#ifdef DEMUX_RTP_SYNC
+	if (out->release == 0 || out->releases == NULL)
+		return NULL;
+	beat_clock_t *beat = &out->releases[out->nreleases++ % out->jitter->ctx->count];
+	beat->release = out->release;
+	out->release = 0;
+	return beat;
+#else
+	return NULL;
+#endif
+}
+
+static void _demux_pushdata(demux_out_t *out, unsigned char *input, size_t len)
+{
+	if (out->data == NULL)
+		out->data = out->jitter->ops->pull(out->jitter->ctx);
+	while (len > out->jitter->ctx->size)
+	{
+		err("demux: udp packet has not to overflow 1500 bytes (%ld)", len);
+		memcpy(out->data, input, out->jitter->ctx->size);
+		out->jitter->ops->push(out->jitter->ctx, out->jitter->ctx->size, _demux_beat(out));
+		len -= out->jitter->ctx->size;
+		input += out->jitter->ctx->size;
+		out->data = out->jitter->ops->pull(out->jitter->ctx);
+	}
+	memcpy(out->data, input, len);
+	demux_dbg("demux: push %ld", len);
+	out->jitter->ops->push(out->jitter->ctx, len, _demux_beat(out));
+	out->data = NULL;
+#ifdef SINK_DRIFT
+	out->driftbytes += len;
+#endif
+}
+
+/**
+ * @brief write one sample left aligned on 32 bits into the format of the decoder
+ */
+static void _demux_pcmsample(unsigned char *output, int32_t sample, unsigned int size, int bigendian, int lowaligned)
+{
+	if (lowaligned)
+		sample >>= 8;
+	else
+		sample >>= (4 - size) * 8;
+	unsigned int i;
+	for (i = 0; i < size; i++)
+		output[(bigendian)? size - 1 - i : i] = sample >> (i * 8);
+}
+
+/**
+ * @brief convert the L16/L24 samples (network byte order) into the
+ * format of the decoder
+ */
+static void _demux_pushpcm(demux_out_t *out, const unsigned char *input, size_t len)
+{
+	unsigned int outsize = 4;
+	unsigned int outchannels = 2;
+	int bigendian = 0;
+	int lowaligned = 0;
+	switch (out->jitter->format)
+	{
+	case PCM_16bits_LE_mono:
+		outchannels = 1;
+	case PCM_16bits_LE_stereo:
+		outsize = 2;
+	break;
+	case PCM_16bits_BE_stereo:
+		outsize = 2;
+		bigendian = 1;
+	break;
+	case PCM_24bits3_LE_stereo:
+		outsize = 3;
+	break;
+	case PCM_24bits3_BE_stereo:
+		outsize = 3;
+		bigendian = 1;
+	break;
+	case PCM_24bits4_LE_stereo:
+		lowaligned = 1;
+	break;
+	case PCM_32bits_BE_stereo:
+		bigendian = 1;
+	break;
+	default:
+	break;
+	}
+	size_t inframe = out->samplesize * out->nchannels;
+	size_t outframe = outsize * outchannels;
+	while (len >= inframe)
+	{
+		unsigned char *data = out->jitter->ops->pull(out->jitter->ctx);
+		if (data == NULL)
+			return;
+		size_t nframes = len / inframe;
+		if (nframes > out->jitter->ctx->size / outframe)
+			nframes = out->jitter->ctx->size / outframe;
+		if (nframes == 0)
+		{
+			out->jitter->ops->push(out->jitter->ctx, 0, NULL);
+			return;
+		}
+		unsigned char *output = data;
+		size_t i;
+		for (i = 0; i < nframes; i++)
+		{
+			int32_t sample = 0;
+			unsigned int c;
+			for (c = 0; c < outchannels; c++)
+			{
+				/// the mono stream is played on all the channels
+				if (c < out->nchannels)
+				{
+					uint32_t value = ((uint32_t)input[0] << 24) | ((uint32_t)input[1] << 16);
+					if (out->samplesize == 3)
+						value |= (uint32_t)input[2] << 8;
+					sample = (int32_t)value;
+					input += out->samplesize;
+				}
+				_demux_pcmsample(output, sample, outsize, bigendian, lowaligned);
+				output += outsize;
+			}
+			if (out->nchannels > outchannels)
+				input += (out->nchannels - outchannels) * out->samplesize;
+		}
+		out->jitter->ops->push(out->jitter->ctx, output - data, _demux_beat(out));
+#ifdef SINK_DRIFT
+		out->driftbytes += output - data;
+#endif
+		len -= nframes * inframe;
+	}
+}
 
-	profile = calloc(1, sizeof(*profile));
-	profile->pt = pt;
-	profile->mime = mime;
-	profile->next = ctx->profiles;
-	ctx->profiles = profile;
+static void _demux_push(demux_out_t *out, unsigned char *input, size_t len)
+{
+	/// the fragments of a frame are sent one after the other to the decoder
+	if (len < out->format)
+		return;
+	input += out->format;
+	len -= out->format;
+	if (out->samplesize > 0)
+		_demux_pushpcm(out, input, len);
+	else
+		_demux_pushdata(out, input, len);
+#ifdef RTP_PLC
+	out->nbytes += len;
+	if (out->plc != NULL && len <= BUFFERSIZE)
+	{
+		memcpy(out->plc, input, len);
+		out->plclength = len;
+		out->plccount = 0;
+	}
+#endif
+}
+
+
+#ifdef RTP_PLC
+/// number of packets repeated before the silence
+#define PLC_FADE 4
+
+/**
+ * @brief repeat the last PCM payload with a fade out
+ */
+static void _demux_plcpcm(demux_out_t *out)
+{
+	if (out->plclength == 0 || out->plclength > BUFFERSIZE)
+		return;
+	unsigned char data[BUFFERSIZE];
+	memcpy(data, out->plc, out->plclength);
+	unsigned int count = (out->plccount < PLC_FADE)? out->plccount : PLC_FADE;
+	/// gain in 1/65536 from (PLC_FADE - count) / PLC_FADE to (PLC_FADE - count - 1) / PLC_FADE
+	int32_t gain0 = (PLC_FADE - count) * 65536 / PLC_FADE;
+	int32_t gain1 = (count < PLC_FADE)? (PLC_FADE - count - 1) * 65536 / PLC_FADE : 0;
+	size_t nsamples = out->plclength / out->samplesize;
+	size_t i;
+	for (i = 0; i < nsamples; i++)
+	{
+		unsigned char *sample = data + i * out->samplesize;
+		uint32_t value = ((uint32_t)sample[0] << 24) | ((uint32_t)sample[1] << 16);
+		if (out->samplesize == 3)
+			value |= (uint32_t)sample[2] << 8;
+		int32_t gain = gain0 + (int64_t)(gain1 - gain0) * i / nsamples;
+		/// the samples stay in network byte order
+		_demux_pcmsample(sample, ((int64_t)(int32_t)value * gain) >> 16, out->samplesize, 1, 0);
+	}
+	_demux_pushpcm(out, data, out->plclength);
+	out->plccount++;
+}
+
+/**
+ * @brief replace the lost packets to keep the number of samples
+ * sent to the sink.
+ */
+static void _demux_conceal(demux_out_t *out, unsigned int nlost)
+{
+	if (out->jitter == NULL)
+		return;
+	if (out->plc != NULL)
+	{
+		while (nlost-- > 0)
+			_demux_plcpcm(out);
+	}
+	else if (out->estream != NULL && out->estream->ops->conceal != NULL && out->tsduration > 0)
+	{
+		out->estream->ops->conceal(out->estream->ctx, out->nbytes,
+				nlost * out->tsduration, out->clockrate);
+	}
+}
+
+/**
+ * @brief the duration of a packet is the difference of timestamps
+ * between two consecutive media packets
+ */
+static void _demux_plctimestamp(demux_out_t *out, rtpheader_t *header)
+{
+	uint32_t timestamp = ntohl(header->timestamp);
+	uint16_t seqnum = ntohs(header->b.seqnum);
+	if ((uint16_t)(seqnum - out->seqnum) == 1 && timestamp != out->timestamp)
+		out->tsduration = timestamp - out->timestamp;
+	out->timestamp = timestamp;
+	out->seqnum = seqnum;
+}
+#endif
+
+#ifdef RTP_FEC
+/**
+ * @brief send to the decoder the packets held after the loss
+ */
+static void _demux_fecrelease(demux_out_t *out)
+{
+	demux_fec_t *fec = &out->fec;
+	uint16_t i;
+#ifdef RTP_PLC
+	demux_fecpacket_t *lost = &fec->packets[fec->lost % FEC_NBPACKETS];
+	if (!lost->ready || lost->seqnum != fec->lost)
+		_demux_conceal(out, 1);
+#endif
+	for (i = 1; i < FEC_NBPACKETS; i++)
+	{
+		uint16_t seqnum = fec->lost + i;
+		demux_fecpacket_t *packet = &fec->packets[seqnum % FEC_NBPACKETS];
+		if (packet->ready && packet->held && packet->seqnum == seqnum)
+		{
+			_demux_push(out, packet->buffer + packet->offset, packet->len - packet->offset);
+			packet->held = 0;
+		}
+	}
+	fec->holding = 0;
+}
+
+/**
+ * @brief rebuild the lost packet from the last parity and the other
+ * packets of the group. Without all the packets, the recovery waits
+ * the next media or parity packet.
+ */
+static void _demux_fecrecover(demux_ctx_t *ctx, demux_out_t *out)
+{
+	demux_fec_t *fec = &out->fec;
+	demux_fecpacket_t *parity = &fec->parity;
+	rtpfec_t header;
+	if (!fec->holding || !parity->ready || parity->len - parity->offset < sizeof(header))
+		return;
+	unsigned char *input = parity->buffer + parity->offset;
+	size_t len = parity->len - parity->offset;
+	memcpy(&header, input, sizeof(header));
+	input += sizeof(header);
+	len -= sizeof(header);
+	uint16_t snbase = ntohs(header.snbase);
+	uint16_t mask = ntohs(header.mask);
+	size_t protectlength = ntohs(header.protectlength);
+	uint16_t index = fec->lost - snbase;
+	if (index >= 16 || !(mask & RTP_FEC_MASK(index)))
+	{
+		/// the parity of the group of the lost packet is lost too
+		if ((int16_t)(snbase - fec->lost) > 0)
+			_demux_fecrelease(out);
+		return;
+	}
+	if (protectlength > len || protectlength > BUFFERSIZE - sizeof(rtpheader_t))
+	{
+		_demux_fecrelease(out);
+		return;
+	}
+	uint16_t i;
+	for (i = 0; i < 16; i++)
+	{
+		if (i == index || !(mask & RTP_FEC_MASK(i)))
+			continue;
+		uint16_t seqnum = snbase + i;
+		demux_fecpacket_t *packet = &fec->packets[seqnum % FEC_NBPACKETS];
+		if (packet->ready && packet->seqnum == seqnum)
+			continue;
+		/// a packet before the loss is lost too, the group is not recoverable
+		if ((int16_t)(seqnum - fec->lost) < 0)
+			_demux_fecrelease(out);
+		return;
+	}
+
+	demux_fecpacket_t *recovered = &fec->packets[fec->lost % FEC_NBPACKETS];
+	unsigned char *payload = recovered->buffer + sizeof(rtpheader_t);
+	memcpy(payload, input, protectlength);
+	size_t length = ntohs(header.lengthrecovery);
+	uint16_t bits = ntohs(header.brecovery);
+	uint32_t timestamp = header.tsrecovery;
+	for (i = 0; i < 16; i++)
+	{
+		if (i == index || !(mask & RTP_FEC_MASK(i)))
+			continue;
+		uint16_t seqnum = snbase + i;
+		demux_fecpacket_t *packet = &fec->packets[seqnum % FEC_NBPACKETS];
+		rtpheader_t *pheader = (rtpheader_t *)packet->buffer;
+		size_t plength = packet->len - sizeof(rtpheader_t);
+		rtp_fecxor(payload, packet->buffer + sizeof(rtpheader_t), plength);
+		length ^= plength;
+		bits ^= rtp_fecbits(pheader->b);
+		timestamp ^= pheader->timestamp;
+	}
+	if (length > protectlength)
+	{
+		_demux_fecrelease(out);
+		return;
+	}
+	rtpheader_t *rheader = (rtpheader_t *)recovered->buffer;
+	/// the version replaces the E and L bits
+	recovered->buffer[0] = 0x80 | ((bits >> 8) & 0x3F);
+	recovered->buffer[1] = bits & 0xFF;
+	rheader->b.seqnum = htons(fec->lost);
+	rheader->timestamp = timestamp;
+	recovered->offset = sizeof(rtpheader_t) + rheader->b.cc * sizeof(uint32_t);
+	recovered->len = sizeof(rtpheader_t) + length;
+	recovered->seqnum = fec->lost;
+	recovered->ready = 1;
+	if (recovered->offset <= recovered->len)
+	{
+		ctx->recovered++;
+		warn("demux: packet recovered %ld/%ld", ctx->recovered, ctx->missing);
+		_demux_push(out, recovered->buffer + recovered->offset, recovered->len - recovered->offset);
+	}
+	_demux_fecrelease(out);
+}
+
+static void _demux_feclost(demux_ctx_t *ctx, demux_out_t *out, uint16_t seqnum)
+{
+	demux_fec_t *fec = &out->fec;
+	/// only one loss is recoverable, the previous one is abandoned
+	if (fec->holding)
+		_demux_fecrelease(out);
+	fec->packets[seqnum % FEC_NBPACKETS].ready = 0;
+	fec->lost = seqnum;
+	fec->holding = 1;
+	_demux_fecrecover(ctx, out);
+}
+
+/**
+ * @brief keep the last parity packet of the stream.
+ * The parity stream has its own sequence numbers, a lost parity packet
+ * is not a lost media packet.
+ */
+static void _demux_fecparity(demux_ctx_t *ctx, demux_out_t *out, unsigned char *packet, size_t offset, size_t len)
+{
+	rtpheader_t *header = (rtpheader_t *)packet;
+	demux_fecpacket_t *parity = &out->fec.parity;
+	uint16_t seqnum = ntohs(header->b.seqnum);
+	if (offset + len > BUFFERSIZE)
+		return;
+	/// late or duplicated
+	if (parity->ready && (int16_t)(seqnum - parity->seqnum) <= 0 &&
+		(uint16_t)(parity->seqnum - seqnum) < SEQNUM_RESTART)
+		return;
+	memcpy(parity->buffer, packet, offset + len);
+	parity->len = offset + len;
+	parity->offset = offset;
+	parity->seqnum = seqnum;
+	parity->ready = 1;
+	_demux_fecrecover(ctx, out);
+}
+
+/**
+ * @brief keep the packet for the recovery
+ *
+ * @return 1 if the packet must not be sent to the decoder now
+ */
+static int _demux_fec(demux_ctx_t *ctx, demux_out_t *out, unsigned char *packet, size_t offset, size_t len)
+{
+	rtpheader_t *header = (rtpheader_t *)packet;
+	demux_fec_t *fec = &out->fec;
+	uint16_t seqnum = ntohs(header->b.seqnum);
+	if (offset + len > BUFFERSIZE)
+		return 0;
+	demux_fecpacket_t *slot = &fec->packets[seqnum % FEC_NBPACKETS];
+	memcpy(slot->buffer, packet, offset + len);
+	slot->len = offset + len;
+	slot->offset = offset;
+	slot->seqnum = seqnum;
+	slot->ready = 1;
+	slot->held = fec->holding;
+	if (!fec->holding)
+		return 0;
+	_demux_fecrecover(ctx, out);
+	/// the parity is too late, the ring is full
+	if (fec->holding && (uint16_t)(slot->seqnum - fec->lost) >= FEC_NBPACKETS - 1)
+		_demux_fecrelease(out);
+	return 1;
+}
+#endif
+
+#if defined(DEMUX_RTP_ARRIVAL) || defined(SINK_DRIFT)
+static uint64_t _demux_clock(clockid_t clockid)
+{
+	struct timespec now;
+	clock_gettime(clockid, &now);
+	return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+#endif
+
+#ifdef DEMUX_RTP_SYNC
+#ifndef DEMUX_RTP_LATENCY
+#define DEMUX_RTP_LATENCY 200
+#endif
+/// the skew is computed after 10 seconds of reports
+#define SYNC_SKEWPERIOD 10000000000LL
+#define SYNC_SKEWMAX 500
+
+/**
+ * @brief store the mapping between the RTP timestamps and the
+ * wallclock of the sender, and follow the skew of its clock.
+ */
+void demux_rtp_report(demux_ctx_t *ctx, const rtcpsr_t *sr)
+{
+	demux_out_t *out = _demux_out(ctx, sr->ssrc);
+	if (out == NULL)
+		return;
+	uint32_t timestamp = ntohl(sr->timestamp);
+	uint64_t wallclock = (uint64_t)(ntohl(sr->ntpsec) - RTCP_NTPOFFSET) * 1000000000ULL;
+	wallclock += ((uint64_t)ntohl(sr->ntpfrac) * 1000000000ULL) >> 32;
+
+	if (out->srorigwall == 0 || wallclock <= out->srorigwall)
+	{
+		out->srorigts = timestamp;
+		out->srorigwall = wallclock;
+	}
+	else if (wallclock - out->srorigwall > SYNC_SKEWPERIOD)
+	{
+		/// the skew is measured from the first report to remove the jitter of the sender
+		int64_t wall = wallclock - out->srorigwall;
+		int64_t media = (int64_t)(int32_t)(timestamp - out->srorigts) * 1000000000LL / out->clockrate;
+		int64_t skew = (media - wall) * 1000000LL / wall;
+		if (skew > SYNC_SKEWMAX || skew < -SYNC_SKEWMAX)
+		{
+			warn("demux: rtp timestamps discontinuity");
+			out->srorigts = timestamp;
+			out->srorigwall = wallclock;
+		}
+		else
+		{
+			int newskew = out->skew + ((int)skew - out->skew) / 4;
+			/// the sender clock runs faster, the samples have to be played faster
+#ifdef SINK_DRIFT
+			/// the estimator of the drift is the only controller of the ratio
+			out->drift.skew = -newskew;
+#else
+			if (out == ctx->playout)
+			{
+				player_ratio(ctx->player, -newskew - out->ratio);
+				out->ratio = -newskew;
+			}
+#endif
+			out->skew = newskew;
+		}
+	}
+	out->srtimestamp = timestamp;
+	out->srwallclock = wallclock;
+}
+
+/**
+ * @brief the time to send the packet to the decoder: its playout time
+ * less the delay of the player pipeline, on the monotonic clock.
+ *
+ * @return the time in ns or 0 without sender report
+ */
+static int64_t _demux_release(demux_ctx_t *ctx, demux_out_t *out, rtpheader_t *header)
+{
+	if (out->srwallclock == 0)
+		return 0;
+	uint32_t timestamp = ntohl(header->timestamp);
+	int64_t offset = (int64_t)(int32_t)(timestamp - out->srtimestamp) * 1000000000LL / out->clockrate;
+	uint64_t realtime = _demux_clock(CLOCK_REALTIME);
+	uint64_t now = _demux_clock(CLOCK_MONOTONIC);
+	int64_t playout = out->srwallclock + offset + DEMUX_RTP_LATENCY * 1000000LL;
+	/// move the playout on the monotonic clock
+	playout += (int64_t)(now - realtime);
+	return playout - player_delay(ctx->player) * 1000000LL;
+}
+
+/**
+ * @brief date the packet with its release time.
+ *
+ * All the receivers play the same sample at the same wallclock time:
+ * the time of the sender report plus DEMUX_RTP_LATENCY. The demux
+ * doesn't wait, the heartbeat of the jitter holds the packet until
+ * this time on the thread of the decoder.
+ */
+static void _demux_sync(demux_ctx_t *ctx, demux_out_t *out, rtpheader_t *header)
+{
+	out->release = 0;
+	int64_t release = _demux_release(ctx, out, header);
+	if (release == 0)
+		return;
+	int64_t now = _demux_clock(CLOCK_MONOTONIC);
+	if (release > (int64_t)now)
+	{
+		/// too far, the mapping is wrong
+		if (release - (int64_t)now > 10 * DEMUX_RTP_LATENCY * 1000000LL)
+			return;
+		out->release = release;
+	}
+	else if ((int64_t)now - release > DEMUX_RTP_LATENCY * 1000000LL)
+	{
+		out->late++;
+		dbg("demux: packet late %ld ms (%ld)", ((int64_t)now - release) / 1000000, out->late);
+	}
+}
+
+/**
+ * @brief set the heartbeat on the jitter of the decoder
+ */
+static void _demux_syncattach(demux_out_t *out)
+{
+	out->heartbeat.ops = heartbeat_clock;
+	out->heartbeat.ctx = heartbeat_clock->init(NULL);
+	heartbeat_t *old = out->jitter->ops->heartbeat(out->jitter->ctx, &out->heartbeat);
+	if (old != NULL || out->jitter->ctx->heartbeat != &out->heartbeat)
+	{
+		/// the jitter is already paced by its consumer
+		if (old != NULL)
+			out->jitter->ops->heartbeat(out->jitter->ctx, old);
+		warn("demux: rtp stream %u not synchronized", out->ssrc);
+		heartbeat_clock->destroy(out->heartbeat.ctx);
+		out->heartbeat.ctx = NULL;
+		return;
+	}
+	out->releases = calloc(out->jitter->ctx->count, sizeof(*out->releases));
+}
+#endif
+
+#ifdef DEMUX_RTP_ARRIVAL
+/**
+ * @brief follow the variation of the transit time of the packets
+ */
+static void _demux_interarrival(demux_ctx_t *ctx, demux_out_t *out, rtpheader_t *header)
+{
+	uint32_t timestamp = ntohl(header->timestamp);
+	if (out->lastarrival != 0)
+	{
+		int64_t media = (int64_t)(int32_t)(timestamp - out->lasttimestamp) * 1000000000LL / out->clockrate;
+		int64_t transit = (int64_t)(ctx->arrival - out->lastarrival) - media;
+		if (transit < 0)
+			transit = -transit;
+		out->interjitter += (transit - out->interjitter) / 16;
+	}
+	out->lastarrival = ctx->arrival;
+	out->lasttimestamp = timestamp;
+}
+#endif
+
+#ifdef SINK_DRIFT
+/**
+ * @brief follow the level of the jitter of the decoder.
+ * The buffer of the device is always full, the drift between the
+ * sender and the device appears on the input of the decoder.
+ */
+static void _demux_drift(demux_ctx_t *ctx, demux_out_t *out, rtpheader_t *header)
+{
+	uint32_t timestamp = ntohl(header->timestamp);
+	if (!out->driftstarted || (int32_t)(timestamp - out->driftts) < 0)
+	{
+		out->driftts = timestamp;
+		out->driftbytes = 0;
+		out->driftstarted = 1;
+		return;
+	}
+	uint32_t duration = timestamp - out->driftts;
+	/// the rate of the compressed streams is measured over one second at least
+	if (duration >= out->clockrate)
+		out->drift.bytespersec = out->driftbytes * out->clockrate / duration;
+	sink_drift(&out->drift, ctx->player, out->jitter, _demux_clock(CLOCK_MONOTONIC));
+}
+#endif
+
+/**
+ * @brief send a packet to the decoder in the order of the sequence numbers
+ */
+static void _demux_packet(demux_ctx_t *ctx, demux_out_t *out, unsigned char *packet, size_t offset, size_t len)
+{
+	rtpheader_t *header = (rtpheader_t *)packet;
+	unsigned char *input = packet + offset;
+	uint16_t seqnum = ntohs(header->b.seqnum);
+	if (out->seqlast == 0)
+		out->seqorig = out->seqlast = seqnum - 1;
+	out->seqlast++;
+	uint16_t gap = seqnum - out->seqlast;
+	if (gap >= UINT16_MAX - SEQNUM_RESTART)
+	{
+		/// late or duplicated, this sequence number is already played
+		out->seqlast--;
+		return;
+	}
+	if (gap > SEQNUM_RESTART)
+	{
+		warn("demux: rtp sequence restarts");
+		out->seqorig = out->seqlast = seqnum;
+		gap = 0;
+	}
+	while (gap-- > 0)
+	{
+		ctx->missing++;
+		warn("demux: packet missing %ld/%d", ctx->missing, (uint16_t)(out->seqlast - out->seqorig));
+#if defined(RTP_FEC)
+		_demux_feclost(ctx, out, out->seqlast);
+#elif defined(RTP_PLC)
+		_demux_conceal(out, 1);
+#endif
+		out->seqlast++;
+	}
+#ifdef RTP_PLC
+	_demux_plctimestamp(out, header);
+#endif
+#ifdef DEMUX_RTP_SYNC
+	_demux_sync(ctx, out, header);
+#endif
+#ifdef RTP_FEC
+	if (_demux_fec(ctx, out, packet, offset, len))
+		return;
+#endif
+	_demux_push(out, input, len);
+#ifdef SINK_DRIFT
+	_demux_drift(ctx, out, header);
+#endif
+}
+
+#ifdef DEMUX_RTP_REORDER
+/**
+ * @brief send the next packet of the ring or skip the missing one
+ */
+static void _demux_reorderpop(demux_ctx_t *ctx, demux_out_t *out)
+{
+	demux_reorder_t *reorder = &out->reorder;
+	demux_packet_t **slot = &reorder->ring[reorder->next % DEMUX_RTP_REORDER_DEPTH];
+	demux_packet_t *packet = *slot;
+	reorder->next++;
+	if (packet == NULL)
+		return;
+	*slot = NULL;
+	reorder->nheld--;
+	_demux_packet(ctx, out, packet->buffer, packet->offset, packet->len - packet->offset);
+	packet->next = reorder->free;
+	reorder->free = packet;
+}
+
+/**
+ * @brief release the packets in order, a missing packet blocks the
+ * next ones until the deadline of the first packet held.
+ *
+ * @arg force to release all the packets
+ */
+static void _demux_reorderrelease(demux_ctx_t *ctx, demux_out_t *out, int force)
+{
+	demux_reorder_t *reorder = &out->reorder;
+	uint64_t now = _demux_clock(CLOCK_MONOTONIC);
+	while (reorder->nheld > 0)
+	{
+		if (reorder->ring[reorder->next % DEMUX_RTP_REORDER_DEPTH] == NULL && !force)
+		{
+			demux_packet_t *first = NULL;
+			uint16_t i;
+			for (i = 1; i < DEMUX_RTP_REORDER_DEPTH && first == NULL; i++)
+				first = reorder->ring[(uint16_t)(reorder->next + i) % DEMUX_RTP_REORDER_DEPTH];
+			if (first != NULL && first->deadline > now)
+				break;
+		}
+		_demux_reorderpop(ctx, out);
+	}
+}
+
+/**
+ * @return the deadline of the first packet held, 0 without packet
+ */
+static uint64_t _demux_reorderdeadline(demux_out_t *out)
+{
+	demux_reorder_t *reorder = &out->reorder;
+	uint16_t i;
+	if (reorder->nheld == 0)
+		return 0;
+	for (i = 0; i < DEMUX_RTP_REORDER_DEPTH; i++)
+	{
+		demux_packet_t *packet = reorder->ring[(uint16_t)(reorder->next + i) % DEMUX_RTP_REORDER_DEPTH];
+		if (packet != NULL)
+			return packet->deadline;
+	}
+	return 0;
+}
+
+/**
+ * @brief wait the next packet or the first deadline of the packets held.
+ * The packets held after a loss are released at their deadline even
+ * if the sender stops.
+ */
+static void _demux_reorderwait(demux_ctx_t *ctx)
+{
+	if (ctx->in->ops->fd == NULL)
+		return;
+	int fd = ctx->in->ops->fd(ctx->in->ctx);
+	while (fd >= 0 && ctx->in->ops->empty(ctx->in->ctx))
+	{
+		uint64_t deadline = 0;
+		demux_out_t *out;
+		for (out = ctx->out; out != NULL; out = out->next)
+		{
+			uint64_t first = _demux_reorderdeadline(out);
+			if (first != 0 && (deadline == 0 || first < deadline))
+				deadline = first;
+		}
+		if (deadline == 0)
+			return;
+		uint64_t now = _demux_clock(CLOCK_MONOTONIC);
+		int timeout = (deadline > now)? (deadline - now + 999999) / 1000000 : 0;
+		struct pollfd pfd = {.fd = fd, .events = POLLIN};
+		int ret = poll(&pfd, 1, timeout);
+		if (ret > 0)
+		{
+			uint64_t value;
+			if (read(fd, &value, sizeof(value)) < 0)
+				demux_dbg("demux: jitter event error %s", strerror(errno));
+			continue;
+		}
+		if (ret < 0 && errno != EINTR)
+			return;
+		for (out = ctx->out; out != NULL; out = out->next)
+		{
+			if (out->jitter != NULL)
+				_demux_reorderrelease(ctx, out, 0);
+		}
+	}
+}
+
+/**
+ * @brief keep a reference on the packet into the ring at the place
+ * of its sequence number
+ */
+static void _demux_reorder(demux_ctx_t *ctx, demux_out_t *out, unsigned char *input, size_t offset, size_t len)
+{
+	rtpheader_t *header = (rtpheader_t *)input;
+	demux_reorder_t *reorder = &out->reorder;
+	uint16_t seqnum = ntohs(header->b.seqnum);
+	if (offset + len > BUFFERSIZE)
+		return;
+	if (reorder->pool == NULL)
+	{
+		int i;
+		reorder->pool = calloc(DEMUX_RTP_REORDER_DEPTH, sizeof(*reorder->pool));
+		for (i = 0; i < DEMUX_RTP_REORDER_DEPTH; i++)
+		{
+			reorder->pool[i].next = reorder->free;
+			reorder->free = &reorder->pool[i];
+		}
+	}
+	if (!reorder->started)
+	{
+		reorder->next = seqnum;
+		reorder->started = 1;
+	}
+	uint16_t distance = seqnum - reorder->next;
+	if (distance >= UINT16_MAX - SEQNUM_RESTART)
+	{
+		dbg("demux: packet %d too late", seqnum);
+		return;
+	}
+	if (distance > SEQNUM_RESTART)
+	{
+		_demux_reorderrelease(ctx, out, 1);
+		reorder->next = seqnum;
+		distance = 0;
+	}
+	/// the ring is full, the oldest packets are released
+	for (; distance >= DEMUX_RTP_REORDER_DEPTH; distance--)
+		_demux_reorderpop(ctx, out);
+	demux_packet_t **slot = &reorder->ring[seqnum % DEMUX_RTP_REORDER_DEPTH];
+	if (*slot != NULL)
+		return;
+
+	demux_packet_t *packet = reorder->free;
+	reorder->free = packet->next;
+	memcpy(packet->buffer, input, offset + len);
+	packet->offset = offset;
+	packet->len = offset + len;
+	packet->deadline = 0;
+#ifdef DEMUX_RTP_SYNC
+	packet->deadline = _demux_release(ctx, out, header);
+#endif
+	/// without playout time, the missing packet is waited more than the jitter of the network
+	if (packet->deadline == 0)
+		packet->deadline = ctx->arrival + DEMUX_RTP_REORDER_DELAY * 1000000ULL + 2 * out->interjitter;
+	*slot = packet;
+	reorder->nheld++;
+	_demux_reorderrelease(ctx, out, 0);
+}
+#endif
+
+/**
+ * @brief remove the corrections of the stream from the ratio of the player
+ */
+static void _demux_unratio(demux_ctx_t *ctx, demux_out_t *out)
+{
+#ifdef SINK_DRIFT
+	sink_driftreset(&out->drift, ctx->player);
+#elif defined(DEMUX_RTP_SYNC)
+	if (out->ratio != 0)
+		player_ratio(ctx->player, -out->ratio);
+	out->ratio = 0;
+#endif
+}
+
+/**
+ * @brief create the decoder of the played stream
+ */
+static void _demux_play(demux_ctx_t *ctx, demux_out_t *out)
+{
+	/// the parked stream doesn't correct the player
+	if (ctx->playout != NULL && ctx->playout != out)
+		_demux_unratio(ctx, ctx->playout);
+	ctx->playout = out;
+#if defined(DEMUX_RTP_SYNC) && !defined(SINK_DRIFT)
+	/// the skew already measured on the stream is sent to the player
+	if (out->ratio != -out->skew)
+	{
+		player_ratio(ctx->player, -out->skew - out->ratio);
+		out->ratio = -out->skew;
+	}
+#endif
+	if (out->estream != NULL)
+		return;
+	event_listener_t *listener = ctx->listener;
+	const src_t src = { .ops = demux_rtp, .ctx = ctx };
+	event_new_es_t event = {.pid = out->ssrc, .src = &src, .mime = out->mime, .jitte = JITTE_HIGH};
+	event_decode_es_t event_decode = {.src = &src};
+	while (listener != NULL)
+	{
+		listener->cb(listener->arg, SRC_EVENT_NEW_ES, (void *)&event);
+		event_decode.pid = event.pid;
+		event_decode.decoder = event.decoder;
+		listener->cb(listener->arg, SRC_EVENT_DECODE_ES, (void *)&event_decode);
+		listener = listener->next;
+	}
 }
 
 static int demux_parseheader(demux_ctx_t *ctx, unsigned char *input, size_t len)
 {
 	rtpheader_t *header = (rtpheader_t *)input;
-	demux_dbg("demux: rtp seqnum %d", header->b.seqnum);
+	demux_dbg("demux: rtp seqnum %d", ntohs(header->b.seqnum));
 #ifdef DEBUG_0
 	int i;
 	fprintf(stderr, "header: ");
@@ -174,15 +1209,33 @@ static int demux_parseheader(demux_ctx_t *ctx, unsigned char *input, size_t len)
 	fprintf(stderr, "\n");
 	warn("rtp header:");
 	warn("\ttimestamp:\t%d", header->timestamp);
-	warn("\tseq:\t%d", header->b.seqnum);
+	warn("\tseq:\t%d", ntohs(header->b.seqnum));
 	warn("\tssrc:\t%d", header->ssrc);
 	warn("\ttype:\t%d", header->b.pt);
 	warn("\tnb csrc:\t%d", header->b.cc);
 	warn("\tpadding:\t%d", header->b.p);
 #endif
-	demux_out_t *out = ctx->out;
-	while (out != NULL && out->ssrc != header->ssrc)
-		out = out->next;
+#ifdef RTP_FEC
+	/// the parity stream names its media stream as CSRC
+	if (header->b.pt == RTP_FEC_PT)
+	{
+		size_t offset = sizeof(*header) + header->b.cc * sizeof(uint32_t);
+		if (header->b.cc == 0 || len < offset)
+			return len;
+		demux_out_t *out = _demux_out(ctx, *(uint32_t *)(input + sizeof(*header)));
+		/// the stream starts with a media packet
+		if (out != NULL && out->jitter != NULL)
+			_demux_fecparity(ctx, out, input, offset, len - offset);
+		return len;
+	}
+#endif
+	demux_out_t *out = _demux_out(ctx, header->ssrc);
+	if (out == NULL && ctx->nbstreams >= DEMUX_RTP_MAXSTREAMS)
+	{
+		if (ctx->dropped++ % DEMUX_RTP_SWITCHPACKETS == 0)
+			warn("demux: too many rtp streams, %lu packets dropped", ctx->dropped);
+		return len;
+	}
 	if (out == NULL)
 	{
 		out = calloc(1, sizeof(*out));
@@ -190,22 +1243,38 @@ static int demux_parseheader(demux_ctx_t *ctx, unsigned char *input, size_t len)
 		out->cc = header->b.cc;
 		out->mime = mime_octetstream;
 		out->mime = demux_profile(ctx, header->b.pt);
-		out->next = ctx->out;
-		ctx->out = out;
-		warn("demux: new  rtp substream %d %s", out->ssrc, out->mime);
-		event_listener_t *listener = ctx->listener;
-		const src_t src = { .ops = demux_rtp, .ctx = ctx };
-		event_new_es_t event = {.pid = out->ssrc, .src = &src, .mime = out->mime, .jitte = JITTE_HIGH};
-		event_decode_es_t event_decode = {.src = &src};
-		while (listener != NULL)
+		out->clockrate = (header->b.pt == RTP_MPA_PT)? 90000 : DEFAULT_SAMPLERATE;
+		if (header->b.pt == RTP_MPA_PT)
+			out->format = sizeof(rtpmpa_t);
+		if (rtp_pcmformat(header->b.pt, &out->samplesize, &out->nchannels, &out->clockrate) != 0)
 		{
-			listener->cb(listener->arg, SRC_EVENT_NEW_ES, (void *)&event);
-			event_decode.pid = event.pid;
-			event_decode.decoder = event.decoder;
-			listener->cb(listener->arg, SRC_EVENT_DECODE_ES, (void *)&event_decode);
-			listener = listener->next;
+			out->samplesize = 0;
+			out->nchannels = 0;
 		}
+#ifdef RTP_PLC
+		if (out->samplesize > 0)
+			out->plc = malloc(BUFFERSIZE);
+#endif
+		demux_out_t **last = &ctx->out;
+		while (*last != NULL)
+			last = &(*last)->next;
+		*last = out;
+		ctx->streams[_demux_slot(ctx, out->ssrc)] = out;
+		ctx->nbstreams++;
+		warn("demux: new  rtp substream %d %s", out->ssrc, out->mime);
+	}
+	ctx->npackets++;
+	out->lastpacket = ctx->npackets;
+	if (ctx->playout == NULL)
+		_demux_play(ctx, out);
+	/// the played stream stops, the first parked stream replaces it
+	else if (out != ctx->playout && ctx->npackets - ctx->playout->lastpacket > DEMUX_RTP_SWITCHPACKETS)
+	{
+		warn("demux: rtp substream %d replaces %d", out->ssrc, ctx->playout->ssrc);
+		_demux_play(ctx, out);
 	}
+	if (out != ctx->playout)
+		return len;
 	input += sizeof(*header);
 	len -= sizeof(*header);
 	if (header->b.cc)
@@ -224,87 +1293,20 @@ static int demux_parseheader(demux_ctx_t *ctx, unsigned char *input, size_t len)
 		input += sizeof(uint16_t);
 		len -= sizeof(uint16_t);
 
-		input += *extlength;
-		len -= *extlength;
+		/// the length of the extension is in words of 32 bits
+		input += ntohs(*extlength) * sizeof(uint32_t);
+		len -= ntohs(*extlength) * sizeof(uint32_t);
 	}
+	/// the stream without decoder is dropped, the others continue
+	if (out->jitter == NULL)
+		return len;
+#ifdef DEMUX_RTP_ARRIVAL
+	_demux_interarrival(ctx, out, header);
+#endif
 #ifdef DEMUX_RTP_REORDER
-	demux_reorder_t *reorder = &ctx->reorder[header->b.seqnum % NB_BUFFERS];
-	int id = header->b.seqnum % (NB_BUFFERS * NB_LOOPS);
-
-	if (out->jitter != NULL && reorder->ready && reorder->id != id)
-	{
-		if (out->data == NULL)
-			out->data = out->jitter->ops->pull(out->jitter->ctx);
-		char *buffer = reorder->buffer;
-		size_t len = reorder->len;
-		while (len > out->jitter->ctx->size)
-		{
-			memcpy(out->data, buffer, out->jitter->ctx->size);
-			out->jitter->ops->push(out->jitter->ctx, out->jitter->ctx->size, NULL);
-			len -= out->jitter->ctx->size;
-			buffer += out->jitter->ctx->size;
-		}
-		memcpy(out->data, buffer, len);
-		out->jitter->ops->push(out->jitter->ctx, len, NULL);
-		out->data = NULL;
-		reorder->ready = 0;
-	}
-	if (!reorder->ready)
-	{
-		if (len > 0)
-		{
-			memcpy(reorder->buffer, input, len);
-			reorder->ready = 1;
-			reorder->id = id;
-		}
-	}
+	_demux_reorder(ctx, out, (unsigned char *)header, input - (unsigned char *)header, len);
 #else
-	if (out->jitter != NULL)
-	{
-		if (ctx->seqnum == 0)
-			ctx->seqorig = ctx->seqnum = header->b.seqnum - 1;
-		ctx->seqnum++;
-		while (ctx->seqnum < header->b.seqnum)
-		{
-#if 0
-			/*
-			 * generate missing data
-			 * this code is not correct:
-			 * it is impossible to generate a good stream for the decoder
-			 * and if they are missing, they are yet old too,
-			 * it is useless to generate them.
-			 * it is more efficient to count the missing PCM and
-			 * remove from the encoder the same number of PCM, who generated
-			 * during previous hole of data.
-			 */
-			if (out->data == NULL)
-				out->data = out->jitter->ops->pull(out->jitter->ctx);
-			memset(out->data, 0, out->jitter->ctx->size);
-			out->jitter->ops->push(out->jitter->ctx, out->jitter->ctx->size, NULL);
-			out->data = NULL;
-#endif
-			ctx->missing++;
-			warn("demux: packet missing %ld/%d", ctx->missing, ctx->seqnum - ctx->seqorig);
-			ctx->seqnum++;
-		}
-		if (out->data == NULL)
-			out->data = out->jitter->ops->pull(out->jitter->ctx);
-		while (len > out->jitter->ctx->size)
-		{
-			err("demux: udp packet has not to overflow 1500 bytes (%ld)", len);
-			memcpy(out->data, input, out->jitter->ctx->size);
-			out->jitter->ops->push(out->jitter->ctx, out->jitter->ctx->size, NULL);
-			len -= out->jitter->ctx->size;
-			input += out->jitter->ctx->size;
-			out->data = out->jitter->ops->pull(out->jitter->ctx);
-		}
-		memcpy(out->data, input, len);
-		demux_dbg("demux: push %ld", len);
-		out->jitter->ops->push(out->jitter->ctx, len, NULL);
-		out->data = NULL;
-	}
-	else
-		exit(0);
+	_demux_packet(ctx, out, (unsigned char *)header, input - (unsigned char *)header, len);
 #endif
 	return len;
 }
@@ -317,7 +1319,17 @@ static void *demux_thread(void *arg)
 	{
 		char *input;
 		size_t len = 0;
+#ifdef DEMUX_RTP_REORDER
+		_demux_reorderwait(ctx);
+#endif
+#ifdef DEMUX_RTP_ARRIVAL
+		/// the source may give the arrival time as beat
+		uint64_t *arrival = NULL;
+		input = ctx->in->ops->peer(ctx->in->ctx, (void **)&arrival);
+		ctx->arrival = (arrival != NULL)? *arrival : _demux_clock(CLOCK_MONOTONIC);
+#else
 		input = ctx->in->ops->peer(ctx->in->ctx, NULL);
+#endif
 		if (input == NULL)
 		{
 			run = 0;
@@ -333,6 +1345,10 @@ static void *demux_thread(void *arg)
 	demux_out_t *out = ctx->out;
 	while (out != NULL)
 	{
+#ifdef DEMUX_RTP_REORDER
+		if (out->jitter != NULL)
+			_demux_reorderrelease(ctx, out, 1);
+#endif
 		const src_t src = { .ops = demux_rtp, .ctx = ctx};
 		event_end_es_t event = {.pid = out->ssrc, .src = &src, .decoder = out->estream};
 		event_listener_t *listener = ctx->listener;
@@ -396,8 +1412,8 @@ static const char *demux_mime(demux_ctx_t *ctx, int index)
 		out = out->next;
 		index--;
 	}
-	if (ctx->out != NULL)
-		return ctx->out->mime;
+	if (out != NULL)
+		return out->mime;
 	return ctx->mime;
 }
 
@@ -423,27 +1439,28 @@ static void demux_eventlistener(demux_ctx_t *ctx, event_listener_cb_t cb, void *
 
 static int demux_attach(demux_ctx_t *ctx, long index, decoder_t *decoder)
 {
-	demux_out_t *out = ctx->out;
-	while (out != NULL && out->ssrc != (uint32_t)index)
-	{
-		out = out->next;
-	}
+	demux_out_t *out = _demux_out(ctx, (uint32_t)index);
 	if (out != NULL)
 	{
 		out->estream = decoder;
 		out->jitter = out->estream->ops->jitter(out->estream->ctx, ctx->jitte);
+		/// the decoder receives the samples at the rate of the payload type
+		if (out->jitter != NULL && out->samplesize > 0)
+			out->jitter->ctx->frequence = out->clockrate;
+#ifdef DEMUX_RTP_SYNC
+		if (out->jitter != NULL && out->releases == NULL)
+			_demux_syncattach(out);
+#endif
+		return 0;
 	}
+	return -1;
 }
 
 static decoder_t *demux_estream(demux_ctx_t *ctx, long index)
 {
-	demux_out_t *out = ctx->out;
-	while (out != NULL)
-	{
-		if (index == out->ssrc)
-			return out->estream;
-		out = out->next;
-	}
+	demux_out_t *out = _demux_out(ctx, (uint32_t)index);
+	if (out != NULL)
+		return out->estream;
 	return NULL;
 }
 
@@ -454,8 +1471,20 @@ static void demux_destroy(demux_ctx_t *ctx)
 	{
 		demux_out_t *old = out;
 		out = out->next;
+		_demux_unratio(ctx, old);
 		if (old->estream != NULL)
 			old->estream->ops->destroy(old->estream->ctx);
+#ifdef RTP_PLC
+		free(old->plc);
+#endif
+#ifdef DEMUX_RTP_REORDER
+		free(old->reorder.pool);
+#endif
+#ifdef DEMUX_RTP_SYNC
+		free(old->releases);
+		if (old->heartbeat.ctx != NULL)
+			heartbeat_clock->destroy(old->heartbeat.ctx);
+#endif
 		free(old);
 	}
 	event_listener_t *listener = ctx->listener;
@@ -465,13 +1494,6 @@ static void demux_destroy(demux_ctx_t *ctx)
 		free(listener);
 		listener = next;
 	}
-	demux_profile_t *profile = ctx->profiles;
-	while (profile != NULL)
-	{
-		demux_profile_t *next = profile->next;
-		free(profile);
-		profile = next;
-	}
 	free(ctx);
 }
 
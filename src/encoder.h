@@ -11,14 +11,21 @@ typedef void encoder_ctx_t;
 typedef struct encoder_s encoder_t;
 struct encoder_s
 {
+	const char *name;
 	encoder_ctx_t *(*init)(player_ctx_t *);
 	jitter_t *(*jitter)(encoder_ctx_t *encoder);
 	int (*run)(encoder_ctx_t *, jitter_t *);
 	const char *(*mime)(encoder_ctx_t *);
 	void (*destroy)(encoder_ctx_t *);
+	/**
+	 * optional: set the bitrate (kbps) of the output before the run
+	 */
+	int (*bitrate)(encoder_ctx_t *, unsigned int bitrate);
 };
 
 const encoder_t *encoder_get(encoder_ctx_t *ctx);
+const encoder_t *encoder_check(const char *codec);
+const char *encoder_namelist(int first);
 
 extern const encoder_t *encoder_passthrough;
 extern const encoder_t *encoder_lame;
@@ -0,0 +1,180 @@
+/*****************************************************************************
+ * encoder_common.c
+ * this file is part of https://github.com/ouistiti-project/putv
+ *****************************************************************************
+ * Copyright (C) 2016-2017
+ *
+ * Authors: Marc Chalain <marc.chalain@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#ifdef ENCODER_MODULES
+#include <dlfcn.h>
+#include <dirent.h>
+#endif
+
+#include "player.h"
+#include "encoder.h"
+
+#define err(format, ...) fprintf(stderr, "\x1B[31m"format"\x1B[0m\n",  ##__VA_ARGS__)
+#define warn(format, ...) fprintf(stderr, "\x1B[35m"format"\x1B[0m\n",  ##__VA_ARGS__)
+#ifdef DEBUG
+#define dbg(format, ...) fprintf(stderr, "\x1B[32m"format"\x1B[0m\n",  ##__VA_ARGS__)
+#else
+#define dbg(...)
+#endif
+
+#define encoder_dbg(...)
+
+#define MAX_ENCODERS 10
+static const encoder_t * encoderslist [MAX_ENCODERS + 1];
+
+#ifdef ENCODER_MODULES
+static const encoder_t * encoder_load_module(const char *root, const char *name)
+{
+	const encoder_t *ops = NULL;
+	if (name != NULL)
+	{
+		char *file = NULL;
+		if (!strncmp("encoder_", name, 8) &&
+			asprintf(&file, "%s/%s", root, name) > 0)
+		{
+			void *dh = dlopen(file, RTLD_NOW | RTLD_DEEPBIND | RTLD_GLOBAL);
+			if (dh == NULL)
+			{
+				err("ERROR: No such output library: '%s %s'", file, dlerror());
+			}
+			else
+			{
+				ops = dlsym(dh, "encoder_ops");
+				dbg("new encoder %p", ops);
+			}
+			free(file);
+		}
+	}
+	return ops;
+}
+#endif
+
+/**
+ * @brief find an encoder from its name or its mime type
+ * ie: "lame", "mp3" or "audio/mp3"
+ *
+ * @arg codec the name of the encoder, NULL for the default encoder
+ *
+ * @return the operations of the encoder or NULL
+ */
+const encoder_t *encoder_check(const char *codec)
+{
+	int i = 0;
+	if (codec == NULL || codec[0] == '\0')
+		return encoderslist[0];
+	const encoder_t *ops = encoderslist[i];
+	while (ops != NULL)
+	{
+		const char *mime = ops->mime(NULL);
+		const char *subtype = strchr(mime, '/');
+		if (ops->name != NULL && !strcmp(codec, ops->name))
+			break;
+		if (!strcmp(codec, mime))
+			break;
+		if (subtype != NULL && !strcmp(codec, subtype + 1))
+			break;
+		i++;
+		ops = encoderslist[i];
+	}
+	if (ops == NULL)
+		err("encoder: %s not found", codec);
+	return ops;
+}
+
+const char *encoder_namelist(int first)
+{
+	const char *name = NULL;
+	static int i = 0;
+	if (first)
+		i = 0;
+	if (encoderslist[i] != NULL)
+	{
+		name = encoderslist[i]->name;
+		i++;
+	}
+	else
+		i = 0;
+	return name;
+}
+
+/**
+ * all the encoders' contexts begin with the operations
+ */
+const encoder_t *encoder_get(encoder_ctx_t *ctx)
+{
+	return *(const encoder_t **)ctx;
+}
+
+static void _encoder_init(void) __attribute__((constructor));
+
+static void _encoder_init(void)
+{
+	const encoder_t *encoders[] = {
+#ifndef ENCODER_MODULES
+#ifdef ENCODER_FLAC
+		encoder_flac,
+#endif
+#ifdef ENCODER_LAME
+		encoder_lame,
+#endif
+#endif
+#ifdef ENCODER_PASSTHROUGH
+		encoder_passthrough,
+#endif
+		NULL
+	};
+
+	int i;
+	for (i = 0; i < MAX_ENCODERS && encoders[i] != NULL; i++)
+	{
+		encoderslist[i] = encoders[i];
+	}
+
+#ifdef ENCODER_MODULES
+	struct dirent **namelist;
+	int n;
+
+	n = scandir(PKGLIBDIR, &namelist, NULL, alphasort);
+	while (n > 0)
+	{
+		n--;
+		if (namelist[n]->d_name[0] != '.')
+		{
+			const encoder_t *ops = encoder_load_module(PKGLIBDIR, namelist[n]->d_name);
+			if (ops != NULL && i < MAX_ENCODERS)
+				encoderslist[i++] = ops;
+		}
+		free(namelist[n]);
+	}
+	free(namelist);
+#endif
+}
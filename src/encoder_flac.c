@@ -52,7 +52,6 @@ struct encoder_ctx_s
 	unsigned char nchannels;
 	unsigned char samplesize;
 	unsigned short samplesframe;
-	unsigned int framescnt;
 	int dumpfd;
 	pthread_t thread;
 	player_ctx_t *player;
@@ -84,9 +83,27 @@ struct encoder_ctx_s
 #define DEFAULT_SAMPLERATE 44100
 #endif
 
+#ifdef LOWLATENCY
+#define BLOCKSIZE 576
+/// the pool of threads queues several blocks before to write them
+#undef ENCODER_FLAC_THREADS
+#define ENCODER_FLAC_THREADS 1
+#else
 #define NB_BUFFERS 6
+#define BLOCKSIZE 1000
+#endif
 #define LATENCY 200 //ms
-#define MAX_SAMPLES (44100 * 60 * 2)
+
+/**
+ * libFLAC 1.5 compresses the frames on a pool of threads
+ * and calls the write callback in the order of the stream.
+ */
+#if defined(FLAC_API_VERSION_CURRENT) && FLAC_API_VERSION_CURRENT >= 14
+#define ENCODER_FLAC_MT
+#endif
+#ifndef ENCODER_FLAC_THREADS
+#define ENCODER_FLAC_THREADS 0
+#endif
 
 static const char *jitter_name = "flac encoder";
 
@@ -147,17 +164,36 @@ static int encoder_flac_init(encoder_ctx_t *ctx)
 	/** reinitialize the encoder **/
 	FLAC__stream_encoder_finish(ctx->encoder);
 
+#ifdef ENCODER_FLAC_MT
+	long nthreads = ENCODER_FLAC_THREADS;
+	if (nthreads < 1)
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nthreads < 1)
+		nthreads = 1;
+	/**
+	 * the verification decodes each frame again in the thread of
+	 * the write callback, it is useful only for the debug.
+	 */
+	ret = FLAC__stream_encoder_set_verify(ctx->encoder, (nthreads == 1));
+	if (FLAC__stream_encoder_set_num_threads(ctx->encoder, nthreads) != FLAC__STREAM_ENCODER_SET_NUM_THREADS_OK)
+		warn("encoder: flac multithreading not available");
+	else
+		dbg("encoder: flac on %ld threads", nthreads);
+#else
 	ret = FLAC__stream_encoder_set_verify(ctx->encoder, true);
+#endif
 	FLAC__stream_encoder_set_streamable_subset(ctx->encoder, true);
 	FLAC__stream_encoder_set_sample_rate(ctx->encoder, ctx->samplerate);
 	FLAC__stream_encoder_set_bits_per_sample(ctx->encoder, 24);
 	FLAC__stream_encoder_set_channels(ctx->encoder, ctx->nchannels);
 	FLAC__stream_encoder_set_compression_level(ctx->encoder, 2);
-	FLAC__stream_encoder_set_blocksize(ctx->encoder, 1000);
+	FLAC__stream_encoder_set_blocksize(ctx->encoder, BLOCKSIZE);
 //	FLAC__stream_encoder_set_blocksize(ctx->encoder, 0);
-	FLAC__stream_encoder_set_total_samples_estimate(ctx->encoder, MAX_SAMPLES);
+	/**
+	 * the stream is continuous, the total number of samples is unknown
+	 */
+	FLAC__stream_encoder_set_total_samples_estimate(ctx->encoder, 0);
 
-	ctx->framescnt = 0;
 	dbg("flac: initialized");
 	return ret;
 }
@@ -202,7 +238,13 @@ static encoder_ctx_t *encoder_init(player_ctx_t *player)
 		ctx->samplerate,
 		ctx->samplesize,
 		ctx->nchannels);
-	jitter_t *jitter = jitter_scattergather_init(jitter_name, NB_BUFFERS, buffsize);
+#ifdef LOWLATENCY
+	/// the encoder writes a block when the samples of one block are queued
+	unsigned int count = JITTER_MINCOUNT(BLOCKSIZE * ctx->samplesize * ctx->nchannels, buffsize);
+#else
+	unsigned int count = NB_BUFFERS;
+#endif
+	jitter_t *jitter = jitter_scattergather_init(jitter_name, count, buffsize);
 	ctx->in = jitter;
 	jitter->format = format;
 	jitter->ctx->frequence = 0; // automatic freq
@@ -259,18 +301,6 @@ static void *_encoder_thread(void *arg)
 				ret = -1;
 			}
 		}
-		ctx->framescnt++;
-		if (ctx->framescnt > (MAX_SAMPLES / ctx->samplesframe))
-		{
-			encoder_flac_init(ctx);
-
-			FLAC__StreamEncoderInitStatus init_status;
-			init_status = FLAC__stream_encoder_init_stream(ctx->encoder, _encoder_writecb, NULL, NULL, NULL, ctx);
-			if(init_status != FLAC__STREAM_ENCODER_INIT_STATUS_OK) {
-				err("encoder: flac initializing encoder: %s\n", FLAC__StreamEncoderInitStatusString[init_status]);
-				ret = -1;
-			}
-		}
 
 		if (ctx->inbuffer)
 		{
@@ -324,6 +354,8 @@ static int encoder_run(encoder_ctx_t *ctx, jitter_t *jitter)
 	dbg("set heart %s %dms %dkbps", jitter->ctx->name, timeslot, bitrate);
 	jitter->ops->heartbeat(jitter->ctx, &ctx->heartbeat);
 #endif
+	unsigned int delay = ctx->in->ctx->thredhold * ctx->samplesframe + BLOCKSIZE;
+	player_setdelay(ctx->player, ctx->in, jitter, delay * 1000 / ctx->samplerate);
 	if (ret == 0)
 		pthread_create(&ctx->thread, NULL, _encoder_thread, ctx);
 	return ret;
@@ -352,8 +384,9 @@ static void encoder_destroy(encoder_ctx_t *ctx)
 	free(ctx);
 }
 
-const encoder_t *encoder_flac = &(encoder_t)
+const encoder_t _encoder_flac =
 {
+	.name = "flac",
 	.init = encoder_init,
 	.jitter = encoder_jitter,
 	.run = encoder_run,
@@ -361,10 +394,8 @@ const encoder_t *encoder_flac = &(encoder_t)
 	.destroy = encoder_destroy,
 };
 
-#ifndef ENCODER_GET
-#define ENCODER_GET
-const encoder_t *encoder_get(encoder_ctx_t *ctx)
-{
-	return ctx->ops;
-}
+const encoder_t *encoder_flac = &_encoder_flac;
+
+#ifdef ENCODER_MODULES
+extern const encoder_t encoder_ops __attribute__ ((weak, alias ("_encoder_flac")));
 #endif
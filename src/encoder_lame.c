@@ -49,6 +49,7 @@ struct encoder_ctx_s
 	const encoder_t *ops;
 	lame_global_flags *encoder;
 	unsigned int samplerate;
+	unsigned int bitrate;
 	unsigned char nchannels;
 	unsigned char samplesize;
 	int samplesframe;
@@ -57,6 +58,14 @@ struct encoder_ctx_s
 	player_ctx_t *player;
 	jitter_t *in;
 	unsigned char *inbuffer;
+	size_t inoffset;
+	/// batch of samplesframe samples sent to lame in one call
+	unsigned char *pcm;
+	int pcmlength;
+	/// encoded stream waiting to be cut on the frame boundaries
+	unsigned char *mp3;
+	size_t mp3length;
+	size_t mp3size;
 	jitter_t *out;
 	unsigned char *outbuffer;
 	heartbeat_t heartbeat;
@@ -79,7 +88,20 @@ struct encoder_ctx_s
 #define ENCODER_HEARTBEAT
 #endif
 
+#ifdef LOWLATENCY
+/**
+ * the encoder sends each frame as soon as it is encoded
+ */
+#undef ENCODER_LAME_NFRAMES
+#define ENCODER_LAME_NFRAMES 1
+#undef ENCODER_VBR
+#else
 #define NB_BUFFERS 6
+#endif
+
+#ifndef ENCODER_LAME_NFRAMES
+#define ENCODER_LAME_NFRAMES 3
+#endif
 
 static const char *jitter_name = "lame encoder";
 void error_report(const char *format, va_list ap)
@@ -114,8 +136,13 @@ static int encoder_lame_init(encoder_ctx_t *ctx)
 #else
 	lame_set_VBR_q(ctx->encoder, 4);
 #endif
+	if (ctx->bitrate > 0)
+		lame_set_VBR_max_bitrate_kbps(ctx->encoder, ctx->bitrate);
 #else
 	lame_set_VBR(ctx->encoder, vbr_off);
+	if (ctx->bitrate > 0)
+		lame_set_brate(ctx->encoder, ctx->bitrate);
+	else
 #if DEFAULT_SAMPLERATE == 48000
 	lame_set_brate(ctx->encoder, 112);
 #else
@@ -124,6 +151,10 @@ static int encoder_lame_init(encoder_ctx_t *ctx)
 #endif
 
 	lame_set_disable_reservoir(ctx->encoder, 1);
+#ifdef LOWLATENCY
+	lame_set_quality(ctx->encoder, 7);
+	lame_set_bWriteVbrTag(ctx->encoder, 0);
+#endif
 	lame_init_params(ctx->encoder);
 	return 0;
 }
@@ -143,12 +174,23 @@ static encoder_ctx_t *encoder_init(player_ctx_t *player)
 	ctx->dumpfd = open("lame_dump.mp3", O_RDWR | O_CREAT, 0644);
 #endif
 	/**
-	 * set samples frame to 3 framesize to have less than 1500 bytes
-	 * but more than 1000 bytes into the output
+	 * set samples frame to ENCODER_LAME_NFRAMES framesize
+	 * (3 frames to have less than 1500 bytes but more than 1000 bytes
+	 * into the output). The encoder waits a complete batch before
+	 * to call lame, then it never generates partial frames.
 	 */
-	ctx->samplesframe = lame_get_framesize(ctx->encoder) * 3;
-	//ctx->samplesframe = 576;
+	ctx->samplesframe = lame_get_framesize(ctx->encoder) * ENCODER_LAME_NFRAMES;
 	unsigned long buffsize = ctx->samplesframe * ctx->samplesize * ctx->nchannels;
+	if (posix_memalign((void **)&ctx->pcm, 16, buffsize) != 0)
+	{
+		err("encoder lame: not enought memory");
+		lame_close(ctx->encoder);
+		free(ctx);
+		return NULL;
+	}
+	/// lame requests 1.25 * nsamples + 7200 bytes, plus one frame of the previous batch
+	ctx->mp3size = ctx->samplesframe * 5 / 4 + 7200 + 2881;
+	ctx->mp3 = malloc(ctx->mp3size);
 	dbg("encoder config :\n" \
 		"\tbuffer size %lu\n" \
 		"\tsample rate %d\n" \
@@ -158,8 +200,14 @@ static encoder_ctx_t *encoder_init(player_ctx_t *player)
 		ctx->samplerate,
 		ctx->samplesize,
 		ctx->nchannels);
-	jitter_t *jitter = jitter_scattergather_init(jitter_name, NB_BUFFERS,
-				ctx->samplesframe * ctx->samplesize * ctx->nchannels);
+	size_t size = ctx->samplesframe * ctx->samplesize * ctx->nchannels;
+#ifdef LOWLATENCY
+	/// lame encodes one frame from each buffer
+	unsigned int count = JITTER_MINCOUNT(lame_get_framesize(ctx->encoder) * ctx->samplesize * ctx->nchannels, size);
+#else
+	unsigned int count = NB_BUFFERS;
+#endif
+	jitter_t *jitter = jitter_scattergather_init(jitter_name, count, size);
 	ctx->in = jitter;
 	jitter->format = PCM_16bits_LE_stereo;
 	jitter->ctx->frequence = 0; // automatic freq
@@ -180,6 +228,101 @@ static void encoder_message(const char *format, va_list ap)
 }
 #endif
 
+/**
+ * @brief send the output buffer with the frames already copied
+ */
+static void _encoder_lame_push(encoder_ctx_t *ctx, size_t length)
+{
+	encoder_dbg("encoder lame %lu", length);
+	beat_bitrate_t *beat = NULL;
+#ifdef ENCODER_HEARTBEAT
+	ctx->beat.length = length;
+	beat = &ctx->beat;
+#endif
+	ctx->out->ops->push(ctx->out->ctx, length, beat);
+	ctx->outbuffer = NULL;
+}
+
+/**
+ * @brief encode the batch of samples
+ *
+ * @return the number of bytes added to the mp3 buffer or a lame error
+ */
+static int _encoder_lame_encode(encoder_ctx_t *ctx)
+{
+	if (ctx->pcmlength == 0)
+		return 0;
+	int ret = lame_encode_buffer_interleaved(ctx->encoder,
+			(short int *)ctx->pcm, ctx->pcmlength,
+			ctx->mp3 + ctx->mp3length, ctx->mp3size - ctx->mp3length);
+	ctx->pcmlength = 0;
+	return ret;
+}
+
+/**
+ * @brief send the complete frames of the mp3 buffer to the output
+ * one output buffer contains only whole frames, the last partial
+ * frame stays into the mp3 buffer for the next batch.
+ *
+ * @arg length the number of bytes added to the mp3 buffer
+ *
+ * @return 0 or -1 on error
+ */
+static int _encoder_lame_packet(encoder_ctx_t *ctx, int length)
+{
+#ifdef ENCODER_DUMP
+	if (ctx->dumpfd > 0 && length > 0)
+	{
+		write(ctx->dumpfd, ctx->mp3 + ctx->mp3length, length);
+	}
+#endif
+	ctx->mp3length += length;
+
+	size_t offset = 0;
+	size_t outlength = 0;
+	while (offset < ctx->mp3length)
+	{
+		/// the header continues into the next batch
+		if (ctx->mp3length - offset < 4)
+			break;
+		int framelength = utils_mp3frame(ctx->mp3 + offset, ctx->mp3length - offset, NULL, NULL);
+		if (framelength <= 0)
+		{
+			/// resynchronize on the next frame header
+			offset++;
+			continue;
+		}
+		if (framelength > ctx->mp3length - offset)
+			break;
+		if (framelength > ctx->out->ctx->size)
+		{
+			err("encoder lame: frame too large %d %ld", framelength, ctx->out->ctx->size);
+			offset += framelength;
+			continue;
+		}
+		if (outlength + framelength > ctx->out->ctx->size)
+		{
+			_encoder_lame_push(ctx, outlength);
+			outlength = 0;
+		}
+		if (ctx->outbuffer == NULL)
+		{
+			ctx->outbuffer = ctx->out->ops->pull(ctx->out->ctx);
+			if (ctx->outbuffer == NULL)
+				return -1;
+		}
+		memcpy(ctx->outbuffer + outlength, ctx->mp3 + offset, framelength);
+		outlength += framelength;
+		offset += framelength;
+	}
+	if (outlength > 0)
+		_encoder_lame_push(ctx, outlength);
+	ctx->mp3length -= offset;
+	if (ctx->mp3length > 0)
+		memmove(ctx->mp3, ctx->mp3 + offset, ctx->mp3length);
+	return 0;
+}
+
 static void *lame_thread(void *arg)
 {
 	int result = 0;
@@ -203,56 +346,57 @@ static void *lame_thread(void *arg)
 	{
 		int ret = 0;
 
-		ctx->inbuffer = ctx->in->ops->peer(ctx->in->ctx, NULL);
-		unsigned int inlength = ctx->in->ops->length(ctx->in->ctx);
-		inlength /= ctx->samplesize * ctx->nchannels;
-		if (inlength < ctx->samplesframe)
-			warn("encoder lame: frame too small %d %ld", inlength, ctx->in->ctx->size);
-		if (ctx->in->ctx->frequence != ctx->samplerate)
-		{
-			ctx->samplerate = ctx->in->ctx->frequence;
-			encoder_lame_init(ctx);
-		}
-		if (ctx->outbuffer == NULL)
+		if (ctx->inbuffer == NULL)
 		{
-			ctx->outbuffer = ctx->out->ops->pull(ctx->out->ctx);
+			ctx->inbuffer = ctx->in->ops->peer(ctx->in->ctx, NULL);
+			ctx->inoffset = 0;
+			if (ctx->inbuffer && ctx->in->ctx->frequence != ctx->samplerate)
+			{
+				/// the pending samples are encoded with the previous samplerate
+				ret = _encoder_lame_encode(ctx);
+				if (ret >= 0)
+					ret = _encoder_lame_packet(ctx, ret);
+				ctx->samplerate = ctx->in->ctx->frequence;
+				encoder_lame_init(ctx);
+			}
 		}
 		if (ctx->inbuffer)
 		{
-			ret = lame_encode_buffer_interleaved(ctx->encoder,
-					(short int *)ctx->inbuffer, inlength,
-					ctx->outbuffer, ctx->out->ctx->size);
-#ifdef ENCODER_DUMP
-			if (ctx->dumpfd > 0 && ret > 0)
+			size_t inlength = ctx->in->ops->length(ctx->in->ctx);
+			size_t framesize = ctx->samplesize * ctx->nchannels;
+			size_t len = inlength - ctx->inoffset;
+			size_t missing = (ctx->samplesframe - ctx->pcmlength) * framesize;
+			if (len > missing)
+				len = missing;
+			memcpy(ctx->pcm + ctx->pcmlength * framesize, ctx->inbuffer + ctx->inoffset, len);
+			ctx->pcmlength += len / framesize;
+			ctx->inoffset += len;
+			if (ctx->inoffset >= inlength)
 			{
-				write(ctx->dumpfd, ctx->outbuffer, ret);
+				ctx->in->ops->pop(ctx->in->ctx, inlength);
+				ctx->inbuffer = NULL;
 			}
-#endif
-			ctx->in->ops->pop(ctx->in->ctx, ctx->in->ctx->size);
+			if (ctx->pcmlength < ctx->samplesframe)
+				continue;
+			ret = _encoder_lame_encode(ctx);
 		}
 		else
 		{
-			ret = lame_encode_flush_nogap(ctx->encoder, ctx->outbuffer, ctx->out->ctx->size);
+			ret = _encoder_lame_encode(ctx);
+			if (ret >= 0)
+				ret = _encoder_lame_packet(ctx, ret);
+			if (ret >= 0)
+				ret = lame_encode_flush_nogap(ctx->encoder,
+						ctx->mp3 + ctx->mp3length, ctx->mp3size - ctx->mp3length);
 			/* TODO : request media data from player to set new ID3 tag */
 			lame_init_bitstream(ctx->encoder);
 		}
-		if (ret > 0)
-		{
-			encoder_dbg("encoder lame %d", ret);
-			beat_bitrate_t *beat = NULL;
-#ifdef ENCODER_HEARTBEAT
-			//ctx->heartbeat.ops->unlock(&ctx->heartbeat.ctx);
-			ctx->beat.length = ret;
-			beat = &ctx->beat;
-			//ctx->heartbeat.ops->unlock(&ctx->heartbeat.ctx);
-#endif
-			ctx->out->ops->push(ctx->out->ctx, ret, beat);
-			ctx->outbuffer = NULL;
-		}
+		if (ret >= 0)
+			ret = _encoder_lame_packet(ctx, ret);
 		if (ret < 0)
 		{
 			if (ret == -1)
-				err("lame error %d, too small buffer %ld", ret, ctx->out->ctx->size);
+				err("lame error %d, too small buffer %ld", ret, ctx->mp3size);
 			else
 				err("lame error %d", ret);
 			run = 0;
@@ -285,6 +429,13 @@ static int encoder_run(encoder_ctx_t *ctx, jitter_t *jitter)
 	dbg("set heart %s %dms %dkbps", jitter->ctx->name, config.ms, config.bitrate);
 	jitter->ops->heartbeat(jitter->ctx, &ctx->heartbeat);
 #endif
+	/**
+	 * the input jitter waits thredhold batches, lame keeps its own
+	 * delay (MDCT overlapping) before to generate the first frame
+	 */
+	unsigned int delay = ctx->in->ctx->thredhold * ctx->samplesframe;
+	delay += lame_get_encoder_delay(ctx->encoder) + lame_get_framesize(ctx->encoder);
+	player_setdelay(ctx->player, ctx->in, jitter, delay * 1000 / ctx->samplerate);
 	pthread_create(&ctx->thread, NULL, lame_thread, ctx);
 	return 0;
 }
@@ -294,6 +445,12 @@ static const char *encoder_mime(encoder_ctx_t *encoder)
 	return mime_audiomp3;
 }
 
+static int encoder_bitrate(encoder_ctx_t *ctx, unsigned int bitrate)
+{
+	ctx->bitrate = bitrate;
+	return encoder_lame_init(ctx);
+}
+
 static void encoder_destroy(encoder_ctx_t *ctx)
 {
 #ifdef ENCODER_DUMP
@@ -308,22 +465,24 @@ static void encoder_destroy(encoder_ctx_t *ctx)
 #endif
 	/* release the decoder */
 	jitter_scattergather_destroy(ctx->in);
+	free(ctx->pcm);
+	free(ctx->mp3);
 	free(ctx);
 }
 
-const encoder_t *encoder_lame = &(encoder_t)
+const encoder_t _encoder_lame =
 {
+	.name = "lame",
 	.init = encoder_init,
 	.jitter = encoder_jitter,
 	.run = encoder_run,
 	.mime = encoder_mime,
 	.destroy = encoder_destroy,
+	.bitrate = encoder_bitrate,
 };
 
-#ifndef ENCODER_GET
-#define ENCODER_GET
-const encoder_t *encoder_get(encoder_ctx_t *ctx)
-{
-	return ctx->ops;
-}
+const encoder_t *encoder_lame = &_encoder_lame;
+
+#ifdef ENCODER_MODULES
+extern const encoder_t encoder_ops __attribute__ ((weak, alias ("_encoder_lame")));
 #endif
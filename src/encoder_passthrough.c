@@ -84,17 +84,10 @@ static void encoder_destroy(encoder_ctx_t *encoder)
 
 const encoder_t *encoder_passthrough = &(encoder_t)
 {
+	.name = "passthrough",
 	.init = encoder_init,
 	.jitter = encoder_jitter,
 	.run = encoder_run,
 	.mime = encoder_mime,
 	.destroy = encoder_destroy,
 };
-
-#ifndef ENCODER_GET
-#define ENCODER_GET
-const encoder_t *encoder_get(encoder_ctx_t *ctx)
-{
-	return ctx->ops;
-}
-#endif
@@ -38,6 +38,11 @@ struct filter_ops_s
 	filter_ctx_t *(*init)(sampled_t sampled, jitter_format_t format, ...);
 	int (*set)(filter_ctx_t *ctx, sampled_t sampled, jitter_format_t format, unsigned int rate);
 	int (*run)(filter_ctx_t *ctx, filter_audio_t *audio, unsigned char *buffer, size_t size);
+	/**
+	 * optional: change the number of samples out of the filter
+	 * with a correction in ppm
+	 */
+	int (*ratio)(filter_ctx_t *ctx, int ppm);
 	void (*destroy)(filter_ctx_t *);
 };
 
@@ -50,4 +55,6 @@ struct filter_s
 
 filter_t *filter_build(const char *name, jitter_format_t format, sampled_t sampled);
 
+extern const filter_ops_t *filter_pcm_interleave;
+
 #endif
@@ -28,6 +28,10 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
+#ifdef FILTER_RESAMPLING
+#include <math.h>
+#endif
 
 # define SIZEOF_INT 4
 
@@ -37,6 +41,16 @@ typedef   signed int sample_t;
 typedef   signed long sample_t;
 #endif
 
+#define MAXCHANNELS 8
+#ifdef FILTER_RESAMPLING
+/// the taps of the band-limited interpolation
+#define SINC_TAPS 48
+/// the phases of the interpolation between two input samples
+#define SINC_PHASEBITS 8
+#define SINC_PHASES (1 << SINC_PHASEBITS)
+/// the bits of the coefficients
+#define SINC_COEFBITS 24
+#endif
 typedef struct filter_ctx_s filter_ctx_t;
 typedef int (*sampled_t)(filter_ctx_t *ctx, sample_t sample, int bitspersample, unsigned char *out);
 struct filter_ctx_s
@@ -47,6 +61,23 @@ struct filter_ctx_s
 	unsigned char shift;
 	unsigned char nchannels;
 	unsigned char channel;
+	/// the samples are written in network byte order
+	unsigned char bigendian;
+#ifdef FILTER_RESAMPLING
+	/// the position of the next output sample after the previous input sample
+	uint32_t step;
+	uint32_t frac;
+	sample_t previous[MAXCHANNELS];
+	/// the samplerate of the input, converted to samplerate
+	unsigned int inrate;
+	int ppm;
+	/// the coefficients of the low-pass filter for each phase and the next one
+	int32_t (*sinc)[SINC_TAPS];
+	/// the cut-off of the coefficients in 1/1000 of the input's Nyquist
+	unsigned int cutoff;
+	/// the last input samples, the newest at the end
+	sample_t history[MAXCHANNELS][SINC_TAPS];
+#endif
 };
 #define FILTER_CTX
 #include "filter.h"
@@ -62,14 +93,25 @@ struct filter_ctx_s
 static filter_ctx_t *filter_init(sampled_t sampled, jitter_format_t format,...);
 static int filter_set(filter_ctx_t *ctx, sampled_t sampled, jitter_format_t format, unsigned int samplerate);
 static void filter_destroy(filter_ctx_t *ctx);
+#ifdef FILTER_RESAMPLING
+static void _filter_step(filter_ctx_t *ctx);
+#endif
 
 # define FRACBITS		28
 # define ONE		((sample_t)(0x10000000L))
 
+#ifdef FILTER_RESAMPLING
+# define STEPBITS		24
+# define STEPONE		(1U << STEPBITS)
+#endif
+
 static filter_ctx_t *filter_init(sampled_t sampled, jitter_format_t format,...)
 {
 	filter_ctx_t *ctx = calloc(1, sizeof(*ctx));
 	ctx->sampled = sampled;
+#ifdef FILTER_RESAMPLING
+	ctx->step = STEPONE;
+#endif
 
 	filter_set(ctx, sampled, format, 44100);
 	return ctx;
@@ -106,6 +148,7 @@ static int filter_set(filter_ctx_t *ctx, sampled_t sampled, jitter_format_t form
 	unsigned char samplesize = 4;
 	unsigned char shift = 24;
 	unsigned char nchannels = 2;
+	unsigned char bigendian = 0;
 	switch (format)
 	{
 	case PCM_8bits_mono:
@@ -118,11 +161,17 @@ static int filter_set(filter_ctx_t *ctx, sampled_t sampled, jitter_format_t form
 		shift = 16;
 		nchannels = 1;
 	break;
+	case PCM_16bits_BE_stereo:
+		bigendian = 1;
+		/* fallthrough */
 	case PCM_16bits_LE_stereo:
 		samplesize = 2;
 		shift = 16;
 		nchannels = 2;
 	break;
+	case PCM_24bits3_BE_stereo:
+		bigendian = 1;
+		/* fallthrough */
 	case PCM_24bits3_LE_stereo:
 		samplesize = 3;
 		shift = 24;
@@ -134,6 +183,8 @@ static int filter_set(filter_ctx_t *ctx, sampled_t sampled, jitter_format_t form
 		nchannels = 2;
 	break;
 	case PCM_32bits_BE_stereo:
+		bigendian = 1;
+		/* fallthrough */
 	case PCM_32bits_LE_stereo:
 		samplesize = 4;
 		shift = 32;
@@ -146,12 +197,19 @@ static int filter_set(filter_ctx_t *ctx, sampled_t sampled, jitter_format_t form
 	ctx->samplesize = samplesize;
 	ctx->shift = shift;
 	ctx->nchannels = nchannels;
+	ctx->bigendian = bigendian;
 	ctx->samplerate = samplerate;
+#ifdef FILTER_RESAMPLING
+	_filter_step(ctx);
+#endif
 	return 0;
 }
 
 static void filter_destroy(filter_ctx_t *ctx)
 {
+#ifdef FILTER_RESAMPLING
+	free(ctx->sinc);
+#endif
 	free(ctx);
 }
 
@@ -192,25 +250,223 @@ int sampled_change(filter_ctx_t *ctx, sample_t sample, int bitspersample, unsign
 	int i = 0, j = 0;
 	for (i = 0; i < ctx->samplesize; i++)
 	{
+		/// the byte of weight i
+		int k = (ctx->bigendian)? ctx->samplesize - 1 - i : i;
 		if ((i * 8) < (ctx->shift - bitspersample))
 		{
-			out[i] = 0;
+			out[k] = 0;
 			j++;
 		}
 		else if ((i * 8) > (ctx->shift))
-			out[i] = 0;
+			out[k] = 0;
 		else
-			out[i] = sample >> ((i - j) * 8);
+			out[k] = sample >> ((i - j) * 8);
 	}
 	return ctx->samplesize;
 }
 
+#ifdef FILTER_RESAMPLING
+static sample_t _filter_sample(filter_audio_t *audio, int channel, int i)
+{
+	sample_t sample;
+	if (channel < audio->nchannels)
+		sample = audio->samples[channel][i];
+	else
+		sample = audio->samples[0][i];
+	if (audio->regain > 0)
+		sample = sample << audio->regain;
+	else if (audio->regain < 0)
+		sample = sample >> -audio->regain;
+	return sample;
+}
+
+/**
+ * @brief the step between two output samples, in input samples
+ *
+ * The step converts the samplerate of the input to the samplerate
+ * of the output (the rate of the device) and applies the correction
+ * of the player.
+ */
+static void _filter_step(filter_ctx_t *ctx)
+{
+	uint64_t step = ((uint64_t)STEPONE * 1000000) / (1000000 + ctx->ppm);
+	if (ctx->inrate > 0 && ctx->samplerate > 0)
+		step = step * ctx->inrate / ctx->samplerate;
+	ctx->step = step;
+}
+
+/**
+ * @brief build the coefficients of the windowed sinc for a cut-off
+ * under the Nyquist frequence of the input and of the output.
+ * Each phase is normalized to keep the gain of the DC.
+ */
+static void _filter_sinc(filter_ctx_t *ctx, unsigned int cutoff)
+{
+	if (ctx->sinc != NULL && ctx->cutoff == cutoff)
+		return;
+	if (ctx->sinc == NULL)
+		ctx->sinc = calloc(SINC_PHASES + 1, sizeof(*ctx->sinc));
+	ctx->cutoff = cutoff;
+	double fc = (double)cutoff / 1000;
+	int p;
+	/// the last phase is the first one moved by one tap, for the interpolation
+	for (p = 0; p <= SINC_PHASES; p++)
+	{
+		double coefs[SINC_TAPS];
+		double sum = 0;
+		int k;
+		for (k = 0; k < SINC_TAPS; k++)
+		{
+			/// the output is between the taps SINC_TAPS/2 - 1 and SINC_TAPS/2
+			double x = k - (SINC_TAPS / 2 - 1) - (double)p / SINC_PHASES;
+			double sinc = (x == 0)? 1 : sin(M_PI * fc * x) / (M_PI * fc * x);
+			/// Blackman window
+			double w = 0.42 + 0.5 * cos(M_PI * x / (SINC_TAPS / 2)) +
+					0.08 * cos(2 * M_PI * x / (SINC_TAPS / 2));
+			if (x <= -SINC_TAPS / 2 || x >= SINC_TAPS / 2)
+				w = 0;
+			coefs[k] = sinc * w;
+			sum += coefs[k];
+		}
+		for (k = 0; k < SINC_TAPS; k++)
+			ctx->sinc[p][k] = (int32_t)lround(coefs[k] / sum * (1 << SINC_COEFBITS));
+	}
+}
+
+/**
+ * @brief interleave the channels with a linear interpolation
+ * between the previous and the current input samples.
+ * The linear interpolation is used only for the ratio of the player
+ * (less than PLAYER_RATIO_MAX ppm), the images of the spectrum stay
+ * under the noise.
+ */
+static int filter_resample(filter_ctx_t *ctx, filter_audio_t *audio, unsigned char *buffer, size_t size)
+{
+	int j;
+	int i = 0;
+	int bufferlen = 0;
+	size_t framesize = ctx->samplesize * ctx->nchannels;
+
+	while (i < audio->nsamples)
+	{
+		if (ctx->frac >= STEPONE)
+		{
+			for (j = 0; j < ctx->nchannels; j++)
+				ctx->previous[j] = _filter_sample(audio, j, i);
+			ctx->frac -= STEPONE;
+			i++;
+			continue;
+		}
+		if (bufferlen + framesize > size)
+			break;
+		for (j = 0; j < ctx->nchannels; j++)
+		{
+			sample_t sample = _filter_sample(audio, j, i);
+			sample = ctx->previous[j] +
+				(sample_t)(((int64_t)(sample - ctx->previous[j]) * ctx->frac) >> STEPBITS);
+			bufferlen += ctx->sampled(ctx, sample, audio->bitspersample,
+						buffer + bufferlen);
+		}
+		ctx->frac += ctx->step;
+	}
+	audio->nsamples -= i;
+	for (j = 0; j < audio->nchannels; j++)
+		audio->samples[j] += i;
+	return bufferlen;
+}
+
+/**
+ * @brief interleave the channels with a band-limited interpolation.
+ * Between two samplerates (44.1 kHz and 48 kHz) the linear
+ * interpolation aliases, a windowed sinc filters the spectrum over
+ * the Nyquist frequence of the output.
+ * The output is delayed by SINC_TAPS/2 input samples.
+ */
+static int filter_resamplesinc(filter_ctx_t *ctx, filter_audio_t *audio, unsigned char *buffer, size_t size)
+{
+	int j;
+	int i = 0;
+	int bufferlen = 0;
+	size_t framesize = ctx->samplesize * ctx->nchannels;
+
+	while (i < audio->nsamples)
+	{
+		if (ctx->frac >= STEPONE)
+		{
+			for (j = 0; j < ctx->nchannels; j++)
+			{
+				memmove(ctx->history[j], ctx->history[j] + 1, (SINC_TAPS - 1) * sizeof(sample_t));
+				ctx->history[j][SINC_TAPS - 1] = _filter_sample(audio, j, i);
+			}
+			ctx->frac -= STEPONE;
+			i++;
+			continue;
+		}
+		if (bufferlen + framesize > size)
+			break;
+		/// the coefficients are interpolated between two phases
+		uint32_t phase = ctx->frac >> (STEPBITS - SINC_PHASEBITS);
+		int64_t weight = ctx->frac & ((1 << (STEPBITS - SINC_PHASEBITS)) - 1);
+		const int32_t *coefs = ctx->sinc[phase];
+		const int32_t *next = ctx->sinc[phase + 1];
+		for (j = 0; j < ctx->nchannels; j++)
+		{
+			int64_t sum = 0;
+			int64_t sumnext = 0;
+			int k;
+			for (k = 0; k < SINC_TAPS; k++)
+			{
+				sum += (int64_t)ctx->history[j][k] * coefs[k];
+				sumnext += (int64_t)ctx->history[j][k] * next[k];
+			}
+			sum >>= SINC_COEFBITS;
+			sumnext >>= SINC_COEFBITS;
+			sum += ((sumnext - sum) * weight) >> (STEPBITS - SINC_PHASEBITS);
+			sample_t sample = (sample_t)sum;
+			bufferlen += ctx->sampled(ctx, sample, audio->bitspersample,
+						buffer + bufferlen);
+		}
+		ctx->frac += ctx->step;
+	}
+	audio->nsamples -= i;
+	for (j = 0; j < audio->nchannels; j++)
+		audio->samples[j] += i;
+	return bufferlen;
+}
+
+static int filter_ratio(filter_ctx_t *ctx, int ppm)
+{
+	ctx->ppm = ppm;
+	_filter_step(ctx);
+	return 0;
+}
+#endif
+
 static int filter_interleave(filter_ctx_t *ctx, filter_audio_t *audio, unsigned char *buffer, size_t size)
 {
 	int j;
 	int i;
 	int bufferlen = 0;
 
+#ifdef FILTER_RESAMPLING
+	if (audio->samplerate != ctx->inrate)
+	{
+		ctx->inrate = audio->samplerate;
+		_filter_step(ctx);
+	}
+	if (ctx->inrate > 0 && ctx->samplerate > 0 && ctx->inrate != ctx->samplerate)
+	{
+		/// the cut-off is under the lowest Nyquist frequence, with the transition band
+		unsigned int cutoff = 900;
+		if (ctx->samplerate < ctx->inrate)
+			cutoff = 900 * ctx->samplerate / ctx->inrate;
+		_filter_sinc(ctx, cutoff);
+		return filter_resamplesinc(ctx, audio, buffer, size);
+	}
+	if (ctx->step != STEPONE)
+		return filter_resample(ctx, audio, buffer, size);
+#endif
+
 	for (i = 0; i < audio->nsamples; i++)
 	{
 		sample_t sample;
@@ -320,6 +576,9 @@ const filter_ops_t *filter_pcm_interleave = &(filter_ops_t)
 	.init = filter_init,
 	.set = filter_set,
 	.run = filter_interleave,
+#ifdef FILTER_RESAMPLING
+	.ratio = filter_ratio,
+#endif
 	.destroy = filter_destroy,
 };
 
@@ -1,6 +1,8 @@
 #ifndef __HEARTBEAT_H__
 #define __HEARTBEAT_H__
 
+#include <stdint.h>
+
 #define MAXCHANNELS 8
 typedef struct beat_samples_s beat_samples_t;
 struct beat_samples_s
@@ -29,6 +31,13 @@ struct heartbeat_bitrate_s
 	unsigned int ms;
 };
 
+typedef struct beat_clock_s beat_clock_t;
+struct beat_clock_s
+{
+	/// monotonic time in ns to release the buffer, 0 to release it now
+	uint64_t release;
+};
+
 #ifndef HEARTBEAT_CTX
 typedef void heartbeat_ctx_t;
 #endif
@@ -53,5 +62,6 @@ struct heartbeat_s
 #ifdef HEARTBEAT
 extern const heartbeat_ops_t *heartbeat_samples;
 extern const heartbeat_ops_t *heartbeat_bitrate;
+extern const heartbeat_ops_t *heartbeat_clock;
 #endif
 #endif
@@ -0,0 +1,114 @@
+/*****************************************************************************
+ * heartbeat_clock.c
+ * this file is part of https://github.com/ouistiti-project/putv
+ *****************************************************************************
+ * Copyright (C) 2016-2017
+ *
+ * Authors: Marc Chalain <marc.chalain@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject
+ * to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <errno.h>
+
+#include "jitter.h"
+typedef struct heartbeat_ctx_s heartbeat_ctx_t;
+struct heartbeat_ctx_s
+{
+	clockid_t clockid;
+	pthread_mutex_t mutex;
+};
+#define HEARTBEAT_CTX
+#include "heartbeat.h"
+
+#define err(format, ...) fprintf(stderr, "\x1B[31m"format"\x1B[0m\n",  ##__VA_ARGS__)
+#define warn(format, ...) fprintf(stderr, "\x1B[35m"format"\x1B[0m\n",  ##__VA_ARGS__)
+#ifdef DEBUG
+#define dbg(format, ...) fprintf(stderr, "\x1B[32m"format"\x1B[0m\n",  ##__VA_ARGS__)
+#else
+#define dbg(...)
+#endif
+
+#define heartbeat_dbg(...)
+
+/**
+ * The producer dates each buffer with the monotonic time of its
+ * release (beat_clock_t). The consumer of the jitter waits this time
+ * before to receive the buffer, the producer continues without waiting.
+ */
+static heartbeat_ctx_t *heartbeat_init(void *arg)
+{
+	heartbeat_ctx_t *ctx = calloc(1, sizeof(*ctx));
+	ctx->clockid = CLOCK_MONOTONIC;
+	pthread_mutex_init(&ctx->mutex, NULL);
+	return ctx;
+}
+
+static void heartbeat_destroy(heartbeat_ctx_t *ctx)
+{
+	pthread_mutex_destroy(&ctx->mutex);
+	free(ctx);
+}
+
+static void heartbeat_start(heartbeat_ctx_t *ctx)
+{
+}
+
+static int heartbeat_wait(heartbeat_ctx_t *ctx, void *arg)
+{
+	beat_clock_t *beat = (beat_clock_t *)arg;
+	if (beat->release == 0)
+		return 0;
+
+	struct timespec release = {
+		.tv_sec = beat->release / 1000000000ULL,
+		.tv_nsec = beat->release % 1000000000ULL,
+	};
+	int ret;
+	while ((ret = clock_nanosleep(ctx->clockid, TIMER_ABSTIME, &release, NULL)) == EINTR);
+	if (ret != 0)
+		heartbeat_dbg("heartbeat: clock error %s", strerror(ret));
+	beat->release = 0;
+	return 0;
+}
+
+static int heartbeat_lock(heartbeat_ctx_t *ctx)
+{
+	return pthread_mutex_lock(&ctx->mutex);
+}
+
+static int heartbeat_unlock(heartbeat_ctx_t *ctx)
+{
+	return pthread_mutex_unlock(&ctx->mutex);
+}
+
+const heartbeat_ops_t *heartbeat_clock = &(heartbeat_ops_t)
+{
+	.init = heartbeat_init,
+	.start = heartbeat_start,
+	.wait = heartbeat_wait,
+	.lock = heartbeat_lock,
+	.unlock = heartbeat_unlock,
+	.destroy = heartbeat_destroy,
+};
@@ -68,9 +68,11 @@ static heartbeat_ctx_t *heartbeat_init(void *arg)
 	case PCM_16bits_LE_mono:
 		ctx->nchannels = 1;
 	case PCM_16bits_LE_stereo:
+	case PCM_16bits_BE_stereo:
 		ctx->samplesize = 2;
 	break;
 	case PCM_24bits3_LE_stereo:
+	case PCM_24bits3_BE_stereo:
 		ctx->samplesize = 2;
 	break;
 	case PCM_24bits4_LE_stereo:
@@ -43,6 +43,16 @@ struct jitter_ops_s
 	size_t (*length)(jitter_ctx_t*);
 	int (*empty)(jitter_ctx_t *);
 	void (*pause)(jitter_ctx_t *jitter, int enable);
+	/**
+	 * optional: file descriptor readable when a buffer may be ready
+	 * for the consumer. The consumer reads it before to check "empty".
+	 */
+	int (*fd)(jitter_ctx_t *);
+	/**
+	 * optional: number of bytes ready for the consumer,
+	 * from 0 to count * size.
+	 */
+	size_t (*level)(jitter_ctx_t *);
 };
 
 typedef enum jitter_format_e
@@ -60,6 +70,9 @@ typedef enum jitter_format_e
 	MPEG2_2,
 	DVB_frame,
 	SINK_BITSSTREAM,
+	/// L16 and L24 of RTP in network byte order
+	PCM_16bits_BE_stereo,
+	PCM_24bits3_BE_stereo,
 } jitter_format_t;
 
 typedef struct jitter_s jitter_t;
@@ -70,6 +83,12 @@ struct jitter_s
 	const jitter_ops_t *ops;
 };
 
+/**
+ * the smallest number of buffers to receive the largest write of
+ * the producer while the consumer holds one buffer
+ */
+#define JITTER_MINCOUNT(burst, size) (((burst) + (size) - 1) / (size) + 1)
+
 jitter_t *jitter_scattergather_init(const char *name, unsigned count, size_t size);
 void jitter_scattergather_destroy(jitter_t *);
 jitter_t *jitter_ringbuffer_init(const char *name, unsigned count, size_t size);
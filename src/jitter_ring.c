@@ -410,6 +410,12 @@ static void jitter_reset(jitter_ctx_t *jitter)
 	pthread_mutex_unlock(&private->mutex);
 }
 
+static size_t jitter_level(jitter_ctx_t *jitter)
+{
+	jitter_private_t *private = (jitter_private_t *)jitter->private;
+	return private->level;
+}
+
 static int jitter_empty(jitter_ctx_t *jitter)
 {
 	jitter_private_t *private = (jitter_private_t *)jitter->private;
@@ -441,4 +447,5 @@ static const jitter_ops_t *jitter_ringbuffer = &(jitter_ops_t)
 	.length = jitter_length,
 	.empty = jitter_empty,
 	.pause = jitter_pause,
+	.level = jitter_level,
 };
@@ -30,7 +30,9 @@
 
 #define __USE_GNU
 #include <pthread.h>
+#include <unistd.h>
 #include <sys/mman.h>
+#include <sys/eventfd.h>
 
 #include "jitter.h"
 #include "heartbeat.h"
@@ -82,6 +84,8 @@ struct jitter_private_s
 		JITTER_COMPLETE,
 	} state;
 	int pause;
+	/// eventfd for the consumers running on poll
+	int eventfd;
 };
 
 static unsigned char *jitter_pull(jitter_ctx_t *jitter);
@@ -110,6 +114,7 @@ jitter_t *jitter_scattergather_init(const char *name, unsigned int count, size_t
 	pthread_mutex_init(&private->mutex, NULL);
 	pthread_cond_init(&private->condpush, NULL);
 	pthread_cond_init(&private->condpeer, NULL);
+	private->eventfd = -1;
 
 	// create the scatter gather
 	private->sg = calloc(count, sizeof(*private->sg));
@@ -151,6 +156,8 @@ void jitter_scattergather_destroy(jitter_t *jitter)
 	pthread_cond_destroy(&private->condpush);
 	pthread_cond_destroy(&private->condpeer);
 	pthread_mutex_destroy(&private->mutex);
+	if (private->eventfd >= 0)
+		close(private->eventfd);
 
 	free(private->buffer);
 	free(private->sg);
@@ -159,6 +166,17 @@ void jitter_scattergather_destroy(jitter_t *jitter)
 	free(jitter);
 }
 
+static void _jitter_wakeup(jitter_private_t *private)
+{
+	pthread_cond_broadcast(&private->condpeer);
+	if (private->eventfd >= 0)
+	{
+		uint64_t value = 1;
+		if (write(private->eventfd, &value, sizeof(value)) < 0)
+			jitter_dbg("jitter eventfd error");
+	}
+}
+
 static void _jitter_init(jitter_ctx_t *jitter)
 {
 	jitter_private_t *private = (jitter_private_t *)jitter->private;
@@ -309,7 +327,7 @@ static void jitter_push(jitter_ctx_t *jitter, size_t len, void *beat)
 		 * The buffer is running and the input
 		 * has to send an event to the consumer
 		 * that a new buffer is ready */
-		pthread_cond_broadcast(&private->condpeer);
+		_jitter_wakeup(private);
 #ifdef HEARTBEAT
 		if (jitter->heartbeat != NULL)
 		{
@@ -326,6 +344,7 @@ static void jitter_push(jitter_ctx_t *jitter, size_t len, void *beat)
 		 * The sg may run and send event to the next buffer.
 		 */
 		private->state = JITTER_RUNNING;
+		_jitter_wakeup(private);
 	}
 }
 
@@ -424,6 +443,12 @@ static unsigned char *jitter_peer(jitter_ctx_t *jitter, void **beat)
 		private->out->beat = NULL;
 	}
 #endif
+	/// without heartbeat, the beat is a data of the producer for the consumer
+	if (beat != NULL && private->out->beat != NULL)
+	{
+		*beat = private->out->beat;
+		private->out->beat = NULL;
+	}
 	return private->out->data;
 }
 
@@ -481,7 +506,7 @@ static void jitter_flush(jitter_ctx_t *jitter)
 	pthread_mutex_unlock(&private->mutex);
 
 	pthread_cond_broadcast(&private->condpush);
-	pthread_cond_broadcast(&private->condpeer);
+	_jitter_wakeup(private);
 }
 
 static size_t jitter_length(jitter_ctx_t *jitter)
@@ -523,6 +548,12 @@ static void jitter_reset(jitter_ctx_t *jitter)
 	pthread_mutex_unlock(&private->mutex);
 }
 
+static size_t jitter_level(jitter_ctx_t *jitter)
+{
+	jitter_private_t *private = (jitter_private_t *)jitter->private;
+	return private->level * jitter->size;
+}
+
 static int jitter_empty(jitter_ctx_t *jitter)
 {
 	jitter_private_t *private = (jitter_private_t *)jitter->private;
@@ -544,7 +575,17 @@ static void jitter_pause(jitter_ctx_t *jitter, int enable)
 			private->state = JITTER_FILLING;
 	}
 	pthread_mutex_unlock(&private->mutex);
-	pthread_cond_broadcast(&private->condpeer);
+	_jitter_wakeup(private);
+}
+
+static int jitter_fd(jitter_ctx_t *jitter)
+{
+	jitter_private_t *private = (jitter_private_t *)jitter->private;
+	pthread_mutex_lock(&private->mutex);
+	if (private->eventfd < 0)
+		private->eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	pthread_mutex_unlock(&private->mutex);
+	return private->eventfd;
 }
 
 static const jitter_ops_t *jitter_scattergather = &(jitter_ops_t)
@@ -560,4 +601,6 @@ static const jitter_ops_t *jitter_scattergather = &(jitter_ops_t)
 	.length = jitter_length,
 	.empty = jitter_empty,
 	.pause = jitter_pause,
+	.fd = jitter_fd,
+	.level = jitter_level,
 };
@@ -95,35 +95,118 @@ static void _autostart(union sigval arg)
 }
 #endif
 
-static int run_player(player_ctx_t *player, sink_t *sink)
+#define MAX_OUTPUTS 4
+
+#ifdef DECODER_TRANSMUX
+/// the bitrate of encoder_lame without setting
+#if DEFAULT_SAMPLERATE == 48000
+#define TRANSMUX_BITRATE 112
+#else
+#define TRANSMUX_BITRATE 128
+#endif
+#endif
+
+/**
+ * @brief read the bitrate of the encoder from the query of the output
+ * ie: rtp://239.0.0.1:4400?bitrate=96
+ */
+static unsigned int _output_bitrate(const char *outarg)
+{
+	const char *search = strchr(outarg, '?');
+	if (search == NULL)
+		return 0;
+	const char *bitrate = strstr(search, "bitrate=");
+	if (bitrate == NULL)
+		return 0;
+	return strtoul(bitrate + 8, NULL, 10);
+}
+
+/**
+ * @brief read the codec of the encoder from the query of the output
+ * ie: rtp://239.0.0.1:4400?codec=flac
+ */
+static const encoder_t *_output_encoder(const char *outarg, const char *codec)
+{
+	char name[16] = {0};
+	const char *search = strchr(outarg, '?');
+	if (search != NULL)
+		search = strstr(search, "codec=");
+	if (search != NULL)
+	{
+		search += 6;
+		int len = strcspn(search, "&");
+		if (len >= sizeof(name))
+			len = sizeof(name) - 1;
+		strncpy(name, search, len);
+		codec = name;
+	}
+	const encoder_t *encoder = encoder_check(codec);
+	if (encoder == NULL)
+		encoder = encoder_check(NULL);
+	return encoder;
+}
+
+static int run_player(player_ctx_t *player, sink_t *sinks[], const char *outargs[], int nsinks, const char *codec)
 {
-	int ret;
-	const encoder_t *encoder;
-	encoder_ctx_t *encoder_ctx;
-	jitter_t *encoder_jitter = NULL;
-	jitter_t *sink_jitter;
-
-	encoder = ENCODER;
-	encoder_ctx = encoder->init(player);
-	int index = sink->ops->attach(sink->ctx, encoder->mime(encoder_ctx));
-	sink_jitter = sink->ops->jitter(sink->ctx, index);
-	encoder->run(encoder_ctx, sink_jitter);
-	encoder_jitter = encoder->jitter(encoder_ctx);
-
-	if (encoder_jitter != NULL)
-		ret = player_subscribe(player, ES_AUDIO, encoder_jitter);
+	int ret = 0;
+	const encoder_t *encoder[MAX_OUTPUTS];
+	encoder_ctx_t *encoder_ctx[MAX_OUTPUTS];
+	int i;
+
+	/**
+	 * each output has its own encoder, and the player
+	 * feeds all of them from the same decoding
+	 */
+	for (i = 0; i < nsinks; i++)
+	{
+		jitter_t *encoder_jitter = NULL;
+		jitter_t *sink_jitter;
+		sink_t *sink = sinks[i];
+
+		encoder[i] = _output_encoder(outargs[i], codec);
+		dbg("output %s with encoder %s", outargs[i], encoder[i]->name);
+		encoder_ctx[i] = encoder[i]->init(player);
+		unsigned int bitrate = _output_bitrate(outargs[i]);
+		if (bitrate > 0 && encoder[i]->bitrate != NULL)
+			encoder[i]->bitrate(encoder_ctx[i], bitrate);
+		int index = sink->ops->attach(sink->ctx, encoder[i]->mime(encoder_ctx[i]));
+		sink_jitter = sink->ops->jitter(sink->ctx, index);
+		encoder[i]->run(encoder_ctx[i], sink_jitter);
+		encoder_jitter = encoder[i]->jitter(encoder_ctx[i]);
+
+		if (ret == 0 && encoder_jitter != NULL)
+			ret = player_subscribe(player, ES_AUDIO, encoder_jitter);
+#ifdef DECODER_TRANSMUX
+		/**
+		 * the sink receives MPEG audio frames, the player may send
+		 * the frames of the mp3 files directly as encoder_passthrough does.
+		 */
+		if (ret == 0 && nsinks == 1 && encoder[i]->mime(encoder_ctx[i]) == mime_audiomp3 &&
+			sink_jitter != encoder_jitter)
+			ret = player_transmux(player, sink_jitter, (bitrate > 0)? bitrate : TRANSMUX_BITRATE);
+#endif
+	}
 	if (ret == 0)
 		ret = player_run(player);
-	encoder->destroy(encoder_ctx);
+	for (i = 0; i < nsinks; i++)
+		encoder[i]->destroy(encoder_ctx[i]);
 	return ret;
 }
 
 void help(const char *name)
 {
-	fprintf(stderr, "%s [-R <websocketdir>][-m <media>][-o <output>][-p <pidfile>]\n", name);
-	fprintf(stderr, "\t...[-f <filtername>][-x][-D][-a][-r][-l][-L <logfile>]\n");
+	fprintf(stderr, "%s [-R <websocketdir>][-m <media>][-o <output>[?bitrate=<kbps>][&codec=<codec>]]...[-p <pidfile>]\n", name);
+	fprintf(stderr, "\t...[-c <codec>][-f <filtername>][-x][-D][-a][-r][-l][-L <logfile>]\n");
 	fprintf(stderr, "\t...[-d <directory>]\n");
 	fprintf(stderr, "\t...[-P [0-99]]\n");
+	const char *codec = encoder_namelist(1);
+	fprintf(stderr, "\tcodecs:");
+	while (codec != NULL)
+	{
+		fprintf(stderr, " %s", codec);
+		codec = encoder_namelist(0);
+	}
+	fprintf(stderr, "\n");
 }
 
 #define DAEMONIZE 0x01
@@ -136,7 +219,8 @@ int main(int argc, char **argv)
 {
 	int priority = 0;
 	const char *mediapath = "file://"DATADIR;
-	const char *outarg = "default";
+	const char *outargs[MAX_OUTPUTS] = {"default"};
+	int noutputs = 0;
 	pthread_t thread;
 	const char *root = "/tmp";
 	int mode = 0;
@@ -144,13 +228,14 @@ int main(int argc, char **argv)
 	const char *user = NULL;
 	const char *pidfile = NULL;
 	const char *filtername = "pcm_stereo";
+	const char *codec = NULL;
 	const char *logfile = NULL;
 	const char *cwd = NULL;
 
 	int opt;
 	do
 	{
-		opt = getopt(argc, argv, "R:m:o:u:p:f:hDKVxalrL:d:P:");
+		opt = getopt(argc, argv, "R:m:o:c:u:p:f:hDKVxalrL:d:P:");
 		switch (opt)
 		{
 			case 'R':
@@ -160,7 +245,13 @@ int main(int argc, char **argv)
 				mediapath = optarg;
 			break;
 			case 'o':
-				outarg = optarg;
+				if (noutputs < MAX_OUTPUTS)
+					outargs[noutputs++] = optarg;
+				else
+					err("too many outputs, %s is ignored", optarg);
+			break;
+			case 'c':
+				codec = optarg;
 			break;
 			case 'u':
 				user = optarg;
@@ -286,6 +377,9 @@ int main(int argc, char **argv)
 		}
 	}
 
+	int i;
+	sink_t *sinks[MAX_OUTPUTS] = {0};
+	int nsinks = 0;
 	sink_t *sink = NULL;
 
 	/**
@@ -302,7 +396,20 @@ int main(int argc, char **argv)
 	nbcmds++;
 #endif
 
-	sink = sink_build(player, outarg);
+	if (noutputs == 0)
+		noutputs = 1;
+	for (i = 0; i < noutputs; i++)
+	{
+		sinks[nsinks] = sink_build(player, outargs[i]);
+		if (sinks[nsinks] != NULL)
+			outargs[nsinks++] = outargs[i];
+		else
+			err("output %s not available", outargs[i]);
+	}
+	/**
+	 * the commands control the first output
+	 */
+	sink = sinks[0];
 
 	if (!(mode & DAEMONIZE))
 	{
@@ -363,7 +470,6 @@ int main(int argc, char **argv)
 	if (seteuid(pw_uid))
 		err("Error: start server as root");
 
-	int i;
 	for (i = 0; i < nbcmds; i++)
 	{
 		if(cmds[i].ctx != NULL)
@@ -382,7 +488,8 @@ int main(int argc, char **argv)
 		/**
 		 * the sink must to run before to start the encoder
 		 */
-		sink->ops->run(sink->ctx);
+		for (i = 0; i < nsinks; i++)
+			sinks[i]->ops->run(sinks[i]->ctx);
 
 		if (mode & AUTOSTART)
 		{
@@ -404,9 +511,13 @@ int main(int argc, char **argv)
 #endif
 		}
 
-		run_player(player, sink);
+		run_player(player, sinks, outargs, nsinks, codec);
 
-		sink->ops->destroy(sink->ctx);
+		for (i = 0; i < nsinks; i++)
+		{
+			sinks[i]->ops->destroy(sinks[i]->ctx);
+			free(sinks[i]);
+		}
 		player_destroy(player);
 	}
 
@@ -3,6 +3,8 @@
 
 #define RANDOM_DEVICE "/dev/hwrng"
 
+#include <stdint.h>
+
 typedef struct player_ctx_s player_ctx_t;
 #include "jitter.h"
 
@@ -22,6 +24,8 @@ extern const char const *str_genre;
 extern const char const *str_date;
 extern const char const *str_comment;
 extern const char const *str_cover;
+extern const char const *str_regain;
+extern const char const *str_duration;
 
 void utils_srandom();
 const char *utils_getmime(const char *path);
@@ -34,6 +38,16 @@ char *utils_parseurl(const char *url,
 								char **search);
 const char *utils_mime2mime(const char *mime);
 const char *utils_format2mime(jitter_format_t format);
+/**
+ * @return the size of one sample of all the channels, 0 for the compressed formats
+ */
+unsigned int utils_format2framesize(jitter_format_t format);
+int utils_mp3frame(const unsigned char *buffer, size_t length, unsigned int *samplerate, unsigned int *nsamples);
+int utils_mp3vbrheader(const unsigned char *buffer, size_t length, uint64_t *nsamples, unsigned int *samplerate);
+int utils_flacframe(const unsigned char *buffer, size_t length, unsigned int *samplerate, unsigned int *nsamples);
+/// the default number of samples of the ALAC frames (the frameLength of the magic cookie)
+#define ALAC_FRAMELENGTH 4096
+int utils_alacframe(const unsigned char *buffer, size_t length, unsigned int *nsamples);
 
 typedef struct media_ctx_s media_ctx_t;
 
@@ -142,6 +156,14 @@ int media_parseid3tag(const char *path, json_t *object);
 int media_parseoggmetadata(const char *path, json_t *object);
 #endif
 char *media_fillinfo(const char *url, const char *mime);
+uint32_t media_mp3duration(const char *url);
+uint32_t media_mp3estimate(const char *url);
+/**
+ * @brief read the format of the first frames of the mp3 file
+ *
+ * @arg bitrate set to 0 if the bitrate or the mode of the frames change
+ */
+int media_mp3format(const char *url, unsigned int *samplerate, unsigned int *bitrate, unsigned int *nchannels);
 
 extern const media_ops_t *media_sqlite;
 extern const media_ops_t *media_file;
@@ -260,6 +260,8 @@ const char *utils_format2mime(jitter_format_t format)
 	case PCM_24bits4_LE_stereo:
 	case PCM_32bits_LE_stereo:
 	case PCM_32bits_BE_stereo:
+	case PCM_16bits_BE_stereo:
+	case PCM_24bits3_BE_stereo:
 		return mime_audiopcm;
 	case MPEG2_3_MP3:
 		return mime_audiomp3;
@@ -276,6 +278,489 @@ const char *utils_format2mime(jitter_format_t format)
 	return mime_octetstream;
 }
 
+unsigned int utils_format2framesize(jitter_format_t format)
+{
+	switch (format)
+	{
+	case PCM_8bits_mono:
+		return 1;
+	case PCM_16bits_LE_mono:
+		return 2;
+	case PCM_16bits_LE_stereo:
+	case PCM_16bits_BE_stereo:
+		return 4;
+	case PCM_24bits3_LE_stereo:
+	case PCM_24bits3_BE_stereo:
+		return 6;
+	case PCM_24bits4_LE_stereo:
+	case PCM_32bits_LE_stereo:
+	case PCM_32bits_BE_stereo:
+		return 8;
+	default:
+		break;
+	}
+	return 0;
+}
+
+/**
+ * MPEG audio frame header
+ */
+static const unsigned short mp3_bitrates[2][3][16] =
+{
+	{ /// MPEG1
+		{0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448, 0},
+		{0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384, 0},
+		{0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 0},
+	},
+	{ /// MPEG2 and MPEG2.5
+		{0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256, 0},
+		{0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0},
+		{0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0},
+	},
+};
+
+static const unsigned int mp3_samplerates[4][3] =
+{
+	{11025, 12000, 8000}, /// MPEG2.5
+	{0, 0, 0},
+	{22050, 24000, 16000}, /// MPEG2
+	{44100, 48000, 32000}, /// MPEG1
+};
+
+typedef struct mp3header_s mp3header_t;
+struct mp3header_s
+{
+	unsigned int samplerate;
+	unsigned int bitrate;
+	unsigned int nsamples;
+	unsigned int length;
+	unsigned char mpeg1;
+	unsigned char mono;
+};
+
+static int _mp3_header(const unsigned char *buffer, mp3header_t *header)
+{
+	if (buffer[0] != 0xFF || (buffer[1] & 0xE0) != 0xE0)
+		return -1;
+	int version = (buffer[1] >> 3) & 0x03;
+	int layer = 4 - ((buffer[1] >> 1) & 0x03);
+	int bitrateid = buffer[2] >> 4;
+	int samplerateid = (buffer[2] >> 2) & 0x03;
+	int padding = (buffer[2] >> 1) & 0x01;
+	if (version == 1 || layer == 4 || bitrateid == 0 || bitrateid == 15 || samplerateid == 3)
+		return -1;
+
+	header->mpeg1 = (version == 3);
+	header->mono = ((buffer[3] >> 6) == 3);
+	header->samplerate = mp3_samplerates[version][samplerateid];
+	unsigned int bitrate = mp3_bitrates[!header->mpeg1][layer - 1][bitrateid] * 1000;
+	header->bitrate = bitrate;
+	if (layer == 1)
+	{
+		header->nsamples = 384;
+		header->length = (12 * bitrate / header->samplerate + padding) * 4;
+	}
+	else
+	{
+		header->nsamples = (layer == 3 && !header->mpeg1)? 576 : 1152;
+		header->length = (header->nsamples / 8) * bitrate / header->samplerate + padding;
+	}
+	return 0;
+}
+
+/**
+ * @brief parse the header of a MPEG audio frame
+ *
+ * @arg buffer the beginning of the frame
+ * @arg length the length available into the buffer
+ * @arg samplerate the samplerate of the frame
+ * @arg nsamples the number of samples per channel into the frame
+ *
+ * @return the length of the frame or -1
+ */
+int utils_mp3frame(const unsigned char *buffer, size_t length, unsigned int *samplerate, unsigned int *nsamples)
+{
+	mp3header_t header;
+	if (length < 4 || _mp3_header(buffer, &header) != 0)
+		return -1;
+	if (samplerate)
+		*samplerate = header.samplerate;
+	if (nsamples)
+		*nsamples = header.nsamples;
+	return header.length;
+}
+
+static uint32_t _mp3_uint32(const unsigned char *buffer)
+{
+	return (buffer[0] << 24) | (buffer[1] << 16) | (buffer[2] << 8) | buffer[3];
+}
+
+/**
+ * @brief parse the Xing/Info (with the LAME extension) or the VBRI
+ * header inside the first frame of the stream
+ *
+ * @arg buffer the beginning of the frame
+ * @arg length the length available into the buffer
+ * @arg nsamples the number of samples of the stream
+ * @arg samplerate the samplerate of the stream
+ *
+ * @return 0 if the frame contains a header
+ */
+int utils_mp3vbrheader(const unsigned char *buffer, size_t length, uint64_t *nsamples, unsigned int *samplerate)
+{
+	mp3header_t header;
+	if (length < 4 || _mp3_header(buffer, &header) != 0)
+		return -1;
+	if (header.length < length)
+		length = header.length;
+
+	size_t offset = 4;
+	if (header.mpeg1)
+		offset += (header.mono)? 17 : 32;
+	else
+		offset += (header.mono)? 9 : 17;
+	if (offset + 16 <= length &&
+		(!memcmp(buffer + offset, "Xing", 4) || !memcmp(buffer + offset, "Info", 4)))
+	{
+		uint32_t flags = _mp3_uint32(buffer + offset + 4);
+		if (!(flags & 0x01))
+			return -1;
+		uint64_t total = (uint64_t)_mp3_uint32(buffer + offset + 8) * header.nsamples;
+		/**
+		 * the LAME extension contains the encoder delay and padding
+		 */
+		size_t lame = offset + 8 + 4;
+		if (flags & 0x02)
+			lame += 4;
+		if (flags & 0x04)
+			lame += 100;
+		if (flags & 0x08)
+			lame += 4;
+		if (lame + 24 <= length && !memcmp(buffer + lame, "LAME", 4))
+		{
+			unsigned int delay = (buffer[lame + 21] << 4) | (buffer[lame + 22] >> 4);
+			unsigned int pad = ((buffer[lame + 22] & 0x0F) << 8) | buffer[lame + 23];
+			if (total > delay + pad)
+				total -= delay + pad;
+		}
+		*nsamples = total;
+		*samplerate = header.samplerate;
+		return 0;
+	}
+	offset = 4 + 32;
+	if (offset + 18 <= length && !memcmp(buffer + offset, "VBRI", 4))
+	{
+		*nsamples = (uint64_t)_mp3_uint32(buffer + offset + 14) * header.nsamples;
+		*samplerate = header.samplerate;
+		return 0;
+	}
+	return -1;
+}
+
+/**
+ * @brief parse the header of a FLAC frame
+ *
+ * @arg buffer the beginning of the frame
+ * @arg length the length available into the buffer
+ * @arg samplerate the samplerate of the frame, 0 if it is the one of the stream
+ * @arg nsamples the number of samples per channel into the frame
+ *
+ * @return the length of the header or -1 (the metadata blocks)
+ */
+int utils_flacframe(const unsigned char *buffer, size_t length, unsigned int *samplerate, unsigned int *nsamples)
+{
+	static const unsigned int samplerates[] = {0, 88200, 176400, 192000,
+		8000, 16000, 22050, 24000, 32000, 44100, 48000, 96000};
+	if (length < 5 || buffer[0] != 0xFF || (buffer[1] & 0xFE) != 0xF8)
+		return -1;
+	unsigned int bscode = buffer[2] >> 4;
+	unsigned int srcode = buffer[2] & 0x0F;
+	if (bscode == 0 || srcode == 0x0F)
+		return -1;
+	/// the number of the frame is coded as UTF-8
+	size_t offset = 4;
+	unsigned char first = buffer[offset++];
+	if (first & 0x80)
+		while ((first <<= 1) & 0x80)
+			offset++;
+	unsigned int blocksize = 0;
+	if (bscode == 1)
+		blocksize = 192;
+	else if (bscode < 6)
+		blocksize = 576 << (bscode - 2);
+	else if (bscode == 6 && offset + 1 <= length)
+		blocksize = buffer[offset++] + 1;
+	else if (bscode == 7 && offset + 2 <= length)
+	{
+		blocksize = ((buffer[offset] << 8) | buffer[offset + 1]) + 1;
+		offset += 2;
+	}
+	else if (bscode > 7)
+		blocksize = 256 << (bscode - 8);
+	else
+		return -1;
+	unsigned int rate = 0;
+	if (srcode < 12)
+		rate = samplerates[srcode];
+	else if (srcode == 12 && offset + 1 <= length)
+		rate = buffer[offset++] * 1000;
+	else if (srcode > 12 && offset + 2 <= length)
+	{
+		rate = (buffer[offset] << 8) | buffer[offset + 1];
+		if (srcode == 14)
+			rate *= 10;
+		offset += 2;
+	}
+	else
+		return -1;
+	/// the CRC-8 of the header
+	offset++;
+	if (offset > length)
+		return -1;
+	if (samplerate)
+		*samplerate = rate;
+	if (nsamples)
+		*nsamples = blocksize;
+	return offset;
+}
+
+/**
+ * @brief parse the header of an ALAC frame
+ *
+ * @arg buffer the beginning of the frame
+ * @arg length the length available into the buffer
+ * @arg nsamples the number of samples per channel into the frame,
+ *      ALAC_FRAMELENGTH if the frame doesn't contain it.
+ *
+ * @return the length of the header or -1
+ */
+int utils_alacframe(const unsigned char *buffer, size_t length, unsigned int *nsamples)
+{
+	if (length < 3)
+		return -1;
+	/// the flags follow the tag, the channels and 12 unused bits
+	int hassize = (buffer[2] >> 4) & 0x01;
+	if (!hassize)
+	{
+		if (nsamples)
+			*nsamples = ALAC_FRAMELENGTH;
+		return 3;
+	}
+	if (length < 7)
+		return -1;
+	/// the size is not aligned on the bytes
+	uint64_t bits = ((uint64_t)buffer[2] << 32) | ((uint64_t)buffer[3] << 24) |
+		(buffer[4] << 16) | (buffer[5] << 8) | buffer[6];
+	if (nsamples)
+		*nsamples = (bits >> 1) & 0xFFFFFFFF;
+	return 7;
+}
+
+#define MP3_SCANBUFFER 65536
+/**
+ * open the file and read the first part of the stream after the ID3v2 tag
+ */
+static int _mp3_open(const char *url, unsigned char *buffer, size_t *length, off_t *offset)
+{
+	const char *path = url;
+	if (!strncmp(path, "file://", 7))
+		path += 7;
+	else if (strstr(path, "://") != NULL)
+		return -1;
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	*length = read(fd, buffer, MP3_SCANBUFFER);
+	if (*length == (size_t)-1)
+		*length = 0;
+	*offset = 0;
+
+	/**
+	 * skip the ID3v2 tag
+	 */
+	if (*length >= 10 && !memcmp(buffer, "ID3", 3))
+	{
+		*offset = ((buffer[6] & 0x7F) << 21) | ((buffer[7] & 0x7F) << 14) |
+				((buffer[8] & 0x7F) << 7) | (buffer[9] & 0x7F);
+		*offset += 10;
+		if (buffer[5] & 0x10)
+			*offset += 10;
+		if (*offset >= *length)
+		{
+			lseek(fd, *offset, SEEK_SET);
+			*length = read(fd, buffer, MP3_SCANBUFFER);
+			if (*length == (size_t)-1)
+				*length = 0;
+			*offset = 0;
+		}
+	}
+	return fd;
+}
+
+/**
+ * @brief compute the duration of a mp3 file without decoding.
+ * The Xing/VBRI header is used if it exists, otherwise
+ * only the headers of the frames are parsed.
+ *
+ * @return the duration in seconds
+ */
+uint32_t media_mp3duration(const char *url)
+{
+	unsigned char *buffer = malloc(MP3_SCANBUFFER);
+	size_t length = 0;
+	off_t offset = 0;
+	int fd = _mp3_open(url, buffer, &length, &offset);
+	if (fd < 0)
+	{
+		free(buffer);
+		return 0;
+	}
+
+	uint64_t nsamples = 0;
+	unsigned int samplerate = 0;
+	if (utils_mp3vbrheader(buffer + offset, length - offset, &nsamples, &samplerate) != 0)
+	{
+		mp3header_t header;
+		nsamples = 0;
+		samplerate = 0;
+		while (length > 0)
+		{
+			while (offset + 4 <= length)
+			{
+				if (_mp3_header(buffer + offset, &header) == 0 &&
+					(samplerate == 0 || samplerate == header.samplerate))
+				{
+					samplerate = header.samplerate;
+					nsamples += header.nsamples;
+					offset += header.length;
+				}
+				else
+					offset++;
+			}
+			/**
+			 * keep the end of the buffer and read the next part
+			 */
+			size_t rest = 0;
+			if (offset < length)
+			{
+				rest = length - offset;
+				memmove(buffer, buffer + offset, rest);
+				offset = 0;
+			}
+			else
+				offset -= length;
+			ssize_t ret = read(fd, buffer + rest, MP3_SCANBUFFER - rest);
+			if (ret <= 0)
+				break;
+			length = rest + ret;
+		}
+	}
+	free(buffer);
+	close(fd);
+	if (samplerate == 0)
+		return 0;
+	media_dbg("media: mp3 %s %lu samples", url, nsamples);
+	return nsamples / samplerate;
+}
+
+/**
+ * @brief estimate the duration of a mp3 file from its first frame.
+ * The Xing/VBRI header is used if it exists, otherwise the bitrate
+ * of the first frame and the size of the file give the duration of a
+ * CBR stream. Only the beginning of the file is read.
+ *
+ * @return the duration in seconds
+ */
+uint32_t media_mp3estimate(const char *url)
+{
+	unsigned char *buffer = malloc(MP3_SCANBUFFER);
+	size_t length = 0;
+	off_t offset = 0;
+	int fd = _mp3_open(url, buffer, &length, &offset);
+	if (fd < 0)
+	{
+		free(buffer);
+		return 0;
+	}
+	/// the offset is from the current position of the file
+	off_t start = lseek(fd, 0, SEEK_CUR) - length;
+	struct stat filestat;
+	if (fstat(fd, &filestat) != 0)
+		filestat.st_size = 0;
+	close(fd);
+
+	uint32_t duration = 0;
+	uint64_t nsamples = 0;
+	unsigned int samplerate = 0;
+	mp3header_t header;
+	while (offset + 4 <= length && _mp3_header(buffer + offset, &header) != 0)
+		offset++;
+	if (offset + 4 <= length &&
+		utils_mp3vbrheader(buffer + offset, length - offset, &nsamples, &samplerate) == 0)
+	{
+		if (samplerate > 0)
+			duration = nsamples / samplerate;
+	}
+	else if (offset + 4 <= length && header.bitrate > 0 &&
+		filestat.st_size > start + offset)
+		duration = (uint64_t)(filestat.st_size - start - offset) * 8 / header.bitrate;
+	free(buffer);
+	media_dbg("media: mp3 %s estimated %u s", url, duration);
+	return duration;
+}
+
+/**
+ * @brief read the format of the first audio frame of a mp3 file.
+ * The frame with the Xing/VBRI header is skipped.
+ *
+ * @return 0 on success
+ */
+int media_mp3format(const char *url, unsigned int *samplerate, unsigned int *bitrate, unsigned int *nchannels)
+{
+	unsigned char *buffer = malloc(MP3_SCANBUFFER);
+	size_t length = 0;
+	off_t offset = 0;
+	int fd = _mp3_open(url, buffer, &length, &offset);
+	if (fd < 0)
+	{
+		free(buffer);
+		return -1;
+	}
+	close(fd);
+
+	int ret = -1;
+	uint64_t nsamples = 0;
+	unsigned int vbrrate = 0;
+	mp3header_t header;
+	while (offset + 4 <= length && _mp3_header(buffer + offset, &header) != 0)
+		offset++;
+	if (offset + 4 <= length &&
+		utils_mp3vbrheader(buffer + offset, length - offset, &nsamples, &vbrrate) == 0)
+		offset += header.length;
+	if (offset + 4 <= length && _mp3_header(buffer + offset, &header) == 0)
+	{
+		*samplerate = header.samplerate;
+		*bitrate = header.bitrate;
+		*nchannels = (header.mono)? 1 : 2;
+		ret = 0;
+		/// the bitrate of a VBR stream is 0
+		mp3header_t next;
+		offset += header.length;
+		while (offset + 4 <= length && _mp3_header(buffer + offset, &next) == 0)
+		{
+			if (next.bitrate != header.bitrate || next.mono != header.mono)
+			{
+				*bitrate = 0;
+				break;
+			}
+			offset += next.length;
+		}
+	}
+	free(buffer);
+	return ret;
+}
+
 static char *media_regfile(char *path, const char *mime, const unsigned char *data, unsigned long length)
 {
 	int fd = -1;
@@ -620,7 +1105,7 @@ char *media_fillinfo(const char *url, const char *mime)
 
 	if (strncmp(path, "file://", 7) == 0)
 		path += 7;
-	else
+	else if (strstr(path, "://") != NULL)
 		return NULL;
 	object = json_object();
 #ifdef USE_ID3TAG
@@ -635,6 +1120,16 @@ char *media_fillinfo(const char *url, const char *mime)
 		ret = media_parseoggmetadata(path, object);
 	}
 #endif
+	/**
+	 * the listings fill the info of each entry, the scan of the
+	 * whole file is done only at the insertion into a database.
+	 */
+	if (mime && !strcmp(mime, mime_audiomp3))
+	{
+		uint32_t duration = media_mp3estimate(path);
+		if (duration > 0)
+			json_object_set_new(object, str_duration, json_integer(duration));
+	}
 	char coverpath[PATH_MAX];
 	strcpy(coverpath, path);
 	char *dname = strrchr(coverpath, '/');
@@ -472,6 +472,54 @@ char *opus_getcover(media_ctx_t *ctx, int coverid)
 	return cover;
 }
 
+static uint32_t opus_getduration(media_ctx_t *ctx, int opusid)
+{
+	sqlite3 *db = ctx->db;
+	int ret;
+	uint32_t duration = 0;
+
+	char *sql = "select duration from media where opusid=@ID";
+	sqlite3_stmt *st_select;
+	ret = sqlite3_prepare_v2(db, sql, -1, &st_select, NULL);
+	SQLITE3_CHECK(ret, 0, sql);
+
+	int index;
+
+	index = sqlite3_bind_parameter_index(st_select, "@ID");
+	ret = sqlite3_bind_int(st_select, index, opusid);
+	SQLITE3_CHECK(ret, 0, sql);
+
+	ret = sqlite3_step(st_select);
+	if (ret == SQLITE_ROW && sqlite3_column_type(st_select, 0) == SQLITE_INTEGER)
+	{
+		duration = sqlite3_column_int(st_select, 0);
+	}
+	sqlite3_finalize(st_select);
+	return duration;
+}
+
+/**
+ * the duration is computed once at the insertion of the media.
+ * The duration of the info is an estimation for the mp3 files,
+ * the frames are scanned here.
+ */
+static uint32_t media_duration(const char *path, const char *info, const char *mime)
+{
+	uint32_t duration = 0;
+	if (mime != NULL && !strcmp(mime, mime_audiomp3))
+		duration = media_mp3duration(path);
+	if (duration == 0 && info != NULL)
+	{
+		json_error_t error;
+		json_t *jinfo = json_loads(info, 0, &error);
+		json_t *value = json_object_get(jinfo, str_duration);
+		if (json_is_integer(value))
+			duration = json_integer_value(value);
+		json_decref(jinfo);
+	}
+	return duration;
+}
+
 static json_t *opus_getjson(media_ctx_t *ctx, int opusid, int coverid)
 {
 	json_t *json_info = json_object();
@@ -637,6 +685,10 @@ static json_t *opus_getjson(media_ctx_t *ctx, int opusid, int coverid)
 	}
 	sqlite3_finalize(st_select);
 
+	uint32_t duration = opus_getduration(ctx, opusid);
+	if (duration > 0)
+		json_object_set_new(json_info, str_duration, json_integer(duration));
+
 	return json_info;
 }
 
@@ -844,8 +896,11 @@ static int media_insert(media_ctx_t *ctx, const char *path, const char *info, co
 		filename += 1;
 	else
 		filename = path;
+	if (mime == NULL)
+		mime = utils_getmime(path);
 	if (info == NULL)
 		info = 	media_fillinfo(path, mime);
+	uint32_t duration = media_duration(path, info, mime);
 
 	opusid = opus_insert(ctx, info, &albumid, filename);
 	if (opusid == -1)
@@ -855,6 +910,9 @@ static int media_insert(media_ctx_t *ctx, const char *path, const char *info, co
 #else
 	if (path == NULL)
 		return -1;
+	char *tinfo = NULL;
+	if (info == NULL)
+		info = tinfo = media_fillinfo(path, mime);
 #endif
 
 	char *tpath = NULL;
@@ -876,7 +934,7 @@ static int media_insert(media_ctx_t *ctx, const char *path, const char *info, co
 #ifndef MEDIA_SQLITE_EXT
 		char *sql = "insert into \"media\" (\"url\", \"mimeid\", \"info\") values(@PATH , @MIMEID , @INFO);";
 #else
-		char *sql = "insert into \"media\" (\"url\", \"mimeid\", \"opusid\", \"albumid\") values(@PATH , @MIMEID, @OPUSID, @ALBUMID );";
+		char *sql = "insert into \"media\" (\"url\", \"mimeid\", \"opusid\", \"albumid\", \"duration\") values(@PATH , @MIMEID, @OPUSID, @ALBUMID, @DURATION );";
 #endif
 
 		ret = sqlite3_prepare_v2(db, sql, -1, &statement, NULL);
@@ -906,6 +964,11 @@ static int media_insert(media_ctx_t *ctx, const char *path, const char *info, co
 			index = sqlite3_bind_parameter_index(statement, "@ALBUMID");
 			ret = sqlite3_bind_null(statement, index);
 		}
+		index = sqlite3_bind_parameter_index(statement, "@DURATION");
+		if (duration > 0)
+			ret = sqlite3_bind_int(statement, index, duration);
+		else
+			ret = sqlite3_bind_null(statement, index);
 #endif
 		SQLITE3_CHECK(ret, -1, sql);
 		index = sqlite3_bind_parameter_index(statement, "@MIMEID");
@@ -936,7 +999,7 @@ static int media_insert(media_ctx_t *ctx, const char *path, const char *info, co
 	{
 		int index;
 		sqlite3_stmt *statement;
-		char *sql = "update \"media\" set \"opusid\"=@OPUSID where id = @ID;";
+		char *sql = "update \"media\" set \"opusid\"=@OPUSID, \"duration\"=@DURATION where id = @ID;";
 
 		ret = sqlite3_prepare_v2(db, sql, -1, &statement, NULL);
 		SQLITE3_CHECK(ret, -1, sql);
@@ -945,6 +1008,13 @@ static int media_insert(media_ctx_t *ctx, const char *path, const char *info, co
 		ret = sqlite3_bind_int(statement, index, opusid);
 		SQLITE3_CHECK(ret, -1, sql);
 
+		index = sqlite3_bind_parameter_index(statement, "@DURATION");
+		if (duration > 0)
+			ret = sqlite3_bind_int(statement, index, duration);
+		else
+			ret = sqlite3_bind_null(statement, index);
+		SQLITE3_CHECK(ret, -1, sql);
+
 		index = sqlite3_bind_parameter_index(statement, "@ID");
 		ret = sqlite3_bind_int(statement, index, id);
 		SQLITE3_CHECK(ret, -1, sql);
@@ -953,6 +1023,9 @@ static int media_insert(media_ctx_t *ctx, const char *path, const char *info, co
 	}
 #endif
 	free(tpath);
+#ifndef MEDIA_SQLITE_EXT
+	free(tinfo);
+#endif
 	if (opusid != -1)
 	{
 		int index;
@@ -1651,7 +1724,7 @@ static media_ctx_t *media_init(player_ctx_t *player, const char *url, ...)
 "insert into mimes (id, name) values (3, \"audio/alac\");",
 "insert into mimes (id, name) values (4, \"audio/pcm\");",
 "create table media (id INTEGER PRIMARY KEY, url TEXT UNIQUE NOT NULL, mimeid INTEGER, info BLOB, " \
-	"opusid INTEGER, albumid INTEGER, comment BLOB, " \
+	"opusid INTEGER, albumid INTEGER, comment BLOB, duration INTEGER, " \
 	"FOREIGN KEY (mimeid) REFERENCES mimes(id) ON UPDATE SET NULL," \
 	"FOREIGN KEY (opusid) REFERENCES opus(id) ON UPDATE SET NULL," \
 	"FOREIGN KEY (albumid) REFERENCES album(id) ON UPDATE SET NULL);",
@@ -1698,6 +1771,16 @@ static media_ctx_t *media_init(player_ctx_t *player, const char *url, ...)
 #endif
 			ret = _media_initdb(ctx->db, query);
 		}
+#ifdef MEDIA_SQLITE_EXT
+		else
+		{
+			/**
+			 * the old databases don't contain the duration.
+			 * The request fails if the column already exists.
+			 */
+			sqlite3_exec(ctx->db, "alter table media add column duration INTEGER;", NULL, NULL, NULL);
+		}
+#endif
 		if (ret == SQLITE_OK)
 		{
 			dbg("open db %s", url);
@@ -48,6 +48,27 @@ struct mux_ctx_s
 	rtpheader_t header;
 	pthread_t thread;
 	const char *mime;
+	/// the first timestamp and the samples sent since
+	uint32_t timestamp;
+	uint64_t nsamples;
+	/// the delay in ms of the buffers, measured on the data
+	unsigned int delay;
+	/// the longest data of a packet after the header of the payload format
+	size_t maxpayload;
+	/// the MPEG audio frame started at the end of the previous buffer
+	unsigned char *frame;
+	size_t framelength;
+	size_t framesize;
+	unsigned int samplerate;
+#ifdef RTP_FEC
+	/// the parity of the current group
+	uint8_t *fec;
+	rtpfec_t fecheader;
+	int fecn;
+	/// the parity stream
+	uint32_t fecssrc;
+	uint16_t fecseqnum;
+#endif
 };
 #define MUX_CTX
 #include "mux.h"
@@ -68,6 +89,7 @@ static const char *jitter_name = "rtp muxer";
 static mux_ctx_t *mux_init(player_ctx_t *player, const char *mime)
 {
 	mux_ctx_t *ctx = calloc(1, sizeof(*ctx));
+	ctx->ctx = player;
 	ctx->mime = mime;
 
 	ctx->header.b.v = 2;
@@ -76,14 +98,20 @@ static mux_ctx_t *mux_init(player_ctx_t *player, const char *mime)
 	ctx->header.b.cc = 0;
 	ctx->header.b.m = 1;
 	if (mime == mime_audiomp3)
-		ctx->header.b.pt = 14;
+		ctx->header.b.pt = RTP_MPA_PT;
 	if (mime == mime_audiopcm)
-		ctx->header.b.pt = 11;
+		ctx->header.b.pt = RTP_L16_STEREO_PT;
 	if (mime == mime_audioalac)
 		ctx->header.b.pt = 46;
-	ctx->header.b.seqnum = random();
+	ctx->header.b.seqnum = htons(random());
 	ctx->header.timestamp = random();
+	ctx->timestamp = ntohl(ctx->header.timestamp);
 	ctx->header.ssrc = random();
+	ctx->frame = malloc(RTP_MPA_MAXFRAME);
+#ifdef RTP_FEC
+	ctx->fecssrc = random();
+	ctx->fecseqnum = random();
+#endif
 
 	return ctx;
 }
@@ -93,6 +121,309 @@ static jitter_t *mux_jitter(mux_ctx_t *ctx, int index)
 	return ctx->in;
 }
 
+/**
+ * @brief advance the timestamp of the next packet with the samples
+ * sent.
+ */
+static void _mux_timestamp(mux_ctx_t *ctx, unsigned int nsamples, unsigned int samplerate, unsigned int clockrate)
+{
+	ctx->nsamples += nsamples;
+	if (samplerate > 0)
+		ctx->header.timestamp = htonl(ctx->timestamp + (uint32_t)(ctx->nsamples * clockrate / samplerate));
+}
+
+#ifdef LOWLATENCY
+/// the largest MPEG audio frame: layer III 320 kbps at 32 kHz
+#define MUX_MAXFRAME 1441
+#else
+#define NB_BUFFERS 6
+#define THREDHOLD 3
+#endif
+
+/**
+ * @brief set the delay of the mux and the sink jitters to the player
+ * each buffer of the jitters contains the same number of samples.
+ */
+static void _mux_delay(mux_ctx_t *ctx, uint64_t nsamples, unsigned int samplerate)
+{
+	unsigned int nbuffers = ctx->in->ctx->thredhold + ctx->out->ctx->thredhold;
+	if (samplerate == 0)
+		return;
+	unsigned int delay = nbuffers * nsamples * 1000 / samplerate;
+	if (delay != ctx->delay)
+		player_setdelay(ctx->ctx, ctx->in, ctx->out, delay);
+	ctx->delay = delay;
+}
+
+static void _mux_seqnum(mux_ctx_t *ctx)
+{
+	ctx->header.b.m = 0;
+	/// the sequence number wraps after UINT16_MAX without hole
+	ctx->header.b.seqnum = htons(ntohs(ctx->header.b.seqnum) + 1);
+}
+
+#ifdef RTP_FEC
+/**
+ * @brief add a media packet to the parity of the group
+ */
+static void _mux_fecadd(mux_ctx_t *ctx, const char *packet, size_t len)
+{
+	const rtpheader_t *header = (const rtpheader_t *)packet;
+	rtpfec_t *fec = &ctx->fecheader;
+	size_t length = len - sizeof(*header);
+
+	if (ctx->fecn == 0)
+	{
+		memset(fec, 0, sizeof(*fec));
+		fec->snbase = ntohs(header->b.seqnum);
+	}
+	rtp_fecxor(ctx->fec, (const uint8_t *)packet + sizeof(*header), length);
+	fec->lengthrecovery ^= length;
+	fec->brecovery ^= rtp_fecbits(header->b);
+	fec->tsrecovery ^= header->timestamp;
+	if (length > fec->protectlength)
+		fec->protectlength = length;
+	fec->mask |= RTP_FEC_MASK(ctx->fecn);
+	ctx->fecn++;
+}
+
+/**
+ * @brief send the parity packet at the end of the group
+ */
+static void _mux_fecsend(mux_ctx_t *ctx)
+{
+	rtpheader_t header = ctx->header;
+	header.b.pt = RTP_FEC_PT;
+	header.b.m = 0;
+	header.b.cc = 1;
+	header.b.seqnum = htons(ctx->fecseqnum++);
+	header.ssrc = ctx->fecssrc;
+	/// the media stream protected
+	uint32_t csrc = ctx->header.ssrc;
+
+	rtpfec_t fec = ctx->fecheader;
+	fec.brecovery = htons(fec.brecovery & RTP_FEC_BITSMASK);
+	fec.snbase = htons(fec.snbase);
+	fec.lengthrecovery = htons(fec.lengthrecovery);
+	fec.protectlength = htons(fec.protectlength);
+	fec.mask = htons(fec.mask);
+
+	unsigned char *outbuffer = ctx->out->ops->pull(ctx->out->ctx);
+	if (outbuffer == NULL)
+		return;
+	int len = 0;
+	memcpy(outbuffer + len, &header, sizeof(header));
+	len += sizeof(header);
+	memcpy(outbuffer + len, &csrc, sizeof(csrc));
+	len += sizeof(csrc);
+	memcpy(outbuffer + len, &fec, sizeof(fec));
+	len += sizeof(fec);
+	memcpy(outbuffer + len, ctx->fec, ctx->fecheader.protectlength);
+	len += ctx->fecheader.protectlength;
+	mux_dbg("mux: rtp fec %d", ntohs(header.b.seqnum));
+	ctx->out->ops->push(ctx->out->ctx, len, NULL);
+
+	memset(ctx->fec, 0, ctx->fecheader.protectlength);
+	ctx->fecn = 0;
+}
+#endif
+
+/**
+ * @brief send one RTP packet with the header of the payload format
+ * and the data
+ */
+static void _mux_packet(mux_ctx_t *ctx, const void *format, size_t formatlen,
+		const char *data, size_t length, void *beat)
+{
+	char *outbuffer = ctx->out->ops->pull(ctx->out->ctx);
+	if (outbuffer == NULL)
+		return;
+	int len = sizeof(ctx->header);
+
+	mux_dbg("mux: rtp seqnum %d", ntohs(ctx->header.b.seqnum));
+	memcpy(outbuffer, &ctx->header, len);
+	_mux_seqnum(ctx);
+#ifdef DEBUG_0
+	int i;
+	fprintf(stderr, "header: ");
+	for (i = 0; i < len; i++)
+		fprintf(stderr, "%.2x ", outbuffer[i]);
+	fprintf(stderr, "\n");
+#endif
+	if (formatlen > 0)
+	{
+		memcpy(outbuffer + len, format, formatlen);
+		len += formatlen;
+	}
+	memcpy(outbuffer + len, data, length);
+	len += length;
+#ifdef RTP_FEC
+	_mux_fecadd(ctx, outbuffer, len);
+#endif
+	ctx->out->ops->push(ctx->out->ctx, len, beat);
+#ifdef RTP_FEC
+	if (ctx->fecn == RTP_FEC_GROUP)
+		_mux_fecsend(ctx);
+#endif
+}
+
+/**
+ * @brief send one MPEG audio frame (RFC 2250), a lost packet costs
+ * only one frame. The frame larger than the packet is fragmented, the
+ * header of each fragment contains its offset into the frame and all
+ * the fragments have the timestamp of the frame.
+ */
+static void _mux_mpaframe(mux_ctx_t *ctx, const unsigned char *frame, size_t length, void *beat)
+{
+	unsigned int samplerate = 0;
+	unsigned int nsamples = 0;
+	utils_mp3frame(frame, length, &samplerate, &nsamples);
+	/// the sink paces the packets on the clock of the timestamps
+	ctx->out->ctx->frequence = 90000;
+	size_t offset = 0;
+	while (offset < length)
+	{
+		size_t fragment = length - offset;
+		if (fragment > ctx->maxpayload)
+			fragment = ctx->maxpayload;
+		rtpmpa_t mpa = {
+			.mbz = 0,
+			.offset = htons(offset),
+		};
+		_mux_packet(ctx, &mpa, sizeof(mpa), (const char *)frame + offset, fragment, beat);
+		beat = NULL;
+		offset += fragment;
+	}
+	/**
+	 * the clock of MPEG audio is 90kHz (RFC 3551)
+	 */
+	_mux_timestamp(ctx, nsamples, samplerate, 90000);
+	if (samplerate > 0)
+		ctx->samplerate = samplerate;
+}
+
+/**
+ * @brief cut the buffer into MPEG audio frames.
+ * The end of the last frame may be into the next buffer, the
+ * beginning is kept until the frame is complete.
+ *
+ * @return the samplerate of the stream, 0 if it is unknown
+ */
+static unsigned int _mux_mpa(mux_ctx_t *ctx, const char *buffer, size_t length, void *beat)
+{
+	const unsigned char *input = (const unsigned char *)buffer;
+	size_t offset = 0;
+	while (offset < length)
+	{
+		if (ctx->framelength > 0)
+		{
+			/// the header gives the size of the frame
+			size_t missing = (ctx->framesize > 0)? ctx->framesize - ctx->framelength : 4 - ctx->framelength;
+			if (missing > length - offset)
+				missing = length - offset;
+			memcpy(ctx->frame + ctx->framelength, input + offset, missing);
+			ctx->framelength += missing;
+			offset += missing;
+			if (ctx->framesize == 0 && ctx->framelength >= 4)
+			{
+				int framesize = utils_mp3frame(ctx->frame, ctx->framelength, NULL, NULL);
+				if (framesize < 4 || framesize > RTP_MPA_MAXFRAME)
+				{
+					/// not a header, the search continues on the next byte
+					ctx->framelength--;
+					memmove(ctx->frame, ctx->frame + 1, ctx->framelength);
+					continue;
+				}
+				ctx->framesize = framesize;
+			}
+			if (ctx->framesize == 0 || ctx->framelength < ctx->framesize)
+				continue;
+			_mux_mpaframe(ctx, ctx->frame, ctx->framelength, beat);
+			beat = NULL;
+			ctx->framelength = 0;
+			ctx->framesize = 0;
+			continue;
+		}
+		size_t remain = length - offset;
+		if (remain < 4)
+		{
+			/// the header continues into the next buffer
+			ctx->framesize = 0;
+			ctx->framelength = remain;
+			memcpy(ctx->frame, input + offset, remain);
+			break;
+		}
+		int framelength = utils_mp3frame(input + offset, remain, NULL, NULL);
+		if (framelength < 4 || framelength > RTP_MPA_MAXFRAME)
+		{
+			/// skip up to the next header
+			offset++;
+			continue;
+		}
+		if ((size_t)framelength > remain)
+		{
+			/// the frame continues into the next buffer
+			ctx->framesize = framelength;
+			ctx->framelength = remain;
+			memcpy(ctx->frame, input + offset, remain);
+			break;
+		}
+		_mux_mpaframe(ctx, input + offset, framelength, beat);
+		beat = NULL;
+		offset += framelength;
+	}
+	return ctx->samplerate;
+}
+
+/**
+ * @brief the uncompressed audio and the other frames are sent as they come
+ * The buffers of the FLAC and ALAC encoders contain one frame,
+ * its header gives the number of samples.
+ *
+ * @return the samplerate of the stream
+ */
+static unsigned int _mux_pcm(mux_ctx_t *ctx, const char *buffer, size_t length, void *beat)
+{
+	/**
+	 * the clock of the audio is the samplerate
+	 */
+	unsigned int framesize = utils_format2framesize(ctx->in->format);
+	unsigned int samplerate = ctx->in->ctx->frequence;
+	if (samplerate == 0)
+		samplerate = DEFAULT_SAMPLERATE;
+	unsigned int nsamples = 0;
+	if (framesize > 0)
+	{
+		nsamples = length / framesize;
+		/// the static payload type is only for 44.1 kHz
+		if (samplerate != ctx->samplerate)
+		{
+			uint8_t pt = rtp_pcmpt(framesize / 2, samplerate);
+			if (pt == 0)
+				warn("mux: rtp samplerate %u without payload type", samplerate);
+			else
+				ctx->header.b.pt = pt;
+			ctx->samplerate = samplerate;
+		}
+	}
+	else if (ctx->mime == mime_audioflac)
+	{
+		unsigned int framerate = 0;
+		/// the metadata blocks don't contain samples
+		if (utils_flacframe((const unsigned char *)buffer, length, &framerate, &nsamples) > 0 &&
+			framerate > 0)
+			samplerate = framerate;
+	}
+	else if (ctx->mime == mime_audioalac)
+		utils_alacframe((const unsigned char *)buffer, length, &nsamples);
+	/// the sink paces the packets on the clock of the timestamps
+	ctx->out->ctx->frequence = samplerate;
+	_mux_packet(ctx, NULL, 0, buffer, length, beat);
+	if (nsamples > 0)
+		_mux_timestamp(ctx, nsamples, samplerate, samplerate);
+	return samplerate;
+}
+
 static void *mux_thread(void *arg)
 {
 	int result = 0;
@@ -112,29 +443,14 @@ static void *mux_thread(void *arg)
 		unsigned long inlength = ctx->in->ops->length(ctx->in->ctx);
 		if (inbuffer != NULL)
 		{
-			int len = sizeof(ctx->header);
-			char *outbuffer = ctx->out->ops->pull(ctx->out->ctx);
-
-			mux_dbg("mux: rtp seqnum %d", ctx->header.b.seqnum);
-			memcpy(outbuffer, &ctx->header, len);
-			ctx->header.b.m = 0;
-			ctx->header.b.seqnum++;
-			if (ctx->header.b.seqnum == UINT16_MAX)
-			{
-				ctx->header.b.seqnum = 0;
-				ctx->header.b.m = 1;
-			}
-#ifdef DEBUG_0
-			int i;
-			fprintf(stderr, "header: ");
-			for (i = 0; i < len; i++)
-				fprintf(stderr, "%.2x ", outbuffer[i]);
-			fprintf(stderr, "\n");
-#endif
-			memcpy(outbuffer + len, inbuffer, inlength);
-			len += inlength;
-
-			ctx->out->ops->push(ctx->out->ctx, len, beat);
+			uint64_t nsamples = ctx->nsamples;
+			unsigned int samplerate;
+			if (ctx->mime == mime_audiomp3)
+				samplerate = _mux_mpa(ctx, inbuffer, inlength, beat);
+			else
+				samplerate = _mux_pcm(ctx, inbuffer, inlength, beat);
+			if (ctx->nsamples > nsamples)
+				_mux_delay(ctx, ctx->nsamples - nsamples, samplerate);
 			ctx->in->ops->pop(ctx->in->ctx, inlength);
 		}
 	}
@@ -143,17 +459,47 @@ static void *mux_thread(void *arg)
 
 static int mux_run(mux_ctx_t *ctx, jitter_t *sink_jitter)
 {
-	int size = sink_jitter->ctx->size - sizeof(rtpheader_t) - sizeof(uint32_t);
-	jitter_t *jitter = jitter_scattergather_init(jitter_name, 6, size);
-	jitter->ctx->frequence = 0;
-	jitter->ctx->thredhold = 3;
 #if defined(MUX_RTP_MP3)
-	jitter->format = MPEG2_3_MP3;
-#elif defined(MUX_RTP_PCM)
-	jitter->format = PCM_16bits_LE_mono;
+	jitter_format_t format = MPEG2_3_MP3;
+#else
+	jitter_format_t format = SINK_BITSSTREAM;
+#endif
+	if (ctx->mime == mime_audiopcm)
+	{
+		/**
+		 * the filter of the decoder writes the samples in network
+		 * byte order directly into the payload, without encoder.
+		 */
+#ifdef MUX_RTP_L24
+		format = PCM_24bits3_BE_stereo;
+		ctx->header.b.pt = RTP_L24_PT;
+#else
+		format = PCM_16bits_BE_stereo;
+		ctx->header.b.pt = RTP_L16_STEREO_PT;
+#endif
+	}
+	/// the payload starts with the MPEG audio header
+	int size = sink_jitter->ctx->size - sizeof(rtpheader_t) - sizeof(rtpmpa_t);
+#ifdef RTP_FEC
+	/// the parity packet contains the CSRC, the FEC header and the longest payload
+	size -= sizeof(uint32_t) + sizeof(rtpfec_t);
+	ctx->fec = calloc(1, sink_jitter->ctx->size);
+#endif
+	/// the packets of PCM contain complete frames
+	unsigned int framesize = utils_format2framesize(format);
+	if (framesize > 0)
+		size -= size % framesize;
+	ctx->maxpayload = size;
+#ifdef LOWLATENCY
+	unsigned int count = JITTER_MINCOUNT((ctx->mime == mime_audiomp3)? MUX_MAXFRAME : size, size);
+	jitter_t *jitter = jitter_scattergather_init(jitter_name, count, size);
+	jitter->ctx->thredhold = count - 1;
 #else
-	jitter->format = SINK_BITSSTREAM;
+	jitter_t *jitter = jitter_scattergather_init(jitter_name, NB_BUFFERS, size);
+	jitter->ctx->thredhold = THREDHOLD;
 #endif
+	jitter->ctx->frequence = 0;
+	jitter->format = format;
 	ctx->in = jitter;
 
 	ctx->out = sink_jitter;
@@ -165,9 +511,9 @@ static int mux_attach(mux_ctx_t *ctx, const char *mime)
 {
 	ctx->mime = mime;
 	if (mime == mime_audiomp3)
-		ctx->header.b.pt = 14;
+		ctx->header.b.pt = RTP_MPA_PT;
 	if (mime == mime_audiopcm)
-		ctx->header.b.pt = 11;
+		ctx->header.b.pt = RTP_L16_STEREO_PT;
 	if (mime == mime_audioalac)
 		ctx->header.b.pt = 46;
 	return 0;
@@ -185,6 +531,10 @@ static void mux_destroy(mux_ctx_t *ctx)
 	if (ctx->thread)
 		pthread_join(ctx->thread, NULL);
 	jitter_scattergather_destroy(ctx->in);
+	free(ctx->frame);
+#ifdef RTP_FEC
+	free(ctx->fec);
+#endif
 	free(ctx);
 }
 
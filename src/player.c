@@ -54,6 +54,15 @@
 
 static void _player_autonext(void *arg, event_t event, void *eventarg);
 
+#define MAX_STAGES 16
+typedef struct player_stage_s player_stage_t;
+struct player_stage_s
+{
+	jitter_t *in;
+	jitter_t *out;
+	unsigned int delay;
+};
+
 struct player_ctx_s
 {
 	const char *filtername;
@@ -73,12 +82,29 @@ struct player_ctx_s
 
 	jitter_t *outstream[MAX_ESTREAM];
 	int noutstreams;
+	/// the decoder pushes into the fan-out, which copies to the encoders
+	jitter_t *fanout;
+	/// the fan-out converts the samples for the encoders of another format
+	filter_t *outfilter[MAX_ESTREAM];
+	sample_t *fanoutsamples;
+#ifdef DECODER_TRANSMUX
+	int transmux;
+	/// bitrate of the encoder in kbps, the frames must have the same
+	unsigned int transmuxrate;
+#endif
+	/// expected delay of each stage of the pipeline in ms
+	player_stage_t stages[MAX_STAGES];
+	int nstages;
+	pthread_mutex_t delaymutex;
+	/// correction of the samplerate in ppm
+	int ratio;
 };
 
 player_ctx_t *player_init(const char *filtername)
 {
 	player_ctx_t *ctx = calloc(1, sizeof(*ctx));
 	pthread_mutex_init(&ctx->mutex, NULL);
+	pthread_mutex_init(&ctx->delaymutex, NULL);
 	pthread_cond_init(&ctx->cond, NULL);
 	pthread_cond_init(&ctx->cond_int, NULL);
 	ctx->state = STATE_STOP;
@@ -143,6 +169,19 @@ void player_destroy(player_ctx_t *ctx)
 	pthread_cond_destroy(&ctx->cond);
 	pthread_cond_destroy(&ctx->cond_int);
 	pthread_mutex_destroy(&ctx->mutex);
+	pthread_mutex_destroy(&ctx->delaymutex);
+	if (ctx->fanout)
+		jitter_scattergather_destroy(ctx->fanout);
+	int i;
+	for (i = 0; i < ctx->noutstreams; i++)
+	{
+		if (ctx->outfilter[i] != NULL)
+		{
+			ctx->outfilter[i]->ops->destroy(ctx->outfilter[i]->ctx);
+			free(ctx->outfilter[i]);
+		}
+	}
+	free(ctx->fanoutsamples);
 	free(ctx);
 }
 
@@ -190,6 +229,91 @@ int player_mediaid(player_ctx_t *ctx)
 	return -1;
 }
 
+void player_setdelay(player_ctx_t *ctx, jitter_t *in, jitter_t *out, unsigned int delay)
+{
+	int i;
+	pthread_mutex_lock(&ctx->delaymutex);
+	for (i = 0; i < ctx->nstages; i++)
+	{
+		if (ctx->stages[i].in == in)
+			break;
+	}
+	if (i < MAX_STAGES)
+	{
+		ctx->stages[i].in = in;
+		ctx->stages[i].out = out;
+		ctx->stages[i].delay = delay;
+		if (i == ctx->nstages)
+			ctx->nstages++;
+	}
+	pthread_mutex_unlock(&ctx->delaymutex);
+}
+
+/**
+ * @brief the delay of the longest path from the jitter to a sink
+ */
+static unsigned int _player_pathdelay(player_ctx_t *ctx, jitter_t *in, int depth)
+{
+	unsigned int delay = 0;
+	int i;
+	if (depth > MAX_STAGES)
+		return 0;
+	for (i = 0; i < ctx->nstages; i++)
+	{
+		player_stage_t *stage = &ctx->stages[i];
+		if (stage->in != in)
+			continue;
+		unsigned int path = stage->delay;
+		if (stage->out != NULL)
+			path += _player_pathdelay(ctx, stage->out, depth + 1);
+		if (path > delay)
+			delay = path;
+	}
+	return delay;
+}
+
+unsigned int player_delay(player_ctx_t *ctx)
+{
+	unsigned int delay = 0;
+	int i, j;
+	pthread_mutex_lock(&ctx->delaymutex);
+	for (i = 0; i < ctx->nstages; i++)
+	{
+		/// the path starts on a stage fed by the decoder
+		for (j = 0; j < ctx->nstages; j++)
+		{
+			if (ctx->stages[j].out == ctx->stages[i].in)
+				break;
+		}
+		if (j < ctx->nstages)
+			continue;
+		unsigned int path = _player_pathdelay(ctx, ctx->stages[i].in, 0);
+		if (path > delay)
+			delay = path;
+	}
+	pthread_mutex_unlock(&ctx->delaymutex);
+	return delay;
+}
+
+int player_ratio(player_ctx_t *ctx, int ppm)
+{
+	int ratio = ctx->ratio;
+	if (ppm == 0)
+		return ratio;
+	/// the stored ratio is clamped, the producers remove their own corrections
+	int old;
+	do
+	{
+		old = ctx->ratio;
+		ratio = old + ppm;
+		if (ratio > PLAYER_RATIO_MAX)
+			ratio = PLAYER_RATIO_MAX;
+		if (ratio < -PLAYER_RATIO_MAX)
+			ratio = -PLAYER_RATIO_MAX;
+	} while (!__sync_bool_compare_and_swap(&ctx->ratio, old, ratio));
+	return ratio;
+}
+
 state_t player_state(player_ctx_t *ctx, state_t state)
 {
 	if ((state != STATE_UNKNOWN) && ctx->state != state)
@@ -230,6 +354,24 @@ static void _player_new_es(player_ctx_t *ctx, void *eventarg)
 	event_new_es_t *event_data = (event_new_es_t *)eventarg;
 	const src_t *src = event_data->src;
 	warn("player: decoder build");
+#ifdef DECODER_TRANSMUX
+	if (ctx->transmux)
+	{
+		event_data->decoder = calloc(1, sizeof(*event_data->decoder));
+		event_data->decoder->ops = decoder_transmux;
+		event_data->decoder->ctx = decoder_transmux->init(ctx);
+	}
+	else
+#endif
+#ifdef DECODER_CACHE
+	/**
+	 * only the local files are cached, the streams may change
+	 */
+	if (!strcmp(src->ops->name, "file") && ctx->noutstreams > 0)
+		event_data->decoder = decoder_cache_build(ctx, event_data->mime,
+							src->mediaid, ctx->outstream[0]->format);
+	else
+#endif
 	event_data->decoder = decoder_build(ctx, event_data->mime);
 	if (event_data->decoder == NULL)
 		err("player: decoder not found for %s", event_data->mime);
@@ -243,6 +385,9 @@ static void _player_new_es(player_ctx_t *ctx, void *eventarg)
 static void _player_decode_es(player_ctx_t *ctx, void *eventarg)
 {
 	event_decode_es_t *event_data = (event_decode_es_t *)eventarg;
+	if (event_data->decoder != NULL && ctx->fanout != NULL &&
+		event_data->decoder->ops->run(event_data->decoder->ctx, ctx->fanout) == 0)
+		return;
 	if (event_data->decoder != NULL && ctx->noutstreams < MAX_ESTREAM)
 	{
 		int i;
@@ -266,8 +411,61 @@ static void _player_listener(void *arg, event_t event, void *eventarg)
 		case SRC_EVENT_DECODE_ES:
 			_player_decode_es(ctx, eventarg);
 		break;
+#ifdef DECODER_CACHE
+		case SRC_EVENT_END_ES:
+			decoder_cache_complete(((event_end_es_t *)eventarg)->decoder);
+		break;
+#endif
+	}
+}
+
+#ifdef DECODER_TRANSMUX
+/**
+ * @brief check if the frames of the media may be sent to the sink
+ * without decoding and encoding
+ */
+static int _player_transmux(player_ctx_t *ctx, const char *url, const char *mime)
+{
+	int i;
+	jitter_t *outstream = NULL;
+	if (mime == NULL || strcmp(mime, mime_audiomp3))
+		return 0;
+	for (i = 0; i < ctx->noutstreams; i++)
+	{
+		if (ctx->outstream[i]->format == MPEG2_3_MP3)
+			outstream = ctx->outstream[i];
+	}
+	if (outstream == NULL)
+		return 0;
+
+	unsigned int samplerate = 0;
+	unsigned int bitrate = 0;
+	unsigned int nchannels = 0;
+	if (media_mp3format(url, &samplerate, &bitrate, &nchannels) != 0)
+		return 0;
+	/**
+	 * the VBR frames may be larger than the buffers, and the sink
+	 * expects the bitrate of the encoder. The media is re-encoded.
+	 */
+#ifdef ENCODER_VBR
+	if (bitrate == 0 || bitrate > ctx->transmuxrate * 1000)
+#else
+	if (bitrate == 0 || bitrate != ctx->transmuxrate * 1000)
+#endif
+	{
+		dbg("player: transmux refused %u bps for %u kbps", bitrate, ctx->transmuxrate);
+		return 0;
 	}
+	/**
+	 * the largest frame (1152 samples and padding) must be
+	 * inside one buffer of the muxer
+	 */
+	size_t framesize = 144 * bitrate / samplerate + 1;
+	dbg("player: transmux %u Hz %u bps %u channels", samplerate, bitrate, nchannels);
+	return (samplerate == DEFAULT_SAMPLERATE && nchannels == 2 &&
+			framesize <= outstream->ctx->size);
 }
+#endif
 
 static int _player_play(void* arg, int id, const char *url, const char *info, const char *mime)
 {
@@ -275,6 +473,9 @@ static int _player_play(void* arg, int id, const char *url, const char *info, co
 	src_t *src = NULL;
 
 	dbg("player: prepare %d %s %s", id, url, mime);
+#ifdef DECODER_TRANSMUX
+	ctx->transmux = _player_transmux(ctx, url, mime);
+#endif
 	src = src_build(ctx, url, mime, id);
 	if (src != NULL)
 	{
@@ -314,16 +515,191 @@ int player_play(void* arg, int id, const char *url, const char *info, const char
 	return _player_play(arg, id, url, info, mime);
 }
 
+/**
+ * the fan-out runs inside the thread of the decoder and
+ * copies each buffer to all encoders using its format.
+ */
+/**
+ * @brief the layout of the PCM formats
+ *
+ * @return the number of bits of the samples, or -1 if the format is not PCM
+ */
+static int _player_pcmformat(jitter_format_t format, int *samplesize, int *nchannels, int *bigendian)
+{
+	int bits;
+	*nchannels = 2;
+	*bigendian = 0;
+	switch (format)
+	{
+	case PCM_16bits_LE_mono:
+		*nchannels = 1;
+		*samplesize = 2;
+		bits = 16;
+	break;
+	case PCM_16bits_BE_stereo:
+		*bigendian = 1;
+		/* fallthrough */
+	case PCM_16bits_LE_stereo:
+		*samplesize = 2;
+		bits = 16;
+	break;
+	case PCM_24bits3_BE_stereo:
+		*bigendian = 1;
+		/* fallthrough */
+	case PCM_24bits3_LE_stereo:
+		*samplesize = 3;
+		bits = 24;
+	break;
+	case PCM_24bits4_LE_stereo:
+		*samplesize = 4;
+		bits = 24;
+	break;
+	case PCM_32bits_BE_stereo:
+		*bigendian = 1;
+		/* fallthrough */
+	case PCM_32bits_LE_stereo:
+		*samplesize = 4;
+		bits = 32;
+	break;
+	default:
+		return -1;
+	}
+	return bits;
+}
+
+/**
+ * @brief split the interleaved samples of the fan-out by channel,
+ * the samples are scaled to the bits of the output
+ */
+static void _player_samples(player_ctx_t *ctx, unsigned char *buffer, size_t size,
+			jitter_format_t outformat, filter_audio_t *audio)
+{
+	int samplesize, nchannels, bigendian;
+	int outsamplesize, outnchannels, outbigendian;
+	int bits = _player_pcmformat(ctx->fanout->format, &samplesize, &nchannels, &bigendian);
+	int outbits = _player_pcmformat(outformat, &outsamplesize, &outnchannels, &outbigendian);
+	int nframes = size / (samplesize * nchannels);
+	int i, j, k;
+	for (j = 0; j < nchannels; j++)
+		audio->samples[j] = ctx->fanoutsamples + j * nframes;
+	for (i = 0; i < nframes; i++)
+	{
+		for (j = 0; j < nchannels; j++)
+		{
+			unsigned char *sample = buffer + (i * nchannels + j) * samplesize;
+			uint32_t value = 0;
+			/// from the most significant byte
+			for (k = 0; k < samplesize; k++)
+				value = (value << 8) | sample[(bigendian)? k : samplesize - 1 - k];
+			value <<= 32 - samplesize * 8;
+			audio->samples[j][i] = (int32_t)value >> (32 - samplesize * 8);
+		}
+	}
+	audio->nsamples = nframes;
+	audio->nchannels = nchannels;
+	audio->bitspersample = outbits;
+	audio->regain = outbits - bits;
+}
+
+static int _player_fanout(void *arg, unsigned char *buffer, size_t size)
+{
+	player_ctx_t *ctx = (player_ctx_t *)arg;
+	int i;
+	for (i = 0; i < ctx->noutstreams; i++)
+	{
+		jitter_t *outstream = ctx->outstream[i];
+		filter_t *filter = ctx->outfilter[i];
+		if (outstream->format != ctx->fanout->format && filter == NULL)
+			continue;
+		if (outstream->ctx->frequence != ctx->fanout->ctx->frequence)
+			outstream->ctx->frequence = ctx->fanout->ctx->frequence;
+		if (filter != NULL)
+		{
+			filter_audio_t audio = {0};
+			_player_samples(ctx, buffer, size, outstream->format, &audio);
+			while (audio.nsamples > 0)
+			{
+				unsigned char *outbuffer = outstream->ops->pull(outstream->ctx);
+				if (outbuffer == NULL)
+					break;
+				int len = filter->ops->run(filter->ctx, &audio, outbuffer, outstream->ctx->size);
+				outstream->ops->push(outstream->ctx, len, NULL);
+			}
+			continue;
+		}
+		size_t offset = 0;
+		while (offset < size)
+		{
+			unsigned char *outbuffer = outstream->ops->pull(outstream->ctx);
+			/// the encoder is flushed
+			if (outbuffer == NULL)
+				break;
+			size_t len = size - offset;
+			if (len > outstream->ctx->size)
+				len = outstream->ctx->size;
+			memcpy(outbuffer, buffer + offset, len);
+			outstream->ops->push(outstream->ctx, len, NULL);
+			offset += len;
+		}
+	}
+	return size;
+}
+
 int player_subscribe(player_ctx_t *ctx, estream_t type, jitter_t *encoder_jitter)
 {
+	if (ctx->noutstreams >= MAX_ESTREAM)
+		return -1;
 	if (type == ES_AUDIO)
 	{
+		int samplesize, nchannels, bigendian;
+		int pcm = (_player_pcmformat(encoder_jitter->format, &samplesize, &nchannels, &bigendian) > 0);
+		/// the frames of the transmux go directly to their sink
+		if (!pcm && encoder_jitter->format != MPEG2_3_MP3)
+		{
+			err("player: output format %d not supported", encoder_jitter->format);
+			return -1;
+		}
 		ctx->outstream[ctx->noutstreams] = encoder_jitter;
 		ctx->noutstreams++;
+		jitter_t *first = ctx->outstream[0];
+		/**
+		 * several encoders share the decoding, the first one
+		 * gives the format of the decoder
+		 */
+		if (ctx->fanout == NULL && ctx->noutstreams > 1 && pcm &&
+			_player_pcmformat(first->format, &samplesize, &nchannels, &bigendian) > 0)
+		{
+			ctx->fanout = jitter_scattergather_init("player fanout", 2, first->ctx->size);
+			ctx->fanout->format = first->format;
+			ctx->fanout->ctx->frequence = first->ctx->frequence;
+			ctx->fanout->ctx->thredhold = 0;
+			ctx->fanout->ctx->consume = _player_fanout;
+			ctx->fanout->ctx->consumer = ctx;
+			ctx->fanoutsamples = calloc(first->ctx->size / 2, sizeof(*ctx->fanoutsamples));
+		}
+		/// the encoder of another PCM format receives converted samples
+		if (ctx->fanout != NULL && pcm && encoder_jitter->format != ctx->fanout->format)
+		{
+			filter_t *filter = filter_build(filter_pcm_interleave->name,
+						encoder_jitter->format, sampled_change);
+			if (filter == NULL)
+				return -1;
+			ctx->outfilter[ctx->noutstreams - 1] = filter;
+			dbg("player: fan-out converts %d to %d", ctx->fanout->format, encoder_jitter->format);
+		}
 	}
 	return 0;
 }
 
+#ifdef DECODER_TRANSMUX
+int player_transmux(player_ctx_t *ctx, jitter_t *sink_jitter, unsigned int bitrate)
+{
+	ctx->transmuxrate = bitrate;
+	sink_jitter->format = MPEG2_3_MP3;
+	return player_subscribe(ctx, ES_AUDIO, sink_jitter);
+}
+#endif
+
 static void _player_autonext(void *arg, event_t event, void *eventarg)
 {
 	player_ctx_t *ctx = (player_ctx_t *)arg;
@@ -402,6 +778,8 @@ static int _player_stateengine(player_ctx_t *ctx, int state)
 			ctx->media->ops->end(ctx->media->ctx);
 			for (i = 0; i < ctx->noutstreams; i++)
 				ctx->outstream[i]->ops->reset(ctx->outstream[i]->ctx);
+			if (ctx->fanout)
+				ctx->fanout->ops->reset(ctx->fanout->ctx);
 			dbg("player: stop");
 		break;
 		case STATE_CHANGE:
@@ -412,6 +790,12 @@ static int _player_stateengine(player_ctx_t *ctx, int state)
 				free(ctx->src);
 				ctx->src = NULL;
 			}
+			/**
+			 * the decoder flushes its output, and the fan-out has not
+			 * consumer thread to restart it
+			 */
+			if (ctx->fanout)
+				ctx->fanout->ops->reset(ctx->fanout->ctx);
 			ctx->src = ctx->nextsrc;
 			ctx->nextsrc = NULL;
 			for (i = 0; i < ctx->noutstreams; i++)
@@ -490,6 +874,11 @@ void player_sendevent(player_ctx_t *ctx, event_t event, void *data)
 
 const char *player_filtername(player_ctx_t *ctx)
 {
+	/**
+	 * the decoders without player run in offline mode
+	 */
+	if (ctx == NULL)
+		return "pcm_stereo";
 	return ctx->filtername;
 }
 
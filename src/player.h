@@ -41,6 +41,13 @@ player_ctx_t *player_init();
 int player_change(player_ctx_t *ctx, const char *mediapath, int random, int loop, int now);
 media_t *player_media(player_ctx_t *ctx);
 int player_subscribe(player_ctx_t *userdata, estream_t type, jitter_t *encoder_jitter);
+/**
+ * @brief the sink receives the MPEG audio frames of the mp3 files
+ * without decoding, if they have the format of the encoder
+ *
+ * @arg bitrate the bitrate of the encoder in kbps
+ */
+int player_transmux(player_ctx_t *ctx, jitter_t *sink_jitter, unsigned int bitrate);
 int player_run(player_ctx_t *userdata);
 void player_destroy(player_ctx_t *ctx);
 int player_waiton(player_ctx_t *ctx, int state);
@@ -52,6 +59,32 @@ int player_mediaid(player_ctx_t *ctx);
 const char *player_filtername(player_ctx_t *ctx);
 src_t *player_source(player_ctx_t *ctx);
 void player_sendevent(player_ctx_t *ctx, event_t event, void *data);
+/**
+ * @brief each stage of the pipeline sets its expected delay
+ *
+ * @arg in the input jitter of the stage
+ * @arg out the output jitter of the stage, NULL for a sink
+ * @arg delay the delay of the stage in ms
+ */
+void player_setdelay(player_ctx_t *ctx, jitter_t *in, jitter_t *out, unsigned int delay);
+/**
+ * @brief the stages are linked by their jitters, the outputs run in
+ * parallel.
+ *
+ * @return the expected delay of the longest path of the pipeline in ms
+ */
+unsigned int player_delay(player_ctx_t *ctx);
+
+#define PLAYER_RATIO_MAX 1000
+/**
+ * @brief each controller of the clock adds its correction of the
+ * samplerate. A positive ratio makes more samples for the sink.
+ *
+ * @arg ppm the change of the correction in ppm, 0 to read only
+ *
+ * @return the correction in ppm, limited to PLAYER_RATIO_MAX
+ */
+int player_ratio(player_ctx_t *ctx, int ppm);
 
 int player_play(void* arg, int id, const char *url, const char *info, const char *mime);
 
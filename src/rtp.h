@@ -4,14 +4,27 @@
 #include <stdint.h>
 #include <arpa/inet.h>
 
+/**
+ * The header follows the byte order of RFC 3550 to be read by
+ * the other receivers. The sequence number is in network byte order.
+ */
 struct rtpbits {
-    uint32_t     seqnum:16;     // sequence number: start random
-    uint32_t     pt:7;            // payload type: 14 for MPEG audio
-    uint32_t     m:1;             // marker: 0
-    uint32_t     cc:4;            // number of CSRC identifiers: 0
-    uint32_t     x:1;             // has extension header: 0
-    uint32_t     p:1;             // is there padding appended: 0
-    uint32_t     v:2;             // version: 2
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    uint8_t      v:2;             // version: 2
+    uint8_t      p:1;             // is there padding appended: 0
+    uint8_t      x:1;             // has extension header: 0
+    uint8_t      cc:4;            // number of CSRC identifiers: 0
+    uint8_t      m:1;             // marker: 1 on the first packet
+    uint8_t      pt:7;            // payload type: 14 for MPEG audio
+#else
+    uint8_t      cc:4;            // number of CSRC identifiers: 0
+    uint8_t      x:1;             // has extension header: 0
+    uint8_t      p:1;             // is there padding appended: 0
+    uint8_t      v:2;             // version: 2
+    uint8_t      pt:7;            // payload type: 14 for MPEG audio
+    uint8_t      m:1;             // marker: 1 on the first packet
+#endif
+    uint16_t     seqnum;          // sequence number: start random
 };
 
 struct rtpheader_s {           // in network byte order
@@ -22,8 +35,193 @@ struct rtpheader_s {           // in network byte order
 
 typedef struct rtpheader_s rtpheader_t;
 
+/**
+ * MPEG audio specific header (RFC 2250) before the frames
+ * of the payload type 14.
+ */
+#define RTP_MPA_PT 14
+struct rtpmpa_s {              // in network byte order
+    uint16_t     mbz;
+    uint16_t     offset;          // offset of the fragment into the frame
+};
+
+typedef struct rtpmpa_s rtpmpa_t;
+/// the largest MPEG audio frame: layer II 384 kbps at 32 kHz with padding
+#define RTP_MPA_MAXFRAME 1729
+
+/**
+ * uncompressed audio (RFC 3551 and RFC 3190),
+ * the samples are in network byte order
+ */
+#define RTP_L16_STEREO_PT 10
+#define RTP_L16_MONO_PT 11
+/// dynamic payload type for L24 stereo
+#define RTP_L24_PT 97
+
+/**
+ * @brief the format of the uncompressed audio of a payload type.
+ * The static types are only at 44.1 kHz, without SDP each dynamic type
+ * is fixed to one sample size and one rate.
+ *
+ * @return 0 if the payload type is uncompressed audio
+ */
+static inline int rtp_pcmformat(uint8_t pt, unsigned char *samplesize, unsigned char *nchannels, unsigned int *samplerate)
+{
+	*nchannels = 2;
+	switch (pt)
+	{
+	case RTP_L16_MONO_PT:
+		*nchannels = 1;
+		/* fallthrough */
+	case RTP_L16_STEREO_PT:
+		*samplesize = 2;
+		*samplerate = 44100;
+	break;
+	case 96:
+		*samplesize = 2;
+		*samplerate = 48000;
+	break;
+	case RTP_L24_PT:
+		*samplesize = 3;
+		*samplerate = 44100;
+	break;
+	case 98:
+		*samplesize = 3;
+		*samplerate = 48000;
+	break;
+	case 99:
+	case 100:
+		*samplesize = (pt == 99)? 2 : 3;
+		*samplerate = 88200;
+	break;
+	case 101:
+	case 102:
+		*samplesize = (pt == 101)? 2 : 3;
+		*samplerate = 96000;
+	break;
+	default:
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * @return the payload type of the uncompressed stereo audio, or 0
+ */
+static inline uint8_t rtp_pcmpt(unsigned char samplesize, unsigned int samplerate)
+{
+	static const uint8_t pts[] = {RTP_L16_STEREO_PT, 96, RTP_L24_PT, 98, 99, 100, 101, 102};
+	unsigned int i;
+	for (i = 0; i < sizeof(pts) / sizeof(pts[0]); i++)
+	{
+		unsigned char ptsamplesize;
+		unsigned char ptnchannels;
+		unsigned int ptsamplerate;
+		rtp_pcmformat(pts[i], &ptsamplesize, &ptnchannels, &ptsamplerate);
+		if (ptsamplesize == samplesize && ptsamplerate == samplerate)
+			return pts[i];
+	}
+	return 0;
+}
+
+/**
+ * RTCP sender report (RFC 3550) without report block,
+ * it maps the RTP timestamp to the wallclock of the sender.
+ */
+#define RTCP_SR 200
+#define RTCP_PORTOFFSET 1
+/// seconds between 1900 (NTP) and 1970 (Unix)
+#define RTCP_NTPOFFSET 2208988800UL
+
+struct rtcpsr_s {              // in network byte order
+    uint8_t      bits;            // version 2, no padding, no report: 0x80
+    uint8_t      pt;              // RTCP_SR
+    uint16_t     length;          // length in 32 bits words minus one
+    uint32_t     ssrc;
+    uint32_t     ntpsec;          // wallclock in NTP format
+    uint32_t     ntpfrac;
+    uint32_t     timestamp;       // RTP timestamp at the wallclock
+    uint32_t     packets;         // packets sent since the start
+    uint32_t     octets;          // payload octets sent since the start
+};
+
+typedef struct rtcpsr_s rtcpsr_t;
+
+/// dynamic payload type of the parity packets
+#define RTP_FEC_PT 127
+
+#ifdef RTP_FEC
+#include <string.h>
+
+/**
+ * XOR parity packets with the FEC header and the level 0 header of
+ * RFC 5109: one parity packet protects a group of RTP_FEC_GROUP media
+ * packets, the overhead is 1/RTP_FEC_GROUP.
+ * The parity packets are a stream with their own SSRC and sequence
+ * numbers and a dynamic payload type. The only CSRC of the parity
+ * packet is the SSRC of the media stream.
+ */
+#ifndef RTP_FEC_GROUP
+#define RTP_FEC_GROUP 4
+#endif
+#if RTP_FEC_GROUP > 16
+#error "the FEC mask protects 16 packets at most"
+#endif
+
+struct rtpfec_s {              // in network byte order
+    uint16_t     brecovery;       // E and L (0), XOR of P, X, CC, M and PT
+    uint16_t     snbase;          // seqnum of the first protected packet
+    uint32_t     tsrecovery;      // XOR of the timestamps
+    uint16_t     lengthrecovery;  // XOR of the lengths after the fixed header
+    /// the level 0 header
+    uint16_t     protectlength;   // length of the parity payload
+    uint16_t     mask;            // the MSB protects snbase
+} __attribute__((packed));
+
+typedef struct rtpfec_s rtpfec_t;
+
+/// the bit of the mask for the packet snbase + i
+#define RTP_FEC_MASK(i) (0x8000 >> (i))
+/// the E and L bits take the place of the version
+#define RTP_FEC_BITSMASK 0x3FFF
+
+typedef uint8_t rtpfec_vector_t __attribute__((vector_size(16)));
+
+/**
+ * @brief XOR src into dst, 16 bytes by 16 bytes with the vector unit
+ */
+static inline void rtp_fecxor(uint8_t *dst, const uint8_t *src, size_t len)
+{
+	size_t i = 0;
+	for (; i + sizeof(rtpfec_vector_t) <= len; i += sizeof(rtpfec_vector_t))
+	{
+		rtpfec_vector_t a;
+		rtpfec_vector_t b;
+		memcpy(&a, dst + i, sizeof(a));
+		memcpy(&b, src + i, sizeof(b));
+		a ^= b;
+		memcpy(dst + i, &a, sizeof(a));
+	}
+	for (; i < len; i++)
+		dst[i] ^= src[i];
+}
+
+/**
+ * @brief the two first bytes of the header as a word for the recovery
+ */
+static inline uint16_t rtp_fecbits(struct rtpbits bits)
+{
+	uint8_t word[2];
+	memcpy(word, &bits, sizeof(word));
+	return (word[0] << 8) | word[1];
+}
+#endif
+
 struct demux_ctx_s;
-typedef struct demux_ctx_s demux_ctx_t;
-extern void demux_rtp_addprofile(demux_ctx_t *ctx, char pt, const char *mime);
+extern void demux_rtp_addprofile(struct demux_ctx_s *ctx, char pt, const char *mime);
+/**
+ * @brief set the playout time of the stream from a sender report
+ */
+extern void demux_rtp_report(struct demux_ctx_s *ctx, const rtcpsr_t *sr);
 
 #endif
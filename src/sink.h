@@ -10,6 +10,9 @@ typedef void sink_ctx_t;
 typedef struct sink_ops_s sink_ops_t;
 struct sink_ops_s
 {
+	const char *name;
+	/// list of url's prefixes separated by '|'
+	const char *protocol;
 	sink_ctx_t *(*init)(player_ctx_t *, const char *soundcard);
 	int (*attach)(sink_ctx_t *, const char *mime);
 	jitter_t *(*jitter)(sink_ctx_t *, int index);
@@ -32,4 +35,51 @@ struct sink_s
 };
 
 sink_t *sink_build(player_ctx_t *, const char *arg);
+
+#ifdef SINK_DRIFT
+#include <stdint.h>
+/**
+ * The estimator follows the fill level of the jitter upstream of the
+ * decoder (the input of a network stream) and corrects the ratio of
+ * the player to hold this level. It compensates the drift between the
+ * clock of the producer (a remote sender) and the clock of the device.
+ * The buffer of the device is always full after a write and it can't
+ * be used as measure.
+ * It is the only controller of the ratio: the skew measured by the
+ * source is added to its correction.
+ */
+typedef struct sink_drift_s sink_drift_t;
+struct sink_drift_s
+{
+	/// average of the fill level in 1/16 of bytes
+	int64_t average;
+	int64_t previous;
+	/// level to hold, the average of the first period
+	int64_t target;
+	uint64_t start;
+	/// rate of the jitter in bytes per second, 0 to use its format
+	int64_t bytespersec;
+	/// correction measured by the source (the sender reports) in ppm
+	int skew;
+	/// correction of the residual drift measured on the level in ppm
+	int trim;
+	/// correction sent to the player in ppm, skew plus trim
+	int correction;
+};
+
+/**
+ * @brief update the estimator with the level of the jitter
+ *
+ * @arg now the monotonic time in ns
+ *
+ * @return the correction of the player in ppm
+ */
+int sink_drift(sink_drift_t *drift, player_ctx_t *player, jitter_t *jitter, uint64_t now);
+
+/**
+ * @brief remove the correction from the player at the end of the stream
+ * The skew of the source is kept, the estimator restarts.
+ */
+void sink_driftreset(sink_drift_t *drift, player_ctx_t *player);
+#endif
 #endif
@@ -30,12 +30,17 @@
 #include <pthread.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <poll.h>
 #include <alsa/asoundlib.h>
 
 #include "player.h"
 #include "jitter.h"
 typedef struct sink_s sink_t;
 typedef struct sink_ctx_s sink_ctx_t;
+#define SINK_CTX
+#include "sink.h"
 struct sink_ctx_s
 {
 	player_ctx_t *player;
@@ -49,16 +54,35 @@ struct sink_ctx_s
 	jitter_t *in;
 	state_t state;
 	jitter_format_t format;
+	/// the rate granted by the device
 	unsigned int samplerate;
+	/// the rate requested, the device may round it
+	unsigned int rate;
 	int buffersize;
+	/// the size of the device's buffer in frames, as granted by the hardware
+	snd_pcm_uframes_t hwbuffersize;
 	char samplesize;
 	char nchannels;
 
+	snd_pcm_format_t pcmformat;
+
+	/// the room of the device to wake the thread up
+	snd_pcm_uframes_t availmin;
+	/// one period of silence
 	unsigned char *noise;
+	/// number of frames of silence inserted
 	unsigned int noisecnt;
+	unsigned int underrun;
+#ifdef SINK_ALSA_MMAP
+	/// the producer writes directly into the buffer of the device
+	int mmap;
+	int flushed;
+	snd_pcm_uframes_t mmapoffset;
+	snd_pcm_uframes_t mmapframes;
+	/// used when the period is not contiguous into the device's buffer
+	unsigned char *bounce;
+#endif
 };
-#define SINK_CTX
-#include "sink.h"
 
 #define err(format, ...) fprintf(stderr, "\x1B[31m"format"\x1B[0m\n",  ##__VA_ARGS__)
 #define warn(format, ...) fprintf(stderr, "\x1B[35m"format"\x1B[0m\n",  ##__VA_ARGS__)
@@ -71,7 +95,22 @@ struct sink_ctx_s
 #define sink_dbg(...)
 
 #define LATENCE_MS 5
+#ifdef LOWLATENCY
+/// alsa needs at least 3 periods
+#define NB_BUFFER 6
+#else
 #define NB_BUFFER 16
+#endif
+
+#ifndef SINK_ALSA_STARTPERIODS
+/// the device starts as soon as this number of periods is queued
+#define SINK_ALSA_STARTPERIODS 2
+#endif
+
+#ifndef SINK_ALSA_NOISEPERIODS
+/// the periods kept queued into the device with silence when the jitter is empty
+#define SINK_ALSA_NOISEPERIODS 3
+#endif
 
 #ifdef USE_REALTIME
 // REALTIME_SCHED is set from the Makefile to SCHED_RR
@@ -122,6 +161,13 @@ typedef struct pcm_config_s
 	snd_pcm_format_t pcm_format;
 } pcm_config_t;
 
+static void _alsa_silencebuffer(sink_ctx_t *ctx)
+{
+	free(ctx->noise);
+	ctx->noise = malloc(ctx->buffersize);
+	snd_pcm_format_set_silence(ctx->pcmformat, ctx->noise, ctx->buffersize / ctx->samplesize);
+}
+
 static int _pcm_config(jitter_format_t format, pcm_config_t *config)
 {
 	jitter_format_t downformat = format;
@@ -165,22 +211,19 @@ static int _pcm_config(jitter_format_t format, pcm_config_t *config)
 	return downformat;
 }
 
-static int _pcm_open(sink_ctx_t *ctx, jitter_format_t format, unsigned int rate, unsigned int *size)
+/**
+ * @brief set the hardware parameters of the opened PCM
+ * The PCM must be in the OPEN or SETUP state (after a drain).
+ *
+ * @arg size the period size in frames, returns the period size in bytes
+ */
+static int _pcm_setup(sink_ctx_t *ctx, jitter_format_t format, unsigned int rate, unsigned int *size)
 {
 	int ret;
-
-	sink_dbg("sink: open %s", ctx->soundcard);
-	ret = snd_pcm_open(&ctx->playback_handle, ctx->soundcard, SND_PCM_STREAM_PLAYBACK, 0);
-	if (ret < 0)
-	{
-		err("sink: open %s", ctx->soundcard);
-		goto error;
-	}
-
 	pcm_config_t config = {0};
 	jitter_format_t downformat = _pcm_config(format, &config);
 
-	snd_pcm_hw_params_t *hw_params;
+	snd_pcm_hw_params_t *hw_params = NULL;
 	ret = snd_pcm_hw_params_malloc(&hw_params);
 	if (ret < 0)
 	{
@@ -196,6 +239,18 @@ static int _pcm_open(sink_ctx_t *ctx, jitter_format_t format, unsigned int rate,
 	}
 	//int resample = 1;
 	//ret = snd_pcm_hw_params_set_rate_resample(handle, params, resample);
+#ifdef SINK_ALSA_MMAP
+	if (ctx->mmap)
+	{
+		ret = snd_pcm_hw_params_set_access(ctx->playback_handle, hw_params, SND_PCM_ACCESS_MMAP_INTERLEAVED);
+		if (ret < 0)
+		{
+			warn("sink: alsa mmap not available");
+			ctx->mmap = 0;
+		}
+	}
+	if (!ctx->mmap)
+#endif
 	ret = snd_pcm_hw_params_set_access(ctx->playback_handle, hw_params, SND_PCM_ACCESS_RW_INTERLEAVED);
 	if (ret < 0)
 	{
@@ -217,6 +272,7 @@ static int _pcm_open(sink_ctx_t *ctx, jitter_format_t format, unsigned int rate,
 		warn("sink: alsa downgrade to 24bits over 32bits");
 	}
 	ctx->format = format;
+	ctx->pcmformat = config.pcm_format;
 	ctx->nchannels = config.nchannels;
 	ctx->samplesize = config.samplesize;
 
@@ -292,12 +348,38 @@ static int _pcm_open(sink_ctx_t *ctx, jitter_format_t format, unsigned int rate,
 		periodsize,
 		periods,
 		((double)periodtime) / 1000,
-		rate,
+		trate,
 		ctx->samplesize,
 		ctx->nchannels);
 	ctx->buffersize = periodsize * ctx->samplesize * ctx->nchannels;
+	ctx->hwbuffersize = buffersize;
 	*size = ctx->buffersize;
 
+	/**
+	 * the default start threshold is the full buffer, the short media
+	 * wouldn't start before the drain.
+	 */
+	snd_pcm_uframes_t start = periodsize * SINK_ALSA_STARTPERIODS;
+	if (start > buffersize)
+		start = buffersize;
+	/// the writes of the data wake up on each period
+	snd_pcm_uframes_t availmin = periodsize;
+	snd_pcm_sw_params_t *sw_params = NULL;
+	snd_pcm_sw_params_alloca(&sw_params);
+	ret = snd_pcm_sw_params_current(ctx->playback_handle, sw_params);
+	if (ret == 0)
+		ret = snd_pcm_sw_params_set_start_threshold(ctx->playback_handle, sw_params, start);
+	if (ret == 0)
+		ret = snd_pcm_sw_params_set_avail_min(ctx->playback_handle, sw_params, availmin);
+	if (ret == 0)
+		ret = snd_pcm_sw_params(ctx->playback_handle, sw_params);
+	if (ret < 0)
+	{
+		err("sink: sw params");
+		goto error;
+	}
+	ctx->availmin = availmin;
+
 	ret = snd_pcm_prepare(ctx->playback_handle);
 	if (ret < 0)
 	{
@@ -305,7 +387,10 @@ static int _pcm_open(sink_ctx_t *ctx, jitter_format_t format, unsigned int rate,
 		goto error;
 	}
 
-	ctx->samplerate = rate;
+	if (trate != rate && rate != 0)
+		warn("sink: alsa samplerate %u instead of %u", trate, rate);
+	ctx->samplerate = trate;
+	ctx->rate = rate;
 
 error:
 	if (ret < 0)
@@ -314,6 +399,44 @@ error:
 	return ret;
 }
 
+static int _pcm_open(sink_ctx_t *ctx, jitter_format_t format, unsigned int rate, unsigned int *size)
+{
+	int ret;
+
+	sink_dbg("sink: open %s", ctx->soundcard);
+	ret = snd_pcm_open(&ctx->playback_handle, ctx->soundcard, SND_PCM_STREAM_PLAYBACK, 0);
+	if (ret < 0)
+	{
+		err("sink: open %s %s", ctx->soundcard, snd_strerror(ret));
+		return ret;
+	}
+	return _pcm_setup(ctx, format, rate, size);
+}
+
+/**
+ * @brief change the samplerate without to close the device
+ * The frames already queued are played until the end, then the
+ * parameters are changed at the boundary of the last period.
+ * With FILTER_RESAMPLING, it is used only to negotiate the rate
+ * of the first media, before the device starts.
+ */
+static int _pcm_samplerate(sink_ctx_t *ctx, unsigned int rate)
+{
+	int divider = ctx->samplesize * ctx->nchannels;
+	unsigned int size = LATENCE_MS * rate / 1000;
+	if (ctx->buffersize > 0 && ctx->samplerate > 0)
+		size = (ctx->buffersize / divider) * rate / ctx->samplerate;
+	int oldsize = ctx->buffersize;
+
+	snd_pcm_drain(ctx->playback_handle);
+	int ret = _pcm_setup(ctx, ctx->format, rate, &size);
+	if (ret < 0)
+		return ret;
+	if (ctx->buffersize != oldsize)
+		_alsa_silencebuffer(ctx);
+	return 0;
+}
+
 static int _pcm_close(sink_ctx_t *ctx)
 {
 	snd_pcm_drain(ctx->playback_handle);
@@ -322,14 +445,23 @@ static int _pcm_close(sink_ctx_t *ctx)
 }
 
 static const char *jitter_name = "alsa";
+#ifdef SINK_ALSA_MMAP
+static jitter_t *_alsa_mmap_init(sink_ctx_t *ctx, size_t size);
+#endif
+
 static sink_ctx_t *alsa_init(player_ctx_t *player, const char *soundcard)
 {
 	int samplerate = DEFAULT_SAMPLERATE;
 	jitter_format_t format = SINK_ALSA_FORMAT;
 	sink_ctx_t *ctx = calloc(1, sizeof(*ctx));
 
+	if (!strncmp(soundcard, "alsa://", 7))
+		soundcard += 7;
 	ctx->soundcard = strdup(soundcard);
 	ctx->mixerch = ALSA_MIXER;
+#ifdef SINK_ALSA_MMAP
+	ctx->mmap = 1;
+#endif
 #ifdef SINK_ALSA_CONFIG
 	char *setting = strchr(ctx->soundcard, '?');
 	while (setting != NULL)
@@ -396,23 +528,36 @@ static sink_ctx_t *alsa_init(player_ctx_t *player, const char *soundcard)
 #endif
 
 	dbg("sink: alsa card %s mixer %s", ctx->soundcard, ctx->mixerch);
-	jitter_t *jitter = jitter_scattergather_init(jitter_name, NB_BUFFER, size);
+	jitter_t *jitter = NULL;
+#ifdef SINK_ALSA_MMAP
+	if (ctx->mmap)
+		jitter = _alsa_mmap_init(ctx, size);
+	else
+#endif
+	jitter = jitter_scattergather_init(jitter_name, NB_BUFFER, size);
 #ifdef SAMPLERATE_AUTO
 	jitter->ctx->frequence = 0;
 #else
 	jitter->ctx->frequence = DEFAULT_SAMPLERATE;
 #endif
 	jitter->ctx->thredhold = NB_BUFFER/2;
+#ifdef SINK_ALSA_MMAP
+	if (ctx->mmap)
+		jitter->ctx->thredhold = SINK_ALSA_STARTPERIODS;
+#endif
 	jitter->format = ctx->format;
 	ctx->in = jitter;
-	ctx->noise = malloc(ctx->buffersize);
-	int i = 0;
-	for (i = 0; i < ctx->buffersize; i++)
-	{
-		ctx->noise[i] = (char)random();
-	}
+	_alsa_silencebuffer(ctx);
 
 	ctx->player = player;
+	/// the jitter waits thredhold periods before to fill the alsa buffer
+	size_t periodsize = ctx->buffersize / (ctx->samplesize * ctx->nchannels);
+	size_t nframes = ctx->hwbuffersize;
+#ifdef SINK_ALSA_MMAP
+	if (!ctx->mmap)
+#endif
+	nframes += jitter->ctx->thredhold * periodsize;
+	player_setdelay(player, jitter, NULL, nframes * 1000 / ctx->samplerate);
 
 	return ctx;
 }
@@ -425,20 +570,20 @@ static jitter_t *alsa_jitter(sink_ctx_t *ctx, int index)
 static int _alsa_checksamplerate(sink_ctx_t *ctx)
 {
 	int ret = 0;
-	if(ctx->in->ctx->frequence && (ctx->in->ctx->frequence != ctx->samplerate))
+	if(ctx->in->ctx->frequence && (ctx->in->ctx->frequence != ctx->samplerate) &&
+		(ctx->in->ctx->frequence != ctx->rate))
 	{
-		_pcm_close(ctx);
-		int size = ctx->buffersize;
-		_pcm_open(ctx, ctx->in->format, ctx->in->ctx->frequence, &size);
-		free(ctx->noise);
-		ctx->noise = malloc(ctx->buffersize);
-		int i = 0;
-		for (i = 0; i < ctx->buffersize; i++)
-		{
-			ctx->noise[i] = (char)random();
-		}
+		ret = _pcm_samplerate(ctx, ctx->in->ctx->frequence);
+		if (ret < 0)
+			err("sink: alsa samplerate %u not available", ctx->in->ctx->frequence);
 	}
-#ifdef SAMPLERATE_AUTO
+#if defined(FILTER_RESAMPLING)
+	/**
+	 * the rate is negotiated once, the filters of the next decoders
+	 * resample to the rate of the device.
+	 */
+	ctx->in->ctx->frequence = ctx->samplerate;
+#elif defined(SAMPLERATE_AUTO)
 	ctx->in->ctx->frequence = 0;
 #else
 	ctx->in->ctx->frequence = DEFAULT_SAMPLERATE;
@@ -446,81 +591,373 @@ static int _alsa_checksamplerate(sink_ctx_t *ctx)
 	return ret;
 }
 
+#ifdef SINK_ALSA_MMAP
+/**
+ * The jitter of the mmap mode is only a descriptor of the period
+ * of the device's buffer. The producer (the filter of the decoder)
+ * packs the samples directly into the DMA area and the commit
+ * gives the period to the device. There is no thread into the sink.
+ */
+static heartbeat_t *_mmap_heartbeat(jitter_ctx_t *jitter, heartbeat_t *new)
+{
+	return NULL;
+}
+
+static void _mmap_lock(jitter_ctx_t *jitter)
+{
+}
+
+/**
+ * the reset empties the device's buffer, the stream starts from the beginning
+ */
+static void _mmap_reset(jitter_ctx_t *jitter)
+{
+	sink_ctx_t *ctx = (sink_ctx_t *)jitter->private;
+	snd_pcm_drop(ctx->playback_handle);
+	snd_pcm_prepare(ctx->playback_handle);
+	ctx->flushed = 0;
+}
+
+static unsigned char *_mmap_pull(jitter_ctx_t *jitter)
+{
+	sink_ctx_t *ctx = (sink_ctx_t *)jitter->private;
+	int divider = ctx->samplesize * ctx->nchannels;
+	snd_pcm_uframes_t periodsize = ctx->buffersize / divider;
+
+	if (ctx->flushed)
+		return NULL;
+	if (jitter->frequence && (jitter->frequence != ctx->samplerate) &&
+		(jitter->frequence != ctx->rate))
+	{
+		_alsa_checksamplerate(ctx);
+		divider = ctx->samplesize * ctx->nchannels;
+		periodsize = ctx->buffersize / divider;
+		jitter->size = ctx->buffersize;
+		ctx->bounce = realloc(ctx->bounce, jitter->size);
+	}
+
+	snd_pcm_sframes_t avail;
+	do
+	{
+		avail = snd_pcm_avail_update(ctx->playback_handle);
+		if (avail < 0)
+		{
+			warn("pcm recover %s", snd_strerror(avail));
+			ctx->underrun++;
+			if (snd_pcm_recover(ctx->playback_handle, avail, 0) < 0)
+				return NULL;
+			continue;
+		}
+		if (avail < periodsize && snd_pcm_wait(ctx->playback_handle, 1000) < 0)
+			snd_pcm_prepare(ctx->playback_handle);
+	} while (avail < periodsize && !ctx->flushed);
+	if (ctx->flushed)
+		return NULL;
+
+	const snd_pcm_channel_area_t *areas;
+	ctx->mmapframes = periodsize;
+	int ret = snd_pcm_mmap_begin(ctx->playback_handle, &areas, &ctx->mmapoffset, &ctx->mmapframes);
+	if (ret < 0)
+	{
+		err("sink: alsa mmap %s", snd_strerror(ret));
+		return NULL;
+	}
+	if (ctx->mmapframes < periodsize)
+	{
+		/// the period wraps the end of the device's buffer
+		snd_pcm_mmap_commit(ctx->playback_handle, ctx->mmapoffset, 0);
+		ctx->mmapframes = 0;
+		return ctx->bounce;
+	}
+	return (unsigned char *)areas[0].addr + (areas[0].first + ctx->mmapoffset * areas[0].step) / 8;
+}
+
+static void _mmap_push(jitter_ctx_t *jitter, size_t len, void *beat)
+{
+	sink_ctx_t *ctx = (sink_ctx_t *)jitter->private;
+	int divider = ctx->samplesize * ctx->nchannels;
+	snd_pcm_sframes_t ret;
+
+	if (ctx->mmapframes == 0)
+		ret = snd_pcm_mmap_writei(ctx->playback_handle, ctx->bounce, len / divider);
+	else
+		ret = snd_pcm_mmap_commit(ctx->playback_handle, ctx->mmapoffset, len / divider);
+	if (ret < 0)
+	{
+		warn("pcm recover");
+		ctx->underrun++;
+		snd_pcm_recover(ctx->playback_handle, ret, 0);
+		return;
+	}
+	/**
+	 * the commit starts the device at the start threshold of the sw params
+	 */
+}
+
+static unsigned char *_mmap_peer(jitter_ctx_t *jitter, void **beat)
+{
+	return NULL;
+}
+
+static void _mmap_pop(jitter_ctx_t *jitter, size_t len)
+{
+}
+
+/**
+ * as the jitter_sg, the flush stops the filling and the frames already
+ * committed are played. The next stream restarts the filling with the
+ * pause's release or the reset.
+ */
+static void _mmap_flush(jitter_ctx_t *jitter)
+{
+	sink_ctx_t *ctx = (sink_ctx_t *)jitter->private;
+	ctx->flushed = 1;
+	/// the end of the stream may be under the start threshold
+	snd_pcm_sframes_t avail = snd_pcm_avail_update(ctx->playback_handle);
+	if (snd_pcm_state(ctx->playback_handle) == SND_PCM_STATE_PREPARED &&
+		avail >= 0 && avail < ctx->hwbuffersize)
+		snd_pcm_start(ctx->playback_handle);
+}
+
+static size_t _mmap_length(jitter_ctx_t *jitter)
+{
+	return jitter->size;
+}
+
+static size_t _mmap_level(jitter_ctx_t *jitter)
+{
+	sink_ctx_t *ctx = (sink_ctx_t *)jitter->private;
+	int divider = ctx->samplesize * ctx->nchannels;
+	snd_pcm_sframes_t avail = snd_pcm_avail_update(ctx->playback_handle);
+	size_t buffersize = ctx->hwbuffersize * divider;
+	if (avail < 0 || avail * divider > buffersize)
+		return 0;
+	return buffersize - avail * divider;
+}
+
+static int _mmap_empty(jitter_ctx_t *jitter)
+{
+	sink_ctx_t *ctx = (sink_ctx_t *)jitter->private;
+	return (snd_pcm_state(ctx->playback_handle) != SND_PCM_STATE_RUNNING);
+}
+
+static void _mmap_pause(jitter_ctx_t *jitter, int enable)
+{
+	sink_ctx_t *ctx = (sink_ctx_t *)jitter->private;
+	/// the player releases the pause on the change of stream
+	if (!enable)
+		ctx->flushed = 0;
+	snd_pcm_state_t state = snd_pcm_state(ctx->playback_handle);
+	if ((enable && state == SND_PCM_STATE_RUNNING) ||
+		(!enable && state == SND_PCM_STATE_PAUSED))
+		snd_pcm_pause(ctx->playback_handle, enable);
+}
+
+static const jitter_ops_t *_alsa_mmap_ops = &(jitter_ops_t)
+{
+	.heartbeat = _mmap_heartbeat,
+	.lock = _mmap_lock,
+	.reset = _mmap_reset,
+	.pull = _mmap_pull,
+	.push = _mmap_push,
+	.peer = _mmap_peer,
+	.pop = _mmap_pop,
+	.flush = _mmap_flush,
+	.length = _mmap_length,
+	.empty = _mmap_empty,
+	.pause = _mmap_pause,
+	.level = _mmap_level,
+};
+
+static jitter_t *_alsa_mmap_init(sink_ctx_t *ctx, size_t size)
+{
+	jitter_t *jitter = calloc(1, sizeof(*jitter));
+	jitter->ctx = calloc(1, sizeof(*jitter->ctx));
+	jitter->ctx->name = jitter_name;
+	/// the jitter describes the periods of the buffer granted by the hardware
+	jitter->ctx->count = ctx->hwbuffersize * ctx->samplesize * ctx->nchannels / size;
+	jitter->ctx->size = size;
+	jitter->ctx->private = ctx;
+	jitter->ops = _alsa_mmap_ops;
+	ctx->bounce = malloc(size);
+	return jitter;
+}
+
+static void _alsa_mmap_destroy(jitter_t *jitter)
+{
+	sink_ctx_t *ctx = (sink_ctx_t *)jitter->ctx->private;
+	free(ctx->bounce);
+	free(jitter->ctx);
+	free(jitter);
+}
+#endif
+
+/**
+ * @brief wait that the jitter receives a buffer or that the device
+ * has room for avail_min frames
+ *
+ * @arg pfds the jitter fd followed by the PCM's descriptors
+ * @arg npcmfds the number of PCM's descriptors to poll, 0 to wait only the jitter
+ * @arg timeout in ms, -1 to wait without limit
+ */
+static void _alsa_wait(sink_ctx_t *ctx, struct pollfd *pfds, int npcmfds, int timeout)
+{
+	struct pollfd *pfd = pfds;
+	int nfds = npcmfds + 1;
+	if (pfds[0].fd < 0)
+	{
+		/// without jitter's fd, the new buffers are checked each LATENCE_MS
+		pfd++;
+		nfds--;
+		timeout = LATENCE_MS;
+	}
+	if (nfds == 0)
+	{
+		usleep(LATENCE_MS * 1000);
+		return;
+	}
+	if (poll(pfd, nfds, timeout) <= 0)
+		return;
+	if (pfds[0].fd >= 0 && (pfds[0].revents & POLLIN))
+	{
+		uint64_t value;
+		if (read(pfds[0].fd, &value, sizeof(value)) < 0)
+			sink_dbg("sink: alsa jitter fd error");
+	}
+	if (npcmfds > 0)
+	{
+		unsigned short revents = 0;
+		snd_pcm_poll_descriptors_revents(ctx->playback_handle, pfds + 1, npcmfds, &revents);
+		if (revents & POLLERR)
+			sink_dbg("sink: alsa device error, recover on the next write");
+	}
+}
+
+#ifdef SINK_ALSA_NOISE
+/**
+ * @brief change the room of the device that wakes the thread up
+ * The level of silence uses a large avail_min only while the jitter
+ * is empty, the writes of the data keep one period.
+ */
+static void _alsa_availmin(sink_ctx_t *ctx, snd_pcm_uframes_t availmin)
+{
+	if (availmin == ctx->availmin)
+		return;
+	snd_pcm_sw_params_t *sw_params = NULL;
+	snd_pcm_sw_params_alloca(&sw_params);
+	int ret = snd_pcm_sw_params_current(ctx->playback_handle, sw_params);
+	if (ret == 0)
+		ret = snd_pcm_sw_params_set_avail_min(ctx->playback_handle, sw_params, availmin);
+	if (ret == 0)
+		ret = snd_pcm_sw_params(ctx->playback_handle, sw_params);
+	if (ret < 0)
+		sink_dbg("sink: alsa avail_min %s", snd_strerror(ret));
+	else
+		ctx->availmin = availmin;
+}
+#endif
+
+static int _alsa_recover(sink_ctx_t *ctx, int ret)
+{
+	ctx->underrun++;
+	warn("sink: alsa underrun %u", ctx->underrun);
+	return snd_pcm_recover(ctx->playback_handle, ret, 0);
+}
+
+#ifdef SINK_ALSA_NOISE
+/**
+ * @brief complete the device's buffer with the missing frames of silence
+ */
+static int _alsa_silence(sink_ctx_t *ctx, snd_pcm_sframes_t frames)
+{
+	int divider = ctx->samplesize * ctx->nchannels;
+	snd_pcm_sframes_t periodsize = ctx->buffersize / divider;
+	while (frames > 0)
+	{
+		snd_pcm_sframes_t length = (frames > periodsize)? periodsize : frames;
+		int ret = snd_pcm_writei(ctx->playback_handle, ctx->noise, length);
+		if (ret == -EPIPE)
+			ret = _alsa_recover(ctx, ret);
+		if (ret < 0)
+			return ret;
+		ctx->noisecnt += ret;
+		frames -= ret;
+	}
+	return 0;
+}
+#endif
+
 static void *sink_thread(void *arg)
 {
 	int ret;
 	sink_ctx_t *ctx = (sink_ctx_t *)arg;
 	int divider = ctx->samplesize * ctx->nchannels;
+	/// the jitter's fd and the PCM's descriptors are polled together
+	int npcmfds = snd_pcm_poll_descriptors_count(ctx->playback_handle);
+	if (npcmfds < 0)
+		npcmfds = 0;
+	struct pollfd *pfds = calloc(npcmfds + 1, sizeof(*pfds));
+	pfds[0].fd = -1;
+	pfds[0].events = POLLIN;
+	if (ctx->in->ops->fd != NULL)
+		pfds[0].fd = ctx->in->ops->fd(ctx->in->ctx);
+	if (npcmfds > 0)
+		npcmfds = snd_pcm_poll_descriptors(ctx->playback_handle, pfds + 1, npcmfds);
 
 	/* start decoding */
 	while (ctx->in->ops->empty(ctx->in->ctx))
-		usleep(LATENCE_MS * 1000);
+		_alsa_wait(ctx, pfds, 0, -1);
 	while (ctx->state != STATE_ERROR)
 	{
 		unsigned char *buff = NULL;
 		int length = 0;
 #ifdef SINK_ALSA_NOISE
-		ret = snd_pcm_wait(ctx->playback_handle, 1000);
-		if (ret == -EPIPE)
-		{
-			/**
-			* This must never occure, the udp src needs to know
-			* how many PCM missing.
-			*/
-			err("alsa: pcm wait error %s", snd_strerror(ret));
-			warn("pcm recover");
-			ret = snd_pcm_recover(ctx->playback_handle, ret, 0);
-			player_state(ctx->player, STATE_STOP);
-			continue;
-		}
 		if (ctx->in->ops->empty(ctx->in->ctx))
 		{
-			snd_pcm_sframes_t samples;
-			snd_pcm_delay(ctx->playback_handle, &samples);
+			snd_pcm_sframes_t queued = 0;
+			ret = snd_pcm_delay(ctx->playback_handle, &queued);
+			if (ret == -EPIPE)
+			{
+				_alsa_recover(ctx, ret);
+				queued = 0;
+			}
 			/**
 			 * alsa needs at least 3 periods to run correctly
 			 */
-			if (samples * ctx->samplesize * ctx->nchannels > ctx->buffersize * 3)
+			snd_pcm_sframes_t level = SINK_ALSA_NOISEPERIODS * ctx->buffersize / divider;
+			if (queued < level)
 			{
-				sched_yield();
-				usleep(LATENCE_MS * 1000);
+				ret = _alsa_silence(ctx, level - queued);
+				if (ret < 0)
+				{
+					ctx->state = STATE_ERROR;
+					err("sink: error write pcm %s", snd_strerror(ret));
+				}
 				continue;
 			}
-			length = ctx->buffersize;
-			buff = ctx->noise;
-			ctx->noisecnt ++;
+			/**
+			 * wait a new buffer or that the device goes under
+			 * the minimum level (avail_min of the sw params)
+			 */
+			if (ctx->hwbuffersize > level)
+				_alsa_availmin(ctx, ctx->hwbuffersize - level + 1);
+			_alsa_wait(ctx, pfds, npcmfds, -1);
+			continue;
 		}
-		else
+		_alsa_availmin(ctx, ctx->buffersize / divider);
 #endif
-		{
-			buff = ctx->in->ops->peer(ctx->in->ctx, NULL);
-			if (buff == NULL)
-				continue;
-			length = ctx->in->ops->length(ctx->in->ctx);
-			_alsa_checksamplerate(ctx);
-		}
-		//snd_pcm_mmap_begin
+		buff = ctx->in->ops->peer(ctx->in->ctx, NULL);
+		if (buff == NULL)
+			continue;
+		length = ctx->in->ops->length(ctx->in->ctx);
+		_alsa_checksamplerate(ctx);
+		divider = ctx->samplesize * ctx->nchannels;
+
 		ret = snd_pcm_writei(ctx->playback_handle, buff, length / divider);
 		sink_dbg("sink  alsa : write %d/%d %d/%d %d", ret * divider, length, ret, length / divider, divider);
 		if (ret == -EPIPE)
-		{
-			warn("pcm recover");
-			ret = snd_pcm_recover(ctx->playback_handle, ret, 0);
-		}
-#ifdef SINK_ALSA_NOISE
-		if (buff == ctx->noise)
-		{
-			int i = 0;
-			char *tmp;
-			for (i = 0; i < ctx->buffersize; i++)
-			{
-				tmp = &ctx->noise[i];
-				*tmp = (char)random();
-			}
-		}
-		else
-#endif
-			ctx->in->ops->pop(ctx->in->ctx, ret * divider);
+			ret = _alsa_recover(ctx, ret);
+		ctx->in->ops->pop(ctx->in->ctx, ret * divider);
 		if (ret < 0)
 		{
 			ctx->state = STATE_ERROR;
@@ -531,6 +968,7 @@ static void *sink_thread(void *arg)
 			sink_dbg("sink: play %d", ret);
 		}
 	}
+	free(pfds);
 	dbg("sink: thread end");
 	return NULL;
 }
@@ -542,6 +980,11 @@ static int sink_attach(sink_ctx_t *ctx, const char *mime)
 
 static int alsa_run(sink_ctx_t *ctx)
 {
+#ifdef SINK_ALSA_MMAP
+	/// the producer's thread feeds the device
+	if (ctx->mmap)
+		return 0;
+#endif
 #ifdef USE_REALTIME
 	int ret;
 
@@ -594,7 +1037,14 @@ static void alsa_destroy(sink_ctx_t *ctx)
 		snd_mixer_close(ctx->mixer);
 #endif
 
+	if (ctx->underrun > 0 || ctx->noisecnt > 0)
+		warn("sink: alsa %u underruns, %u frames of silence", ctx->underrun, ctx->noisecnt);
 	free(ctx->noise);
+#ifdef SINK_ALSA_MMAP
+	if (ctx->mmap)
+		_alsa_mmap_destroy(ctx->in);
+	else
+#endif
 	jitter_scattergather_destroy(ctx->in);
 	free(ctx->soundcard);
 	free(ctx);
@@ -602,6 +1052,8 @@ static void alsa_destroy(sink_ctx_t *ctx)
 
 const sink_ops_t *sink_alsa = &(sink_ops_t)
 {
+	.name = "alsa",
+	.protocol = "alsa://",
 	.init = alsa_init,
 	.jitter = alsa_jitter,
 	.attach = sink_attach,
@@ -1,5 +1,10 @@
+#include <stdio.h>
 #include <string.h>
+#include <stdlib.h>
 
+#include "player.h"
+#include "jitter.h"
+#include "media.h"
 #include "sink.h"
 
 #define err(format, ...) fprintf(stderr, "\x1B[31m"format"\x1B[0m\n",  ##__VA_ARGS__)
@@ -18,30 +23,175 @@ extern const sink_ops_t *sink_file;
 extern const sink_ops_t *sink_udp;
 extern const sink_ops_t *sink_unix;
 
-static sink_t _sink = {0};
-sink_t *sink_build(player_ctx_t *player, const char *arg)
+static const sink_ops_t *sinkslist[6] = {0};
+
+static void _sink_init(void) __attribute__((constructor));
+
+static void _sink_init(void)
 {
-	const sink_ops_t *sinkops = NULL;
-	if (!strcmp(arg, "none"))
-		return NULL;
-#ifdef SINK_ALSA
-	sinkops = sink_alsa;
+	int i = 0;
+	/// the first sink is the default one
+#ifdef SINK_UNIX
+	sinkslist[i++] = sink_unix;
 #endif
-#ifdef SINK_FILE
-	sinkops = sink_file;
+#ifdef SINK_UDP
+	sinkslist[i++] = sink_udp;
 #endif
 #ifdef SINK_TINYALSA
-	sinkops = sink_tinyalsa;
+	sinkslist[i++] = sink_tinyalsa;
 #endif
-#ifdef SINK_UDP
-	sinkops = sink_udp;
+#ifdef SINK_FILE
+	sinkslist[i++] = sink_file;
 #endif
-#ifdef SINK_UNIX
-	sinkops = sink_unix;
+#ifdef SINK_ALSA
+	sinkslist[i++] = sink_alsa;
 #endif
-	_sink.ctx = sinkops->init(player, arg);
-	if (_sink.ctx == NULL)
+}
+
+static const sink_ops_t *_sink_check(const char *url)
+{
+	int i;
+	for (i = 0; sinkslist[i] != NULL; i++)
+	{
+		const char *protocol = sinkslist[i]->protocol;
+		while (protocol != NULL)
+		{
+			const char *next = strchr(protocol,'|');
+			int len = strlen(protocol);
+			if (next != NULL)
+				len = next - protocol;
+			if (!(strncmp(url, protocol, len)))
+				return sinkslist[i];
+			protocol = next;
+			if (protocol)
+				protocol++;
+		}
+	}
+	return sinkslist[0];
+}
+
+sink_t *sink_build(player_ctx_t *player, const char *arg)
+{
+	const sink_ops_t *sinkops = NULL;
+	if (!strcmp(arg, "none"))
+		return NULL;
+	sinkops = _sink_check(arg);
+	if (sinkops == NULL)
+	{
+		err("sink not found %s", arg);
+		return NULL;
+	}
+	sink_dbg("sink: %s", sinkops->name);
+	sink_ctx_t *ctx = sinkops->init(player, arg);
+	if (ctx == NULL)
 		return NULL;
-	_sink.ops = sinkops;
-	return &_sink;
+	sink_t *sink = calloc(1, sizeof(*sink));
+	sink->ctx = ctx;
+	sink->ops = sinkops;
+	return sink;
+}
+
+#ifdef SINK_DRIFT
+#ifndef SINK_DRIFT_MAX
+#define SINK_DRIFT_MAX 500
+#endif
+/// seconds between two corrections
+#define DRIFT_PERIOD 5
+/// seconds to come back to the target level
+#define DRIFT_CONVERGENCE 60
+
+/**
+ * @brief send the sum of the skew and of the trim to the player
+ */
+static int _sink_driftapply(sink_drift_t *drift, player_ctx_t *player)
+{
+	int correction = drift->skew + drift->trim;
+	if (correction > SINK_DRIFT_MAX)
+		correction = SINK_DRIFT_MAX;
+	if (correction < -SINK_DRIFT_MAX)
+		correction = -SINK_DRIFT_MAX;
+	if (correction != drift->correction)
+	{
+		dbg("sink: drift skew %d trim %d correction %d ppm", drift->skew, drift->trim, correction);
+		player_ratio(player, correction - drift->correction);
+		drift->correction = correction;
+	}
+	return drift->correction;
 }
+
+/**
+ * @brief update the estimator after each buffer of the jitter
+ *
+ * The change of the level during a period is the residual drift,
+ * the distance to the target is removed during DRIFT_CONVERGENCE.
+ * A jitter always full is fed faster than the real time (a local file)
+ * and it is not corrected.
+ */
+int sink_drift(sink_drift_t *drift, player_ctx_t *player, jitter_t *jitter, uint64_t now)
+{
+	if (jitter->ops->level == NULL)
+		return _sink_driftapply(drift, player);
+	int64_t level = jitter->ops->level(jitter->ctx);
+	int64_t capacity = (int64_t)jitter->ctx->count * jitter->ctx->size;
+	if (drift->start == 0)
+	{
+		drift->start = now;
+		drift->average = level * 16;
+		return _sink_driftapply(drift, player);
+	}
+	drift->average += (level * 16 - drift->average) / 64;
+
+	uint64_t elapsed = now - drift->start;
+	if (elapsed < DRIFT_PERIOD * 1000000000ULL)
+		return _sink_driftapply(drift, player);
+	drift->start = now;
+
+	int64_t bytespersec = drift->bytespersec;
+	if (bytespersec == 0)
+	{
+		unsigned int samplerate = jitter->ctx->frequence;
+		if (samplerate == 0)
+			samplerate = DEFAULT_SAMPLERATE;
+		bytespersec = (int64_t)utils_format2framesize(jitter->format) * samplerate;
+	}
+	if (bytespersec == 0)
+		return _sink_driftapply(drift, player);
+	if (drift->average >= (capacity - (int64_t)jitter->ctx->size) * 16)
+	{
+		drift->trim = 0;
+		drift->target = 0;
+		return _sink_driftapply(drift, player);
+	}
+	if (drift->target == 0)
+	{
+		drift->target = drift->average;
+		drift->previous = drift->average;
+		return _sink_driftapply(drift, player);
+	}
+	/// the level grows when the device is slower than the producer
+	int64_t residual = (drift->average - drift->previous) / 16 * 1000000LL * 1000
+			/ ((int64_t)(elapsed / 1000000) * bytespersec);
+	int64_t distance = (drift->average - drift->target) * 1000000LL / 16
+			/ (bytespersec * DRIFT_CONVERGENCE);
+	drift->previous = drift->average;
+
+	int trim = drift->trim - (residual / 2 + distance);
+	if (trim > SINK_DRIFT_MAX)
+		trim = SINK_DRIFT_MAX;
+	if (trim < -SINK_DRIFT_MAX)
+		trim = -SINK_DRIFT_MAX;
+	drift->trim = trim;
+	dbg("sink: drift level %lld/%lld", (long long)drift->average / 16, (long long)drift->target / 16);
+	return _sink_driftapply(drift, player);
+}
+
+void sink_driftreset(sink_drift_t *drift, player_ctx_t *player)
+{
+	if (drift->correction != 0)
+		player_ratio(player, -drift->correction);
+	drift->correction = 0;
+	drift->trim = 0;
+	drift->target = 0;
+	drift->start = 0;
+}
+#endif
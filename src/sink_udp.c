@@ -43,11 +43,42 @@
 #include <unistd.h>
 #include <poll.h>
 #include <sched.h>
+#ifdef SINK_UDP_BATCH
+#include <netinet/udp.h>
+#endif
+#if defined(SINK_UDP_TXTIME) || defined(SINK_UDP_RTCP) || defined(SINK_UDP_BATCH)
+#include <time.h>
+#endif
+#ifdef SINK_UDP_TXTIME
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
+#include <linux/rtnetlink.h>
+#endif
 
 #include "player.h"
 #include "mux.h"
 #include "jitter.h"
 #include "unix_server.h"
+#include "rtp.h"
+#ifdef SINK_UDP_RTCP
+#ifndef SINK_UDP_RTCPSTREAMS
+/// the media and the parity streams
+#define SINK_UDP_RTCPSTREAMS 4
+#endif
+/// the state of the sender report of one RTP stream
+typedef struct sink_rtcp_s sink_rtcp_t;
+struct sink_rtcp_s
+{
+	uint32_t ssrc;
+	uint32_t rtptimestamp;
+	/// wallclock of rtptimestamp in ns
+	uint64_t wallclock;
+	uint32_t packets;
+	uint32_t octets;
+	uint64_t report;
+};
+#endif
+
 typedef struct sink_s sink_t;
 typedef struct sink_ctx_s sink_ctx_t;
 struct sink_ctx_s
@@ -70,6 +101,34 @@ struct sink_ctx_s
 #ifdef UDP_DUMP
 	int dumpfd;
 #endif
+#ifdef SINK_UDP_BATCH
+	/// the ready buffers of the jitter are copied to be sent together
+	unsigned char *batch;
+	struct mmsghdr *msgs;
+	struct iovec *iovs;
+	int gso;
+	/// readable when the producer pushes a buffer
+	int gatherfd;
+#endif
+#if defined(SINK_UDP_TXTIME) || defined(SINK_UDP_RTCP)
+	int rtp;
+#endif
+#ifdef SINK_UDP_TXTIME
+	/// the kernel schedules the packets, otherwise the thread sleeps
+	int txtime;
+	/// departure time in ns of the packet with the timestamp txts
+	uint64_t txbase;
+	uint32_t txts;
+#ifdef SINK_UDP_BATCH
+	char *controls;
+#endif
+#endif
+#ifdef SINK_UDP_RTCP
+	/// the sender reports go to the port following the RTP port
+	struct sockaddr_in rtcpaddr;
+	/// each RTP stream of the sink has its own report
+	sink_rtcp_t rtcp[SINK_UDP_RTCPSTREAMS];
+#endif
 };
 #define SINK_CTX
 #include "sink.h"
@@ -88,6 +147,91 @@ struct sink_ctx_s
 #define SINK_POLICY REALTIME_SCHED
 #define SINK_PRIORITY 65
 
+#ifdef LOWLATENCY
+/// the muxer or the encoder writes one packet at a time
+#define NB_BUFFERS JITTER_MINCOUNT(size, size)
+#define THREDHOLD (NB_BUFFERS - 1)
+#else
+#define NB_BUFFERS 6
+#define THREDHOLD 3
+#endif
+
+#ifdef SINK_UDP_TXTIME
+/// the first packet leaves 2 ms after its arrival into the sink
+#define TXTIME_LEAD 2000000ULL
+/// the kernel refuses the packets too far in the future
+#define TXTIME_HORIZON 1000000000ULL
+#define TXTIME_CONTROLSIZE CMSG_SPACE(sizeof(uint64_t))
+
+/**
+ * @brief check the queue discipline of the interface.
+ * Only fq and etf send the packets at their departure time, the
+ * others accept SO_TXTIME and send the packets immediately.
+ *
+ * @return 1 if the interface uses fq or etf
+ */
+static int _sink_txqdisc(unsigned int ifindex)
+{
+	int nl = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+	if (nl < 0)
+		return 0;
+	struct
+	{
+		struct nlmsghdr nlh;
+		struct tcmsg tcm;
+	} req = {
+		.nlh = {
+			.nlmsg_len = NLMSG_LENGTH(sizeof(struct tcmsg)),
+			.nlmsg_type = RTM_GETQDISC,
+			.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP,
+		},
+		.tcm = {
+			.tcm_family = AF_UNSPEC,
+		},
+	};
+	int found = 0;
+	int done = (send(nl, &req, req.nlh.nlmsg_len, 0) < 0);
+	while (!done)
+	{
+		char buffer[8192];
+		int len = recv(nl, buffer, sizeof(buffer), 0);
+		if (len <= 0)
+			break;
+		struct nlmsghdr *nlh;
+		for (nlh = (struct nlmsghdr *)buffer; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len))
+		{
+			if (nlh->nlmsg_type == NLMSG_DONE || nlh->nlmsg_type == NLMSG_ERROR)
+			{
+				done = 1;
+				break;
+			}
+			struct tcmsg *tcm = NLMSG_DATA(nlh);
+			if (nlh->nlmsg_type != RTM_NEWQDISC || tcm->tcm_ifindex != ifindex)
+				continue;
+			/// the qdisc may be a child of mq, one per queue of the interface
+			int attrlen = nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*tcm));
+			struct rtattr *rta;
+			for (rta = TCA_RTA(tcm); RTA_OK(rta, attrlen); rta = RTA_NEXT(rta, attrlen))
+			{
+				if (rta->rta_type == TCA_KIND &&
+					(!strcmp(RTA_DATA(rta), "fq") || !strcmp(RTA_DATA(rta), "etf")))
+					found = 1;
+			}
+		}
+	}
+	close(nl);
+	return found;
+}
+#endif
+
+#ifdef SINK_UDP_RTCP
+/// RFC 3550 recommends 5 seconds between two reports
+#define RTCP_INTERVAL 5000000000ULL
+#endif
+
+/// the IPv4 header without option and the UDP header
+#define UDP_HEADERSLENGTH (20 + 8)
+
 static const char *jitter_name = "udp socket";
 static sink_ctx_t *sink_init(player_ctx_t *player, const char *url)
 {
@@ -148,6 +292,9 @@ static sink_ctx_t *sink_init(player_ctx_t *player, const char *url)
 	sink_ctx_t *ctx = NULL;
 	int sock;
 	int mtu;
+#ifdef SINK_UDP_TXTIME
+	unsigned int ifindex = 0;
+#endif
 
 	sock = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP);
 	//TODO: try IPPROTO_UDPLITE
@@ -191,6 +338,9 @@ static sink_ctx_t *sink_init(player_ctx_t *player, const char *url)
 		}
 		ret = ioctl(sock, SIOCGIFMTU, &ifr);
 		mtu = (ret == -1)?1500:ifr.ifr_mtu;
+#ifdef SINK_UDP_TXTIME
+		ifindex = if_nametoindex(ifr.ifr_name);
+#endif
 
 		int value=1;
 		setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &value, sizeof(value));
@@ -260,15 +410,62 @@ static sink_ctx_t *sink_init(player_ctx_t *player, const char *url)
 			i--; ctx->sink_txt[i++] = NULL;
 		}
 
-		unsigned int size = mtu;
-		jitter_t *jitter = jitter_scattergather_init(jitter_name, 6, size);
+		/// the datagram and the headers of IPv4 and UDP fit into the MTU
+		unsigned int size = mtu - UDP_HEADERSLENGTH;
+		jitter_t *jitter = jitter_scattergather_init(jitter_name, NB_BUFFERS, size);
 #ifdef USE_REALTIME
 		jitter->ops->lock(jitter->ctx);
 #endif
 		jitter->ctx->frequence = 0;
-		jitter->ctx->thredhold = 3;
+		jitter->ctx->thredhold = THREDHOLD;
 		jitter->format = format;
 		ctx->in = jitter;
+#ifdef SINK_UDP_BATCH
+		ctx->batch = malloc(jitter->ctx->count * jitter->ctx->size);
+		ctx->msgs = calloc(jitter->ctx->count, sizeof(*ctx->msgs));
+		ctx->iovs = calloc(jitter->ctx->count, sizeof(*ctx->iovs));
+		ctx->gatherfd = -1;
+		if (jitter->ops->fd != NULL && jitter->ops->level != NULL)
+			ctx->gatherfd = jitter->ops->fd(jitter->ctx);
+#ifdef UDP_SEGMENT
+		int gso = 0;
+		ctx->gso = (setsockopt(sock, SOL_UDP, UDP_SEGMENT, &gso, sizeof(gso)) == 0);
+#endif
+#endif
+#if defined(SINK_UDP_TXTIME) || defined(SINK_UDP_RTCP)
+		ctx->rtp = rtp;
+#endif
+#ifdef SINK_UDP_RTCP
+		memcpy(&ctx->rtcpaddr, &saddr, sizeof(saddr));
+		ctx->rtcpaddr.sin_port = htons(iport + RTCP_PORTOFFSET);
+#endif
+#ifdef SINK_UDP_TXTIME
+		/// etf reports the dropped packets into the error queue of the socket
+		struct sock_txtime txtime = {
+			.clockid = CLOCK_MONOTONIC,
+			.flags = SOF_TXTIME_REPORT_ERRORS,
+		};
+		if (rtp && _sink_txqdisc(ifindex))
+			ctx->txtime = (setsockopt(sock, SOL_SOCKET, SO_TXTIME, &txtime, sizeof(txtime)) == 0);
+		if (rtp && !ctx->txtime)
+			warn("sink: udp txtime not available, use software pacing");
+#ifdef SINK_UDP_BATCH
+		/**
+		 * the segmentation uses only one departure time for all the
+		 * packets of the batch, the paced RTP streams are sent with
+		 * sendmmsg and one departure time per packet. The
+		 * segmentation stays for the other protocols.
+		 */
+		if (rtp && ctx->gso)
+		{
+			warn("sink: udp segmentation disabled by the pacing");
+			ctx->gso = 0;
+		}
+#endif
+#ifdef SINK_UDP_BATCH
+		ctx->controls = calloc(jitter->ctx->count, TXTIME_CONTROLSIZE);
+#endif
+#endif
 #ifdef MUX
 		ctx->mux = mux_build(player, protocol);
 #endif
@@ -299,6 +496,396 @@ static jitter_t *sink_jitter(sink_ctx_t *ctx, int index)
 #endif
 }
 
+#ifdef SINK_UDP_TXTIME
+static uint64_t _sink_now(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static void _sink_sleep(uint64_t departure)
+{
+	struct timespec ts = {
+		.tv_sec = departure / 1000000000ULL,
+		.tv_nsec = departure % 1000000000ULL,
+	};
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+}
+
+/**
+ * @return the clock rate of the timestamps, set by the muxer on the jitter
+ */
+static uint64_t _sink_clockrate(sink_ctx_t *ctx)
+{
+	if (ctx->in->ctx->frequence > 0)
+		return ctx->in->ctx->frequence;
+	return DEFAULT_SAMPLERATE;
+}
+
+static uint64_t _sink_txtimestamp(sink_ctx_t *ctx, uint32_t timestamp, uint64_t clockrate)
+{
+	int32_t delta = timestamp - ctx->txts;
+	return ctx->txbase + (int64_t)delta * 1000000000LL / clockrate;
+}
+
+/**
+ * @brief compute the departure time of a RTP packet from its timestamp
+ *
+ * The first packet fixes the base. The base moves when the stream
+ * restarts (timestamp jump) or when the sink is late.
+ *
+ * @return the departure time on CLOCK_MONOTONIC in ns, or 0 without pacing
+ */
+static uint64_t _sink_departure(sink_ctx_t *ctx, const unsigned char *buff, size_t length)
+{
+	if (!ctx->rtp || length < sizeof(rtpheader_t))
+		return 0;
+	rtpheader_t header;
+	memcpy(&header, buff, sizeof(header));
+	uint32_t timestamp = ntohl(header.timestamp);
+	uint64_t clockrate = _sink_clockrate(ctx);
+
+	uint64_t now = _sink_now();
+	int32_t delta = timestamp - ctx->txts;
+	uint64_t departure = _sink_txtimestamp(ctx, timestamp, clockrate);
+	if (ctx->txbase == 0 || delta < 0 ||
+		departure + TXTIME_HORIZON < now ||
+		departure > now + 10 * TXTIME_HORIZON)
+	{
+		sink_dbg("sink: udp pacing restarts at %u", timestamp);
+		ctx->txbase = now + TXTIME_LEAD;
+		ctx->txts = timestamp;
+		departure = ctx->txbase;
+	}
+	/// the producer is too early, wait to stay into the kernel horizon
+	if (departure > now + TXTIME_HORIZON)
+		_sink_sleep(departure - TXTIME_HORIZON);
+	return departure;
+}
+
+/**
+ * @brief read the packets dropped by the qdisc.
+ * The kernel pacing stops after an error, the next packets are paced
+ * by the thread.
+ */
+static void _sink_txerrors(sink_ctx_t *ctx)
+{
+	if (!ctx->txtime)
+		return;
+	char control[CMSG_SPACE(sizeof(struct sock_extended_err) + sizeof(struct sockaddr_in))];
+	struct msghdr msg = {
+		.msg_control = control,
+		.msg_controllen = sizeof(control),
+	};
+	while (recvmsg(ctx->sock, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) >= 0)
+	{
+		struct cmsghdr *cmsg;
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+		{
+			struct sock_extended_err *ee = (struct sock_extended_err *)CMSG_DATA(cmsg);
+			if (cmsg->cmsg_level != SOL_IP || cmsg->cmsg_type != IP_RECVERR ||
+				ee->ee_origin != SO_EE_ORIGIN_TXTIME)
+				continue;
+			warn("sink: udp packet %s by the qdisc, use software pacing",
+				(ee->ee_code == SO_EE_CODE_TXTIME_MISSED)? "late" : "refused");
+			ctx->txtime = 0;
+		}
+		msg.msg_controllen = sizeof(control);
+	}
+}
+
+static void _sink_txtime(struct msghdr *msg, char *control, uint64_t departure)
+{
+	msg->msg_control = control;
+	msg->msg_controllen = TXTIME_CONTROLSIZE;
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_TXTIME;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(uint64_t));
+	memcpy(CMSG_DATA(cmsg), &departure, sizeof(departure));
+}
+#endif
+
+#ifdef SINK_UDP_RTCP
+/**
+ * @brief count the packet and send the sender report
+ * when the interval is elapsed
+ */
+static void _sink_rtcp(sink_ctx_t *ctx, const unsigned char *buff, size_t len)
+{
+	if (!ctx->rtp || len < sizeof(rtpheader_t))
+		return;
+	rtpheader_t header;
+	memcpy(&header, buff, sizeof(header));
+	/**
+	 * the stream uses the slot of its SSRC, otherwise the free slot
+	 * or the slot without report since the longest time.
+	 */
+	sink_rtcp_t *rtcp = NULL;
+	int i;
+	for (i = 0; i < SINK_UDP_RTCPSTREAMS; i++)
+	{
+		if (ctx->rtcp[i].packets > 0 && ctx->rtcp[i].ssrc == header.ssrc)
+		{
+			rtcp = &ctx->rtcp[i];
+			break;
+		}
+		if (rtcp == NULL || ctx->rtcp[i].packets == 0 ||
+			(rtcp->packets > 0 && ctx->rtcp[i].wallclock < rtcp->wallclock))
+			rtcp = &ctx->rtcp[i];
+	}
+	if (rtcp->packets == 0 || rtcp->ssrc != header.ssrc)
+	{
+		memset(rtcp, 0, sizeof(*rtcp));
+		rtcp->ssrc = header.ssrc;
+	}
+	rtcp->packets++;
+	rtcp->octets += len - sizeof(header);
+
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	uint64_t wallclock = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+	rtcp->rtptimestamp = ntohl(header.timestamp);
+	rtcp->wallclock = wallclock;
+	if (header.b.pt == RTP_FEC_PT)
+		return;
+#ifdef SINK_UDP_TXTIME
+	/// the packet leaves the host at its departure time
+	if (ctx->txbase != 0)
+	{
+		uint64_t departure = _sink_txtimestamp(ctx, rtcp->rtptimestamp, _sink_clockrate(ctx));
+		rtcp->wallclock = wallclock - _sink_now() + departure;
+	}
+#endif
+	if (wallclock - rtcp->report < RTCP_INTERVAL)
+		return;
+	rtcp->report = wallclock;
+
+	rtcpsr_t sr = {
+		.bits = 0x80,
+		.pt = RTCP_SR,
+		.length = htons(sizeof(sr) / sizeof(uint32_t) - 1),
+		.ssrc = rtcp->ssrc,
+		.ntpsec = htonl(rtcp->wallclock / 1000000000ULL + RTCP_NTPOFFSET),
+		.ntpfrac = htonl(((rtcp->wallclock % 1000000000ULL) << 32) / 1000000000ULL),
+		.timestamp = htonl(rtcp->rtptimestamp),
+		.packets = htonl(rtcp->packets),
+		.octets = htonl(rtcp->octets),
+	};
+	sink_dbg("sink: rtcp report %u of %u", rtcp->rtptimestamp, ntohl(rtcp->ssrc));
+	if (sendto(ctx->sock, &sr, sizeof(sr), MSG_NOSIGNAL | MSG_DONTWAIT,
+			(struct sockaddr *)&ctx->rtcpaddr, sizeof(ctx->rtcpaddr)) < 0)
+		warn("sink: rtcp send error %s", strerror(errno));
+}
+#endif
+
+static int _sink_sendto(sink_ctx_t *ctx, unsigned char *buff, size_t len)
+{
+#ifdef SINK_UDP_TXTIME
+	_sink_txerrors(ctx);
+	uint64_t departure = _sink_departure(ctx, buff, len);
+	if (departure && ctx->txtime)
+	{
+		char control[TXTIME_CONTROLSIZE] = {0};
+		struct iovec iov = {
+			.iov_base = buff,
+			.iov_len = len,
+		};
+		struct msghdr msg = {
+			.msg_name = &ctx->saddr,
+			.msg_namelen = sizeof(ctx->saddr),
+			.msg_iov = &iov,
+			.msg_iovlen = 1,
+		};
+		_sink_txtime(&msg, control, departure);
+		return sendmsg(ctx->sock, &msg, MSG_NOSIGNAL| MSG_DONTWAIT);
+	}
+	if (departure)
+		_sink_sleep(departure);
+#endif
+	return sendto(ctx->sock, buff, len, MSG_NOSIGNAL| MSG_DONTWAIT,
+			(struct sockaddr *)&ctx->saddr, sizeof(ctx->saddr));
+}
+
+#ifdef SINK_UDP_BATCH
+#ifndef SINK_UDP_GATHERMS
+/// less than TXTIME_LEAD, the first packet of the batch is not late
+#define SINK_UDP_GATHERMS 1
+#endif
+/**
+ * @brief wait the threshold of the jitter before to gather.
+ * With a heartbeat, the jitter releases the buffers at their time,
+ * the sink sends them as they come.
+ */
+static void _sink_gatherwait(sink_ctx_t *ctx)
+{
+	jitter_ctx_t *jctx = ctx->in->ctx;
+	if (ctx->gatherfd < 0 || jctx->heartbeat != NULL)
+		return;
+	size_t thredhold = ((jctx->thredhold > 1)? jctx->thredhold : 1) * jctx->size;
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while (ctx->in->ops->level(jctx) < thredhold)
+	{
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		int elapsed = (now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000;
+		if (elapsed >= SINK_UDP_GATHERMS)
+			break;
+		struct pollfd pfd = {.fd = ctx->gatherfd, .events = POLLIN};
+		if (poll(&pfd, 1, SINK_UDP_GATHERMS - elapsed) <= 0)
+			break;
+		uint64_t value;
+		if (read(ctx->gatherfd, &value, sizeof(value)) < 0)
+			sink_dbg("sink: udp gather error %s", strerror(errno));
+	}
+}
+
+/**
+ * @brief copy the ready buffers of the jitter into the batch
+ *
+ * @return the number of buffers, or 0 at the end of the stream
+ */
+static int _sink_gather(sink_ctx_t *ctx)
+{
+	int nbuffers = 0;
+	jitter_ctx_t *jctx = ctx->in->ctx;
+	_sink_gatherwait(ctx);
+	do
+	{
+		unsigned char *buff = ctx->in->ops->peer(jctx, NULL);
+		if (buff == NULL)
+			break;
+		size_t length = ctx->in->ops->length(jctx);
+		unsigned char *data = ctx->batch + nbuffers * jctx->size;
+		memcpy(data, buff, length);
+		ctx->in->ops->pop(jctx, length);
+		ctx->iovs[nbuffers].iov_base = data;
+		ctx->iovs[nbuffers].iov_len = length;
+		nbuffers++;
+	} while (nbuffers < jctx->count && !ctx->in->ops->empty(jctx));
+	return nbuffers;
+}
+
+#ifdef UDP_SEGMENT
+/**
+ * @brief send the batch with only one syscall, the kernel cuts
+ * the datagrams. All the packets except the last one must have the
+ * same size.
+ *
+ * @return the number of packets sent, or -1 on error
+ */
+static int _sink_sendgso(sink_ctx_t *ctx, int nbuffers)
+{
+	int i;
+	size_t segment = ctx->iovs[0].iov_len;
+	for (i = 1; i < nbuffers; i++)
+	{
+		if (ctx->iovs[i].iov_len > segment ||
+			(i < nbuffers - 1 && ctx->iovs[i].iov_len != segment))
+			return 0;
+	}
+
+	char control[CMSG_SPACE(sizeof(uint16_t))] = {0};
+	struct msghdr msg = {
+		.msg_name = &ctx->saddr,
+		.msg_namelen = sizeof(ctx->saddr),
+		.msg_iov = ctx->iovs,
+		.msg_iovlen = nbuffers,
+		.msg_control = control,
+		.msg_controllen = sizeof(control),
+	};
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_UDP;
+	cmsg->cmsg_type = UDP_SEGMENT;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+	*(uint16_t *)CMSG_DATA(cmsg) = segment;
+
+	int ret = sendmsg(ctx->sock, &msg, MSG_NOSIGNAL);
+	if (ret < 0 && (errno == EIO || errno == EINVAL || errno == EOPNOTSUPP))
+	{
+		warn("sink: udp segmentation not available");
+		ctx->gso = 0;
+		return 0;
+	}
+	if (ret < 0)
+		return -1;
+	return nbuffers;
+}
+#endif
+
+/**
+ * @brief send the batch with sendmmsg
+ *
+ * @return 0 or -1 on error
+ */
+static int _sink_sendbatch(sink_ctx_t *ctx, int nbuffers)
+{
+	int sent = 0;
+	int i;
+#ifdef SINK_UDP_TXTIME
+	_sink_txerrors(ctx);
+	if (ctx->rtp && !ctx->txtime)
+	{
+		/// software pacing: each packet waits its departure time
+		for (i = 0; i < nbuffers; i++)
+		{
+			int ret;
+			while ((ret = _sink_sendto(ctx, ctx->iovs[i].iov_base, ctx->iovs[i].iov_len)) < 0 &&
+					(errno == EAGAIN || errno == EINTR))
+			{
+				struct pollfd pfd = {.fd = ctx->sock, .events = POLLOUT};
+				poll(&pfd, 1, -1);
+			}
+			if (ret < 0)
+				return -1;
+		}
+		sent = nbuffers;
+	}
+#endif
+#ifdef UDP_SEGMENT
+	if (ctx->gso && nbuffers > 1)
+		sent = _sink_sendgso(ctx, nbuffers);
+	if (sent < 0)
+		return -1;
+#endif
+	for (i = sent; i < nbuffers; i++)
+	{
+		ctx->msgs[i].msg_hdr.msg_name = &ctx->saddr;
+		ctx->msgs[i].msg_hdr.msg_namelen = sizeof(ctx->saddr);
+		ctx->msgs[i].msg_hdr.msg_iov = &ctx->iovs[i];
+		ctx->msgs[i].msg_hdr.msg_iovlen = 1;
+#ifdef SINK_UDP_TXTIME
+		uint64_t departure = _sink_departure(ctx, ctx->iovs[i].iov_base, ctx->iovs[i].iov_len);
+		if (departure)
+			_sink_txtime(&ctx->msgs[i].msg_hdr,
+				ctx->controls + i * TXTIME_CONTROLSIZE, departure);
+#endif
+	}
+	while (sent < nbuffers)
+	{
+		/// the socket is blocking, sendmmsg waits the space into the socket buffer
+		int ret = sendmmsg(ctx->sock, &ctx->msgs[sent], nbuffers - sent, MSG_NOSIGNAL);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0)
+			return -1;
+		sent += ret;
+	}
+#ifdef UDP_DUMP
+	for (i = 0; i < nbuffers; i++)
+		write(ctx->dumpfd, ctx->iovs[i].iov_base, ctx->iovs[i].iov_len);
+#endif
+#ifdef SINK_UDP_RTCP
+	for (i = 0; i < nbuffers; i++)
+		_sink_rtcp(ctx, ctx->iovs[i].iov_base, ctx->iovs[i].iov_len);
+#endif
+	ctx->counter += nbuffers;
+	return 0;
+}
+#endif
+
 static void *sink_thread(void *arg)
 {
 	sink_ctx_t *ctx = (sink_ctx_t *)arg;
@@ -319,6 +906,24 @@ static void *sink_thread(void *arg)
 #endif
 #ifdef UDP_MARKER
 	warn("sink: udp marker is ON");
+#endif
+#ifdef SINK_UDP_BATCH
+	while (run)
+	{
+		int nbuffers = _sink_gather(ctx);
+		if (nbuffers == 0)
+		{
+			run = 0;
+			break;
+		}
+		sink_dbg("sink: udp send %d buffers", nbuffers);
+		if (_sink_sendbatch(ctx, nbuffers) < 0)
+		{
+			err("sink: udp send error %s", strerror(errno));
+			close(ctx->sock);
+			run = 0;
+		}
+	}
 #endif
 	while (run)
 	{
@@ -349,8 +954,7 @@ static void *sink_thread(void *arg)
 			ret = select(maxfd + 1, NULL, &wfds, NULL, NULL);
 			if (ret > 0 && FD_ISSET(ctx->sock, &wfds))
 			{
-				ret = sendto(ctx->sock, buff, len, MSG_NOSIGNAL| MSG_DONTWAIT,
-						(struct sockaddr *)&ctx->saddr, sizeof(ctx->saddr));
+				ret = _sink_sendto(ctx, buff, len);
 				sink_dbg("udp: send %d", ret);
 			}
 			if (ret < 0)
@@ -375,6 +979,9 @@ static void *sink_thread(void *arg)
 		if (len == 0)
 		{
 			sink_dbg("sink: udp play %d", ret);
+#ifdef SINK_UDP_RTCP
+			_sink_rtcp(ctx, buff - length, length);
+#endif
 			ctx->counter++;
 		}
 
@@ -445,6 +1052,14 @@ static void sink_destroy(sink_ctx_t *ctx)
 	if (ctx->thread)
 		pthread_join(ctx->thread, NULL);
 	jitter_scattergather_destroy(ctx->in);
+#ifdef SINK_UDP_BATCH
+	free(ctx->batch);
+	free(ctx->msgs);
+	free(ctx->iovs);
+#endif
+#if defined(SINK_UDP_TXTIME) && defined(SINK_UDP_BATCH)
+	free(ctx->controls);
+#endif
 	int i = 0;
 	while (ctx->sink_txt[i] != NULL)
 		free(ctx->sink_txt[i++]);
@@ -457,6 +1072,8 @@ static void sink_destroy(sink_ctx_t *ctx)
 
 const sink_ops_t *sink_udp = &(sink_ops_t)
 {
+	.name = "udp",
+	.protocol = "udp://|rtp://",
 	.init = sink_init,
 	.jitter = sink_jitter,
 	.attach = sink_attach,
@@ -90,6 +90,15 @@ struct sink_ctx_s
 #define SINK_PRIORITY 65
 #endif
 
+#ifdef LOWLATENCY
+/// the muxer or the encoder writes one packet at a time
+#define NB_BUFFERS JITTER_MINCOUNT(size, size)
+#define THREDHOLD (NB_BUFFERS - 1)
+#else
+#define NB_BUFFERS 6
+#define THREDHOLD 2
+#endif
+
 static const char *jitter_name = "unix socket";
 static sink_ctx_t *sink_init(player_ctx_t *player, const char *url)
 {
@@ -127,9 +136,9 @@ static sink_ctx_t *sink_init(player_ctx_t *player, const char *url)
 	ctx->filepath = path;
 
 	unsigned int size;
-	jitter_t *jitter = jitter_scattergather_init(jitter_name, 6, size);
+	jitter_t *jitter = jitter_scattergather_init(jitter_name, NB_BUFFERS, size);
 	jitter->ctx->frequence = 0;
-	jitter->ctx->thredhold = 2;
+	jitter->ctx->thredhold = THREDHOLD;
 	jitter->format = format;
 	ctx->in = jitter;
 
@@ -413,6 +422,8 @@ static void sink_destroy(sink_ctx_t *ctx)
 
 const sink_ops_t *sink_unix = &(sink_ops_t)
 {
+	.name = "unix",
+	.protocol = "unix://",
 	.init = sink_init,
 	.jitter = sink_jitter,
 	.attach = sink_attach,
@@ -39,10 +39,29 @@
 #include <sys/ioctl.h>
 #include <fcntl.h>
 #include <pwd.h>
+#if defined(SRC_UDP_MMSG) || defined(SRC_UDP_PACKETMMAP)
+#include <poll.h>
+#include <time.h>
+#endif
+#ifdef SRC_UDP_PACKETMMAP
+#include <sys/mman.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <stddef.h>
+#include <linux/filter.h>
+#include <ifaddrs.h>
+#endif
 
 #include "player.h"
 #include "jitter.h"
 #include "event.h"
+#if defined(DEMUX_RTP_SYNC) && defined(DEMUX_PASSTHROUGH)
+/// the sender reports are read beside the RTP stream
+#define SRC_UDP_RTCP
+#include "rtp.h"
+#endif
 typedef struct src_ops_s src_ops_t;
 typedef struct src_ctx_s src_ctx_t;
 typedef struct src_s demux_t;
@@ -50,6 +69,9 @@ struct src_ctx_s
 {
 	player_ctx_t *player;
 	int sock;
+#ifdef SRC_UDP_RTCP
+	int rtcpsock;
+#endif
 	state_t state;
 	pthread_t thread;
 	jitter_t *out;
@@ -70,6 +92,23 @@ struct src_ctx_s
 #ifdef UDP_DUMP
 	int dumpfd;
 #endif
+#ifdef SRC_UDP_MMSG
+	/// the datagrams are received together and copied into the jitter
+	unsigned char *batch;
+	struct mmsghdr *msgs;
+	struct iovec *iovs;
+	char *controls;
+#endif
+#if defined(SRC_UDP_MMSG) || defined(SRC_UDP_PACKETMMAP)
+	/// monotonic arrival time in ns of the buffers of the jitter
+	uint64_t *arrivals;
+	unsigned int narrivals;
+#endif
+#ifdef SRC_UDP_PACKETMMAP
+	/// the shared ring receives the stream instead of the socket
+	struct src_ring_s *ring;
+	src_ctx_t *ringnext;
+#endif
 };
 #define SRC_CTX
 #include "src.h"
@@ -100,6 +139,10 @@ struct src_ctx_s
  */
 static const char *jitter_name = "udp socket";
 
+#ifdef SRC_UDP_MMSG
+#define MMSG_CONTROLSIZE CMSG_SPACE(sizeof(struct timespec))
+#endif
+
 static int src_connect(src_ctx_t *ctx, const char *host, int iport)
 {
 	int count = 2;
@@ -152,6 +195,11 @@ static int src_connect(src_ctx_t *ctx, const char *host, int iport)
 	{
 		int value=1;
 		ret = setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &value, sizeof(value));
+#ifdef SRC_UDP_MMSG
+		/// the kernel stamps the datagrams on their arrival
+		if (ret == 0 && setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS, &value, sizeof(value)) < 0)
+			warn("src: udp timestamping not available");
+#endif
 	}
 	else
 	{
@@ -256,6 +304,12 @@ static src_ctx_t *src_init(player_ctx_t *player, const char *url, const char *mi
 	}
 	if (host != NULL)
 	{
+#ifdef SRC_UDP_RTCP
+		/// the RTCP socket is opened first, ctx->addr stays on the RTP port
+		ctx->rtcpsock = -1;
+		if (demux->ops == demux_rtp)
+			ctx->rtcpsock = src_connect(ctx, host, iport + RTCP_PORTOFFSET);
+#endif
 		int sock = src_connect(ctx, host, iport);
 		ctx->sock = sock;
 		ctx->host = strdup(host);
@@ -274,6 +328,31 @@ static src_ctx_t *src_init(player_ctx_t *player, const char *url, const char *mi
 	return ctx;
 }
 
+#ifdef SRC_UDP_RTCP
+/**
+ * @brief read a sender report and send it to the demux
+ */
+static void _src_report(src_ctx_t *ctx, const unsigned char *buff, int len)
+{
+	rtcpsr_t sr;
+	/// the end of a compound packet is dropped
+	if (len < (int)sizeof(sr))
+		return;
+	memcpy(&sr, buff, sizeof(sr));
+	/// version 2 without padding, and one sender report
+	if ((sr.bits & 0xC0) != 0x80 || sr.pt != RTCP_SR)
+		return;
+	demux_rtp_report((struct demux_ctx_s *)ctx->demux->ctx, &sr);
+}
+
+static void _src_rtcp(src_ctx_t *ctx)
+{
+	unsigned char buff[sizeof(rtcpsr_t)];
+	int ret = recv(ctx->rtcpsock, buff, sizeof(buff), 0);
+	_src_report(ctx, buff, ret);
+}
+#endif
+
 static int src_read(src_ctx_t *ctx, unsigned char *buff, int len)
 {
 	int ret;
@@ -281,12 +360,26 @@ static int src_read(src_ctx_t *ctx, unsigned char *buff, int len)
 	int maxfd = ctx->sock;
 	FD_ZERO(&rfds);
 	FD_SET(ctx->sock, &rfds);
+#ifdef SRC_UDP_RTCP
+	if (ctx->rtcpsock > 0)
+	{
+		FD_SET(ctx->rtcpsock, &rfds);
+		if (ctx->rtcpsock > maxfd)
+			maxfd = ctx->rtcpsock;
+	}
+#endif
 	ret = select(maxfd + 1, &rfds, NULL, NULL, NULL);
-	if (ret != 1)
+	if (ret < 1)
 	{
 		err("udp select %d %s", ret, strerror(errno));
 		return -1;
 	}
+#ifdef SRC_UDP_RTCP
+	if (ctx->rtcpsock > 0 && FD_ISSET(ctx->rtcpsock, &rfds))
+		_src_rtcp(ctx);
+	if (!FD_ISSET(ctx->sock, &rfds))
+		return src_read(ctx, buff, len);
+#endif
 	int length;
 	ret = ioctl(ctx->sock, FIONREAD, &length);
 	if (length > ctx->out->ctx->size)
@@ -332,6 +425,529 @@ static int src_read(src_ctx_t *ctx, unsigned char *buff, int len)
 	return ret;
 }
 
+#if defined(SRC_UDP_MMSG) || defined(SRC_UDP_PACKETMMAP)
+static uint64_t _src_clock(clockid_t clockid)
+{
+	struct timespec now;
+	clock_gettime(clockid, &now);
+	return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+#endif
+
+#ifdef SRC_UDP_MMSG
+
+/**
+ * @brief the arrival time of the datagram on the monotonic clock
+ *
+ * @return the time in ns or 0 without timestamp from the kernel
+ */
+static uint64_t _src_arrival(struct msghdr *msg, int64_t offset)
+{
+	struct cmsghdr *cmsg;
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg))
+	{
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS)
+		{
+			struct timespec ts;
+			memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+			return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec + offset;
+		}
+	}
+	return 0;
+}
+
+/**
+ * @brief receive the waiting datagrams with only one syscall and
+ * push them into the jitter. The beat of each buffer is its arrival time.
+ *
+ * @return the number of datagrams, or -1 on error
+ */
+static int _src_readbatch(src_ctx_t *ctx)
+{
+	jitter_ctx_t *jctx = ctx->out->ctx;
+	int i;
+#ifdef SRC_UDP_RTCP
+	if (ctx->rtcpsock > 0)
+	{
+		struct pollfd pfds[2] = {
+			{ .fd = ctx->sock, .events = POLLIN },
+			{ .fd = ctx->rtcpsock, .events = POLLIN },
+		};
+		if (poll(pfds, 2, -1) < 0)
+		{
+			if (errno == EINTR)
+				return 0;
+			err("udp poll %s", strerror(errno));
+			return -1;
+		}
+		if (pfds[1].revents & POLLIN)
+			_src_rtcp(ctx);
+		if (!(pfds[0].revents & POLLIN))
+			return 0;
+	}
+#endif
+	for (i = 0; i < jctx->count; i++)
+	{
+		ctx->iovs[i].iov_base = ctx->batch + i * jctx->size;
+		ctx->iovs[i].iov_len = jctx->size;
+		ctx->msgs[i].msg_hdr.msg_iov = &ctx->iovs[i];
+		ctx->msgs[i].msg_hdr.msg_iovlen = 1;
+		ctx->msgs[i].msg_hdr.msg_control = ctx->controls + i * MMSG_CONTROLSIZE;
+		ctx->msgs[i].msg_hdr.msg_controllen = MMSG_CONTROLSIZE;
+	}
+	/// the call blocks only until the first datagram
+	int nmsgs = recvmmsg(ctx->sock, ctx->msgs, jctx->count, MSG_WAITFORONE, NULL);
+	if (nmsgs < 0 && errno == EINTR)
+		return 0;
+	if (nmsgs < 0)
+	{
+		err("src: udp reception error %s", strerror(errno));
+		return -1;
+	}
+	/// the kernel stamps on the realtime clock
+	int64_t offset = _src_clock(CLOCK_MONOTONIC) - _src_clock(CLOCK_REALTIME);
+	for (i = 0; i < nmsgs; i++)
+	{
+		size_t len = ctx->msgs[i].msg_len;
+		if (len == 0)
+		{
+			warn("src: udp end of stream");
+			return -1;
+		}
+#ifdef UDP_MARKER
+		if (len == 4)
+			continue;
+#endif
+		unsigned char *buff = ctx->out->ops->pull(jctx);
+		if (buff == NULL)
+			return -1;
+		/**
+		 * the jitter holds at most count buffers, the slot of the
+		 * arrival is free only when the pull returns a buffer.
+		 */
+		uint64_t *arrival = &ctx->arrivals[ctx->narrivals++ % jctx->count];
+		*arrival = _src_arrival(&ctx->msgs[i].msg_hdr, offset);
+		if (*arrival == 0)
+			*arrival = _src_clock(CLOCK_MONOTONIC);
+		memcpy(buff, ctx->iovs[i].iov_base, len);
+#ifdef UDP_DUMP
+		if (ctx->dumpfd > 0)
+			write(ctx->dumpfd, buff, len);
+#endif
+		ctx->out->ops->push(jctx, len, arrival);
+	}
+	return nmsgs;
+}
+#endif
+
+#ifdef SRC_UDP_PACKETMMAP
+/**
+ * SRC_UDP_PACKETMMAP: all the IPv4 streams of the process are received
+ * by one packet socket on every interfaces, with a TPACKET_V3 ring
+ * shared with the kernel. The UDP sockets stay open only to join the
+ * multicast groups.
+ * It needs CAP_NET_RAW, otherwise the streams use their socket.
+ * The test runs into a network namespace:
+ *   ip netns add putv; ip link add veth0 type veth peer name veth1
+ *   ip link set veth1 netns putv
+ * and the sender on veth0 with a multicast route.
+ */
+#ifndef SRC_UDP_RINGBLOCKS
+#define SRC_UDP_RINGBLOCKS 64
+#endif
+#define RING_BLOCKSIZE (1 << 16)
+#define RING_FRAMESIZE 2048
+/// ms before the kernel releases a block not full
+#define RING_RETIRE 4
+/// ms to check the end of the thread
+#define RING_POLLTIMEOUT 100
+#define RING_NBSTREAMS 64
+
+typedef struct src_ring_s src_ring_t;
+struct src_ring_s
+{
+	int sock;
+	unsigned char *map;
+	size_t mapsize;
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	/// the streams indexed by destination port
+	src_ctx_t *streams[RING_NBSTREAMS];
+	int nbstreams;
+	/// the interface of the multicast groups, 0 for every interfaces
+	unsigned int ifindex;
+	int run;
+};
+static src_ring_t *g_ring = NULL;
+static pthread_mutex_t g_ringmutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief the stream of the destination, a multicast stream
+ * checks the group too.
+ */
+static src_ctx_t *_src_ringfind(src_ring_t *ring, in_addr_t daddr, int port)
+{
+	src_ctx_t *ctx = ring->streams[port % RING_NBSTREAMS];
+	while (ctx != NULL)
+	{
+		if (ctx->port == port &&
+			(!IN_MULTICAST(ntohl(ctx->saddr.sin_addr.s_addr)) ||
+			ctx->saddr.sin_addr.s_addr == daddr))
+			break;
+		ctx = ctx->ringnext;
+	}
+	return ctx;
+}
+
+static void _src_ringpacket(src_ring_t *ring, struct tpacket3_hdr *pkt, int64_t offset)
+{
+	struct sockaddr_ll *sll = (struct sockaddr_ll *)((unsigned char *)pkt + TPACKET_ALIGN(sizeof(*pkt)));
+	/// the packets of the sender on the same host are received on the loopback
+	if (sll->sll_pkttype == PACKET_OUTGOING)
+		return;
+	unsigned char *data = (unsigned char *)pkt + pkt->tp_net;
+	size_t snaplen = pkt->tp_snaplen;
+	struct iphdr *ip = (struct iphdr *)data;
+	if (snaplen < sizeof(*ip) || ip->version != 4 || ip->protocol != IPPROTO_UDP)
+		return;
+	/// the fragmented datagrams are dropped, the socket path must be used
+	if (ntohs(ip->frag_off) & (IP_MF | IP_OFFMASK))
+		return;
+	size_t iphl = ip->ihl * 4;
+	struct udphdr *udp = (struct udphdr *)(data + iphl);
+	if (snaplen < iphl + sizeof(*udp))
+		return;
+	size_t len = ntohs(udp->len) - sizeof(*udp);
+	if (ntohs(udp->len) < sizeof(*udp) || len > snaplen - iphl - sizeof(*udp))
+		return;
+	unsigned char *payload = (unsigned char *)(udp + 1);
+	int port = ntohs(udp->dest);
+
+	pthread_mutex_lock(&ring->mutex);
+	src_ctx_t *ctx = _src_ringfind(ring, ip->daddr, port);
+#ifdef SRC_UDP_RTCP
+	if (ctx == NULL)
+	{
+		ctx = _src_ringfind(ring, ip->daddr, port - RTCP_PORTOFFSET);
+		if (ctx != NULL && ctx->rtcpsock > 0)
+			_src_report(ctx, payload, len);
+		ctx = NULL;
+	}
+#endif
+	if (ctx == NULL || len == 0)
+		goto end;
+#ifdef UDP_MARKER
+	if (len == 4)
+		goto end;
+#endif
+	jitter_t *out = ctx->out;
+	jitter_ctx_t *jctx = out->ctx;
+	if (len > jctx->size)
+	{
+		warn("src: udp datagram %ld > %ld", len, jctx->size);
+		goto end;
+	}
+	/// a full jitter must not block the other streams, the packet is lost
+	if (out->ops->level != NULL && out->ops->level(jctx) >= jctx->count * jctx->size)
+	{
+		src_dbg("src: udp %d overrun", port);
+		goto end;
+	}
+	unsigned char *buff = out->ops->pull(jctx);
+	if (buff == NULL)
+		goto end;
+	/// the slot of the arrival is free only when the pull returns a buffer
+	uint64_t *arrival = &ctx->arrivals[ctx->narrivals++ % jctx->count];
+	*arrival = (uint64_t)pkt->tp_sec * 1000000000ULL + pkt->tp_nsec + offset;
+	memcpy(buff, payload, len);
+#ifdef UDP_DUMP
+	if (ctx->dumpfd > 0)
+		write(ctx->dumpfd, buff, len);
+#endif
+	out->ops->push(jctx, len, arrival);
+end:
+	pthread_mutex_unlock(&ring->mutex);
+}
+
+static void *_src_ringthread(void *arg)
+{
+	src_ring_t *ring = (src_ring_t *)arg;
+	unsigned int nblocks = SRC_UDP_RINGBLOCKS;
+	unsigned int block = 0;
+
+	while (ring->run)
+	{
+		struct tpacket_block_desc *desc = (struct tpacket_block_desc *)(ring->map + block * RING_BLOCKSIZE);
+		if (!(desc->hdr.bh1.block_status & TP_STATUS_USER))
+		{
+			struct pollfd pfd = { .fd = ring->sock, .events = POLLIN | POLLERR };
+			poll(&pfd, 1, RING_POLLTIMEOUT);
+			continue;
+		}
+		/// the kernel stamps on the realtime clock
+		int64_t offset = _src_clock(CLOCK_MONOTONIC) - _src_clock(CLOCK_REALTIME);
+		struct tpacket3_hdr *pkt = (struct tpacket3_hdr *)((unsigned char *)desc + desc->hdr.bh1.offset_to_first_pkt);
+		int i;
+		for (i = 0; i < desc->hdr.bh1.num_pkts; i++)
+		{
+			_src_ringpacket(ring, pkt, offset);
+			pkt = (struct tpacket3_hdr *)((unsigned char *)pkt + pkt->tp_next_offset);
+		}
+		/// the block returns to the kernel
+		__sync_synchronize();
+		desc->hdr.bh1.block_status = TP_STATUS_KERNEL;
+		block = (block + 1) % nblocks;
+	}
+	return NULL;
+}
+
+/**
+ * @brief the interface used by the kernel to receive the group
+ *
+ * @return the index of the interface, 0 for a unicast address
+ */
+static unsigned int _src_ringifindex(struct sockaddr_in *saddr)
+{
+	if (!IN_MULTICAST(ntohl(saddr->sin_addr.s_addr)))
+		return 0;
+	/// the route of the group gives the local address of the interface
+	int sock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	struct sockaddr_in local = {0};
+	socklen_t locallen = sizeof(local);
+	if (sock < 0)
+		return 0;
+	if (connect(sock, (struct sockaddr *)saddr, sizeof(*saddr)) < 0 ||
+		getsockname(sock, (struct sockaddr *)&local, &locallen) < 0)
+	{
+		close(sock);
+		return 0;
+	}
+	close(sock);
+	unsigned int ifindex = 0;
+	struct ifaddrs *ifa_list;
+	struct ifaddrs *ifa;
+	if (getifaddrs(&ifa_list) != 0)
+		return 0;
+	for (ifa = ifa_list; ifa != NULL && ifindex == 0; ifa = ifa->ifa_next)
+	{
+		if (ifa->ifa_addr != NULL && ifa->ifa_addr->sa_family == AF_INET &&
+			((struct sockaddr_in *)ifa->ifa_addr)->sin_addr.s_addr == local.sin_addr.s_addr)
+			ifindex = if_nametoindex(ifa->ifa_name);
+	}
+	freeifaddrs(ifa_list);
+	return ifindex;
+}
+
+/**
+ * @brief the kernel copies into the ring only the datagrams of the
+ * streams: UDP not fragmented, to the port of a stream or its RTCP
+ * port, and to the group of the multicast streams.
+ * The filter is rebuilt when a stream is added or removed.
+ */
+static void _src_ringfilter(src_ring_t *ring)
+{
+	/// 7 instructions of header, 5 per destination, 2 destinations per stream
+	struct sock_filter code[7 + RING_NBSTREAMS * 2 * 5 + 1];
+	int n = 0;
+	code[n++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_B | BPF_ABS, offsetof(struct iphdr, protocol));
+	code[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, 1, 0);
+	code[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0);
+	code[n++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_H | BPF_ABS, offsetof(struct iphdr, frag_off));
+	code[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, IP_MF | IP_OFFMASK, 0, 1);
+	code[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0);
+	/// X is the length of the IP header
+	code[n++] = (struct sock_filter)BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 0);
+	/// without room for every streams, the filter keeps all the UDP datagrams
+	uint32_t ret = 0;
+	int i;
+	for (i = 0; i < RING_NBSTREAMS && ret == 0; i++)
+	{
+		src_ctx_t *ctx;
+		for (ctx = ring->streams[i]; ctx != NULL && ret == 0; ctx = ctx->ringnext)
+		{
+			int multicast = IN_MULTICAST(ntohl(ctx->saddr.sin_addr.s_addr));
+			int ports[2] = {ctx->port};
+			int nports = 1;
+#ifdef SRC_UDP_RTCP
+			if (ctx->rtcpsock > 0)
+				ports[nports++] = ctx->port + RTCP_PORTOFFSET;
+#endif
+			int j;
+			for (j = 0; j < nports; j++)
+			{
+				if (n + 5 + 1 > sizeof(code) / sizeof(code[0]))
+				{
+					n = 7;
+					ret = RING_FRAMESIZE;
+					break;
+				}
+				code[n++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_H | BPF_IND, offsetof(struct udphdr, dest));
+				code[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ports[j], 0, multicast? 3 : 1);
+				if (multicast)
+				{
+					code[n++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct iphdr, daddr));
+					code[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ntohl(ctx->saddr.sin_addr.s_addr), 0, 1);
+				}
+				code[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, RING_FRAMESIZE);
+			}
+		}
+	}
+	code[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, ret);
+	struct sock_fprog prog = {
+		.len = n,
+		.filter = code,
+	};
+	if (setsockopt(ring->sock, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) < 0)
+		warn("src: packet ring filter %s", strerror(errno));
+}
+
+static src_ring_t *_src_ringinit(unsigned int ifindex)
+{
+	int sock = socket(AF_PACKET, SOCK_DGRAM, htons(ETH_P_IP));
+	if (sock < 0)
+	{
+		warn("src: packet ring not available %s", strerror(errno));
+		return NULL;
+	}
+	int version = TPACKET_V3;
+	if (setsockopt(sock, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0)
+	{
+		err("src: packet ring version %s", strerror(errno));
+		goto err;
+	}
+	struct tpacket_req3 req = {
+		.tp_block_size = RING_BLOCKSIZE,
+		.tp_block_nr = SRC_UDP_RINGBLOCKS,
+		.tp_frame_size = RING_FRAMESIZE,
+		.tp_frame_nr = (RING_BLOCKSIZE / RING_FRAMESIZE) * SRC_UDP_RINGBLOCKS,
+		.tp_retire_blk_tov = RING_RETIRE,
+	};
+	if (setsockopt(sock, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0)
+	{
+		err("src: packet ring allocation %s", strerror(errno));
+		goto err;
+	}
+	size_t mapsize = (size_t)RING_BLOCKSIZE * SRC_UDP_RINGBLOCKS;
+	unsigned char *map = mmap(NULL, mapsize, PROT_READ | PROT_WRITE, MAP_SHARED, sock, 0);
+	if (map == MAP_FAILED)
+	{
+		err("src: packet ring mapping %s", strerror(errno));
+		goto err;
+	}
+	/// the interface of the groups, the streams are selected by their destination
+	struct sockaddr_ll sll = {
+		.sll_family = AF_PACKET,
+		.sll_protocol = htons(ETH_P_IP),
+		.sll_ifindex = ifindex,
+	};
+	if (bind(sock, (struct sockaddr *)&sll, sizeof(sll)) < 0)
+	{
+		err("src: packet ring bind %s", strerror(errno));
+		munmap(map, mapsize);
+		goto err;
+	}
+
+	src_ring_t *ring = calloc(1, sizeof(*ring));
+	ring->sock = sock;
+	ring->map = map;
+	ring->mapsize = mapsize;
+	ring->ifindex = ifindex;
+	pthread_mutex_init(&ring->mutex, NULL);
+	/// nothing is copied before the first stream
+	_src_ringfilter(ring);
+	ring->run = 1;
+#ifdef USE_REALTIME
+	/// the ring thread replaces the threads of the streams
+	pthread_attr_t attr;
+	struct sched_param params = {
+		.sched_priority = SRC_PRIORITY,
+	};
+	pthread_attr_init(&attr);
+	pthread_attr_setschedpolicy(&attr, SRC_POLICY);
+	pthread_attr_setschedparam(&attr, &params);
+	pthread_attr_setinheritsched(&attr, (getuid() == 0)? PTHREAD_EXPLICIT_SCHED : PTHREAD_INHERIT_SCHED);
+	pthread_create(&ring->thread, &attr, _src_ringthread, ring);
+	pthread_attr_destroy(&attr);
+#else
+	pthread_create(&ring->thread, NULL, _src_ringthread, ring);
+#endif
+	dbg("src: packet ring %d blocks", SRC_UDP_RINGBLOCKS);
+	return ring;
+err:
+	close(sock);
+	return NULL;
+}
+
+static void _src_ringdestroy(src_ring_t *ring)
+{
+	ring->run = 0;
+	pthread_join(ring->thread, NULL);
+	munmap(ring->map, ring->mapsize);
+	close(ring->sock);
+	pthread_mutex_destroy(&ring->mutex);
+	free(ring);
+}
+
+/**
+ * @brief add the stream to the shared ring, the ring is created
+ * with the first stream.
+ *
+ * @return 0 or -1 if the socket has to be used
+ */
+static int _src_ringadd(src_ctx_t *ctx)
+{
+	unsigned int ifindex = _src_ringifindex(&ctx->saddr);
+	pthread_mutex_lock(&g_ringmutex);
+	if (g_ring == NULL)
+		g_ring = _src_ringinit(ifindex);
+	src_ring_t *ring = g_ring;
+	/// the ring receives only the interface of its first stream
+	if (ring == NULL || (ring->ifindex != 0 && ring->ifindex != ifindex))
+	{
+		pthread_mutex_unlock(&g_ringmutex);
+		return -1;
+	}
+	ctx->arrivals = calloc(ctx->out->ctx->count, sizeof(*ctx->arrivals));
+	/// the socket keeps the membership of the group, its data are useless
+	int value = 0;
+	setsockopt(ctx->sock, SOL_SOCKET, SO_RCVBUF, &value, sizeof(value));
+
+	pthread_mutex_lock(&ring->mutex);
+	ctx->ring = ring;
+	ctx->ringnext = ring->streams[ctx->port % RING_NBSTREAMS];
+	ring->streams[ctx->port % RING_NBSTREAMS] = ctx;
+	ring->nbstreams++;
+	_src_ringfilter(ring);
+	pthread_mutex_unlock(&ring->mutex);
+	pthread_mutex_unlock(&g_ringmutex);
+	return 0;
+}
+
+static void _src_ringremove(src_ctx_t *ctx)
+{
+	src_ring_t *ring = ctx->ring;
+	/// the flush unblocks the ring thread on the jitter of the stream
+	ctx->out->ops->flush(ctx->out->ctx);
+	pthread_mutex_lock(&g_ringmutex);
+	pthread_mutex_lock(&ring->mutex);
+	src_ctx_t **it = &ring->streams[ctx->port % RING_NBSTREAMS];
+	while (*it != NULL && *it != ctx)
+		it = &(*it)->ringnext;
+	if (*it != NULL)
+		*it = ctx->ringnext;
+	ring->nbstreams--;
+	_src_ringfilter(ring);
+	pthread_mutex_unlock(&ring->mutex);
+	ctx->ring = NULL;
+	if (ring->nbstreams == 0)
+	{
+		_src_ringdestroy(ring);
+		g_ring = NULL;
+	}
+	pthread_mutex_unlock(&g_ringmutex);
+}
+#endif
+
 static void *src_thread(void *arg)
 {
 	src_ctx_t *ctx = (src_ctx_t *)arg;
@@ -349,6 +965,19 @@ static void *src_thread(void *arg)
 #endif
 #ifdef UDP_MARKER
 	warn("src: udp marker is ON");
+#endif
+#ifdef SRC_UDP_MMSG
+	jitter_ctx_t *jctx = ctx->out->ctx;
+	ctx->batch = malloc(jctx->count * jctx->size);
+	ctx->msgs = calloc(jctx->count, sizeof(*ctx->msgs));
+	ctx->iovs = calloc(jctx->count, sizeof(*ctx->iovs));
+	ctx->controls = calloc(jctx->count, MMSG_CONTROLSIZE);
+	ctx->arrivals = calloc(jctx->count, sizeof(*ctx->arrivals));
+	while (ctx->state != STATE_ERROR)
+	{
+		if (_src_readbatch(ctx) < 0)
+			ctx->state = STATE_ERROR;
+	}
 #endif
 	while (ctx->state != STATE_ERROR)
 	{
@@ -444,6 +1073,10 @@ static int src_start(src_ctx_t *ctx)
 static int src_run(src_ctx_t *ctx)
 {
 	src_wait(ctx);
+#ifdef SRC_UDP_PACKETMMAP
+	if (ctx->sock > 0 && ctx->addr->sa_family == AF_INET && _src_ringadd(ctx) == 0)
+		return 0;
+#endif
 	if (ctx->sock > 0)
 		src_start(ctx);
 	return 0;
@@ -528,6 +1161,10 @@ static void src_mdns(src_ctx_t *ctx, const char *host, struct rr_entry *entry)
 
 static void src_destroy(src_ctx_t *ctx)
 {
+#ifdef SRC_UDP_PACKETMMAP
+	if (ctx->ring != NULL)
+		_src_ringremove(ctx);
+#endif
 #ifdef UDP_THREAD
 	if (ctx->thread)
 		pthread_join(ctx->thread, NULL);
@@ -550,6 +1187,19 @@ static void src_destroy(src_ctx_t *ctx)
 		close(ctx->dumpfd);
 #endif
 	close(ctx->sock);
+#ifdef SRC_UDP_MMSG
+	free(ctx->batch);
+	free(ctx->msgs);
+	free(ctx->iovs);
+	free(ctx->controls);
+#endif
+#if defined(SRC_UDP_MMSG) || defined(SRC_UDP_PACKETMMAP)
+	free(ctx->arrivals);
+#endif
+#ifdef SRC_UDP_RTCP
+	if (ctx->rtcpsock > 0)
+		close(ctx->rtcpsock);
+#endif
 	free(ctx->host);
 	free(ctx);
 }
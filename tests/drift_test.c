@@ -0,0 +1,136 @@
+/**
+ * drift_test checks that the drift estimator of the sink moves the
+ * ratio of the player, and that this ratio holds the level of the
+ * jitter when the sender runs faster or slower than the device.
+ * With a skew measured by the sender reports, the level corrects only
+ * the residual drift. The reset at the end of the stream removes the
+ * correction from the player.
+ *
+ * The estimator runs on a simulated jitter and a simulated clock.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+/// only the estimator of sink_common.c is tested
+#undef SINK_UNIX
+#undef SINK_UDP
+#undef SINK_TINYALSA
+#undef SINK_FILE
+#undef SINK_ALSA
+#ifndef SINK_DRIFT
+#define SINK_DRIFT
+#endif
+#ifndef DEFAULT_SAMPLERATE
+#define DEFAULT_SAMPLERATE 44100
+#endif
+#include "../src/sink_common.c"
+
+/// 10 ms between two buffers
+#define TEST_PERIOD 10000000ULL
+/// 30 minutes of stream
+#define TEST_DURATION (30 * 60 * 1000000000ULL)
+#define TEST_BYTESPERSEC (DEFAULT_SAMPLERATE * 4)
+/// the residual drift accepted at the end of the stream
+#define TEST_TOLERANCE 20
+
+static int g_ratio = 0;
+static double g_level = 0;
+
+int player_ratio(player_ctx_t *ctx, int ppm)
+{
+	g_ratio += ppm;
+	if (g_ratio > PLAYER_RATIO_MAX)
+		g_ratio = PLAYER_RATIO_MAX;
+	if (g_ratio < -PLAYER_RATIO_MAX)
+		g_ratio = -PLAYER_RATIO_MAX;
+	return g_ratio;
+}
+
+unsigned int utils_format2framesize(jitter_format_t format)
+{
+	return 0;
+}
+
+static size_t _test_level(jitter_ctx_t *jitter)
+{
+	return (size_t)g_level;
+}
+
+static int _test_drift(int senderppm, int skew)
+{
+	jitter_ops_t ops = {.level = _test_level};
+	jitter_ctx_t jctx = {.count = 32, .size = 4096, .frequence = DEFAULT_SAMPLERATE};
+	jitter_t jitter = {.ops = &ops, .ctx = &jctx};
+	sink_drift_t drift = {.bytespersec = TEST_BYTESPERSEC, .skew = skew};
+	double capacity = jctx.count * jctx.size;
+	int moved = 0;
+
+	g_ratio = 0;
+	g_level = capacity / 2;
+	uint64_t now;
+	for (now = TEST_PERIOD; now < TEST_DURATION; now += TEST_PERIOD)
+	{
+		/**
+		 * the sender pushes faster with a positive drift,
+		 * the decoder consumes faster with a negative ratio.
+		 */
+		g_level += (double)TEST_BYTESPERSEC * TEST_PERIOD / 1000000000ULL
+				* (senderppm + g_ratio) / 1000000;
+		if (g_level < 0 || g_level > capacity)
+		{
+			fprintf(stderr, "drift %d ppm: jitter %s after %llus\n", senderppm,
+				(g_level < 0)? "empty" : "full",
+				(unsigned long long)(now / 1000000000ULL));
+			return -1;
+		}
+		int correction = sink_drift(&drift, NULL, &jitter, now);
+		if (skew != 0 && now == TEST_PERIOD && correction != skew)
+		{
+			fprintf(stderr, "drift %d ppm: skew %d ppm not sent to the player %d ppm\n",
+				senderppm, skew, correction);
+			return -1;
+		}
+		if (correction != g_ratio)
+		{
+			fprintf(stderr, "drift %d ppm: correction %d ppm not sent to the player %d ppm\n",
+				senderppm, correction, g_ratio);
+			return -1;
+		}
+		if (g_ratio != 0)
+			moved = 1;
+	}
+	if (senderppm != 0 && !moved)
+	{
+		fprintf(stderr, "drift %d ppm: the ratio of the player never moved\n", senderppm);
+		return -1;
+	}
+	if (senderppm + g_ratio > TEST_TOLERANCE || senderppm + g_ratio < -TEST_TOLERANCE)
+	{
+		fprintf(stderr, "drift %d ppm: ratio %d ppm\n", senderppm, g_ratio);
+		return -1;
+	}
+	printf("drift %d ppm skew %d ppm: ratio %d ppm level %.0f/%.0f\n", senderppm, skew, g_ratio, g_level, capacity);
+	/// the end of the stream gives back the ratio of the player
+	sink_driftreset(&drift, NULL);
+	if (g_ratio != 0)
+	{
+		fprintf(stderr, "drift %d ppm: ratio %d ppm after the reset\n", senderppm, g_ratio);
+		return -1;
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int ret = 0;
+	/// the sender drift and the skew measured by the sender reports
+	int drifts[][2] = {{0, 0}, {100, 0}, {-100, 0}, {300, 0}, {-300, 0}, {200, -180}, {-200, 220}};
+	int i;
+	for (i = 0; i < sizeof(drifts) / sizeof(drifts[0]); i++)
+	{
+		if (_test_drift(drifts[i][0], drifts[i][1]) < 0)
+			ret = -1;
+	}
+	return (ret < 0)? EXIT_FAILURE : EXIT_SUCCESS;
+}